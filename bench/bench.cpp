@@ -0,0 +1,425 @@
+#include "../src/bigint.h"
+#include "../src/object.h"
+#include "../src/parser.h"
+#include "../src/scheme.h"
+#include "../src/tokenizer.h"
+
+#include <sys/resource.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Every heap allocation of the process goes through these, so a benchmark can tell how many it makes per operation.
+// Objects taken from the interpreter's pools are not heap allocations and are not counted. All forms allocate with
+// `malloc` or `aligned_alloc` and release with `free`, so any of them may free memory of any other.
+namespace {
+std::atomic<uint64_t> allocation_count{0};
+
+void* Allocate(size_t size, size_t align = 0) noexcept {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    size = size == 0 ? 1 : size;
+    if (align == 0) {
+        return std::malloc(size);
+    }
+    return std::aligned_alloc(align, (size + align - 1) / align * align);
+}
+
+void* AllocateOrThrow(size_t size, size_t align = 0) {
+    if (auto ptr = Allocate(size, align)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+}  // namespace
+
+void* operator new(size_t size) {
+    return AllocateOrThrow(size);
+}
+
+void* operator new[](size_t size) {
+    return AllocateOrThrow(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    return AllocateOrThrow(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return AllocateOrThrow(size, static_cast<size_t>(alignment));
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return Allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return Allocate(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return Allocate(size, static_cast<size_t>(alignment));
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return Allocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    std::free(ptr);
+}
+
+namespace {
+
+//! A benchmark prepares its state once and returns a body, each run of which returns how many operations it did.
+struct Benchmark {
+    std::string name;
+    std::function<std::function<uint64_t()>()> setup;
+};
+
+struct Result {
+    std::string name;
+    uint64_t ops;
+    double ns_per_op;
+    double allocations_per_op;
+};
+
+Result Measure(const Benchmark& benchmark, double min_time) {
+    auto body = benchmark.setup();
+    // The first run warms up pools, caches and the symbol table and is not measured.
+    body();
+    uint64_t ops = 0;
+    auto allocations_before = allocation_count.load();
+    auto start = std::chrono::steady_clock::now();
+    std::chrono::duration<double> elapsed{0};
+    do {
+        ops += body();
+        elapsed = std::chrono::steady_clock::now() - start;
+    } while (elapsed.count() < min_time);
+    auto allocations = allocation_count.load() - allocations_before;
+    return {benchmark.name, ops, elapsed.count() * 1e9 / ops, static_cast<double>(allocations) / ops};
+}
+
+std::string Repeat(std::string_view part, size_t count) {
+    std::string result;
+    result.reserve(part.size() * count);
+    for (size_t i = 0; i < count; ++i) {
+        result += part;
+    }
+    return result;
+}
+
+std::string NumberList(size_t length) {
+    std::string result = "(";
+    for (size_t i = 0; i < length; ++i) {
+        result += std::to_string(i) + " ";
+    }
+    return result + ")";
+}
+
+//! Runs `expression` in an interpreter which has run `definitions` first.
+Benchmark Evaluation(std::string name, Engine engine, std::vector<std::string> definitions, std::string expression) {
+    return {name, [=] {
+                auto interpreter = std::make_shared<Interpreter>(engine);
+                for (const auto& definition : definitions) {
+                    interpreter->Run(definition);
+                }
+                return [=]() -> uint64_t {
+                    interpreter->Run(expression);
+                    return 1;
+                };
+            }};
+}
+
+std::vector<Benchmark> MakeBenchmarks() {
+    std::vector<Benchmark> benchmarks;
+
+    constexpr size_t kForms = 10000;
+    static constexpr std::string_view kForm = "(define (f x y) (if (< x y) (+ x 123456) '(alpha-beta gamma? 42)))\n";
+    benchmarks.push_back({"tokenizer/definitions", [] {
+                              auto text = std::make_shared<std::string>(Repeat(kForm, kForms));
+                              return [text] {
+                                  Tokenizer tokenizer(*text);
+                                  uint64_t tokens = 0;
+                                  for (; !tokenizer.IsEnd(); tokenizer.Next()) {
+                                      tokenizer.GetToken();
+                                      ++tokens;
+                                  }
+                                  return tokens;
+                              };
+                          }});
+
+    constexpr size_t kLongList = 10000;
+    benchmarks.push_back({"read/long_list", [] {
+                              auto text = std::make_shared<std::string>(NumberList(kLongList));
+                              return [text]() -> uint64_t {
+                                  Tokenizer tokenizer(*text);
+                                  Read(&tokenizer);
+                                  return kLongList;
+                              };
+                          }});
+
+    constexpr size_t kDeepList = 1000;
+    benchmarks.push_back({"read/deep_list", [] {
+                              auto text = std::make_shared<std::string>(Repeat("(1 ", kDeepList) +
+                                                                        Repeat(")", kDeepList));
+                              return [text]() -> uint64_t {
+                                  Tokenizer tokenizer(*text);
+                                  Read(&tokenizer);
+                                  return kDeepList;
+                              };
+                          }});
+
+    for (auto [engine, suffix] : {std::pair{Engine::TREE_WALKER, ""}, std::pair{Engine::BYTECODE, "/bytecode"}}) {
+        std::string tag = suffix;
+        std::string sum = "(+";
+        for (int i = 0; i < 100; ++i) {
+            sum += " " + std::to_string(i);
+        }
+        sum += ")";
+        benchmarks.push_back(Evaluation("eval/plus_fold_100" + tag, engine, {"(define (sum) " + sum + ")"}, "(sum)"));
+        benchmarks.push_back(Evaluation("eval/fib_20" + tag, engine,
+                                        {"(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))"},
+                                        "(fib 20)"));
+        benchmarks.push_back(Evaluation(
+            "eval/ackermann_2_9" + tag, engine,
+            {"(define (ack m n) (if (= m 0) (+ n 1) (if (= n 0) (ack (- m 1) 1) (ack (- m 1) (ack m (- n 1))))))"},
+            "(ack 2 9)"));
+        benchmarks.push_back(Evaluation(
+            "eval/cons_list_1000" + tag, engine,
+            {"(define (build n acc) (if (= n 0) acc (build (- n 1) (cons n acc))))"},
+            "(list-tail (build 1000 '()) 999)"));
+        benchmarks.push_back(Evaluation(
+            "eval/vector_sum_1000" + tag, engine,
+            {"(define v (make-vector 1000 1))",
+             "(define (vsum i acc) (if (= i 1000) acc (vsum (+ i 1) (+ acc (vector-ref v i)))))"},
+            "(vsum 0 0)"));
+        benchmarks.push_back(Evaluation(
+            "eval/map_filter_fold_1000" + tag, engine,
+            {"(define (build n acc) (if (= n 0) acc (build (- n 1) (cons n acc))))", "(define l (build 1000 '()))"},
+            "(fold-left + 0 (filter (lambda (x) (< x 500)) (map (lambda (x) (* x 3)) l)))"));
+        benchmarks.push_back(Evaluation("eval/sort_1000" + tag, engine,
+                                        {"(define (build n acc) (if (= n 0) acc (build (- n 1) (cons (- 500 "
+                                         "(abs (- (* n 7) 3500))) acc))))",
+                                         "(define l (build 1000 '()))"},
+                                        "(sort l <)"));
+        benchmarks.push_back(Evaluation(
+            "eval/constant_subexpressions_1000" + tag, engine,
+            {"(define (secs n acc) (if (= n 0) acc (secs (- n 1) (+ acc (* 60 60 24) (car '(1 2)) (if #t 1 2)))))"},
+            "(secs 1000 0)"));
+        benchmarks.push_back(Evaluation(
+            "eval/global_calls_1000" + tag, engine,
+            {"(define (inc x) (+ x 1))",
+             "(define (walk n acc) (if (= n 0) acc (walk (- n 1) (inc (car (cons acc '()))))))"},
+            "(walk 1000 0)"));
+        for (std::string define : {"define", "define-memoized"}) {
+            benchmarks.push_back(Evaluation(
+                "eval/scoring_1000/" + define + tag, engine,
+                {"(" + define + " (score a b) (fold-left + 0 (map (lambda (x) (* x a b)) '(1 2 3 4 5 6 7 8 9 10))))",
+                 "(define (run n acc) (if (= n 0) acc (run (- n 1) (+ acc (score (- n (* 10 (/ n 10))) 3)))))"},
+                "(run 1000 0)"));
+        }
+        benchmarks.push_back(Evaluation(
+            "eval/hash_table_dedup_1000" + tag, engine,
+            {"(define (dedup n t) (if (= n 0) (hash-table-count t) (dedup (- n 1) (mark t (- n (* 300 (/ n 300)))))))",
+             "(define (mark t k) (if (hash-table-contains? t k) t (hash-table-set! t k #t)) t)"},
+            "(dedup 1000 (make-hash-table))"));
+        benchmarks.push_back(Evaluation(
+            "eval/assoc_dedup_1000" + tag, engine,
+            {"(define (dedup n l) (if (= n 0) (length l) (dedup (- n 1) (mark l (- n (* 300 (/ n 300)))))))",
+             "(define (mark l k) (if (assoc k l) l (cons (cons k #t) l)))"},
+            "(dedup 1000 '())"));
+        // On a single core `pmap` only shows its overhead; elsewhere it should approach the number of cores.
+        for (std::string map : {"map", "pmap"}) {
+            benchmarks.push_back(Evaluation(
+                "eval/fib_16_x16/" + map + tag, engine,
+                {"(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))"},
+                "(" + map + " fib '(16 16 16 16 16 16 16 16 16 16 16 16 16 16 16 16))"));
+        }
+        benchmarks.push_back(Evaluation("eval/factorial_1000" + tag, engine,
+                                        {"(define (fact n acc) (if (= n 0) acc (fact (- n 1) (* acc n))))"},
+                                        "(fact 1000 1)"));
+    }
+
+    constexpr size_t kBigDigits = 10000;
+    benchmarks.push_back({"bigint/multiply_10000_digits", [] {
+                              auto lhs =
+                                  std::make_shared<BigInt>(BigInt::FromString(Repeat("1234567890", kBigDigits / 10)));
+                              auto rhs =
+                                  std::make_shared<BigInt>(BigInt::FromString(Repeat("9876543210", kBigDigits / 10)));
+                              return [lhs, rhs]() -> uint64_t {
+                                  auto product = *lhs * *rhs;
+                                  return product.IsZero() ? 0 : 1;
+                              };
+                          }});
+
+    constexpr size_t kSerializedList = 10000;
+    benchmarks.push_back({"serialize/long_list", [] {
+                              auto text = NumberList(kSerializedList);
+                              Tokenizer tokenizer(text);
+                              auto list = Read(&tokenizer);
+                              return [list]() -> uint64_t {
+                                  Serialize(list);
+                                  return kSerializedList;
+                              };
+                          }});
+
+    // Each request gets a fresh fork of an interpreter with a few hundred definitions.
+    constexpr size_t kPreparedDefinitions = 300;
+    auto prepare = [] {
+        auto interpreter = std::make_shared<Interpreter>();
+        interpreter->Run("(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))");
+        for (size_t i = 0; i < kPreparedDefinitions; ++i) {
+            interpreter->Run("(define (f" + std::to_string(i) + " x) (+ x " + std::to_string(i) + "))");
+        }
+        return interpreter;
+    };
+    benchmarks.push_back({"interpreter/fork_and_run", [prepare] {
+                              auto interpreter = prepare();
+                              return [interpreter]() -> uint64_t {
+                                  interpreter->Fork().Run("(f7 (fib 10))");
+                                  return 1;
+                              };
+                          }});
+    constexpr size_t kRequests = 64;
+    benchmarks.push_back({"interpreter/pool_64_requests", [prepare] {
+                              auto pool = std::make_shared<InterpreterPool>(prepare().get());
+                              return [pool]() -> uint64_t {
+                                  std::vector<std::future<std::string>> results;
+                                  for (size_t i = 0; i < kRequests; ++i) {
+                                      results.push_back(pool->Submit("(define x 5) (f7 (fib 10))"));
+                                  }
+                                  for (auto& result : results) {
+                                      result.get();
+                                  }
+                                  return kRequests;
+                              };
+                          }});
+    benchmarks.push_back({"interpreter/startup_from_source", [prepare] {
+                              return [prepare]() -> uint64_t {
+                                  prepare();
+                                  return 1;
+                              };
+                          }});
+    benchmarks.push_back({"interpreter/startup_from_image", [prepare] {
+                              auto path = (std::filesystem::temp_directory_path() / "scheme_bench.img").string();
+                              prepare()->SaveImage(path);
+                              return [path]() -> uint64_t {
+                                  Interpreter interpreter;
+                                  interpreter.LoadImage(path);
+                                  return 1;
+                              };
+                          }});
+
+    return benchmarks;
+}
+
+long PeakRssKb() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+std::string Escape(std::string_view s) {
+    std::string result;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            result += '\\';
+        }
+        result += c;
+    }
+    return result;
+}
+
+}  // namespace
+
+//! Usage: scheme_bench [--filter substring] [--min-time seconds]. Prints results as a JSON object.
+int main(int argc, char** argv) {
+    std::string filter;
+    double min_time = 0.5;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string_view flag = argv[i];
+        if (flag == "--filter") {
+            filter = argv[i + 1];
+        } else if (flag == "--min-time") {
+            min_time = std::atof(argv[i + 1]);
+        } else {
+            std::cerr << "Unknown flag " << flag << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<Result> results;
+    for (const auto& benchmark : MakeBenchmarks()) {
+        if (benchmark.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        results.push_back(Measure(benchmark, min_time));
+        std::cerr << benchmark.name << ": " << results.back().ns_per_op << " ns/op" << std::endl;
+    }
+
+    std::cout << "{\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        char line[512];
+        std::snprintf(line, sizeof(line),
+                      "    {\"name\": \"%s\", \"ops\": %llu, \"ns_per_op\": %.2f, \"allocations_per_op\": %.3f}%s\n",
+                      Escape(results[i].name).c_str(), static_cast<unsigned long long>(results[i].ops),
+                      results[i].ns_per_op, results[i].allocations_per_op, i + 1 < results.size() ? "," : "");
+        std::cout << line;
+    }
+    std::cout << "  ],\n  \"peak_rss_kb\": " << PeakRssKb() << "\n}" << std::endl;
+}
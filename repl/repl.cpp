@@ -2,19 +2,67 @@
 
 #include <exception>
 #include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+//! Runs every file, or standard input if there are none, as a script. Results are written to buffered output.
+int RunBatch(Interpreter* interpreter, const std::vector<std::string>& files) {
+    std::ios::sync_with_stdio(false);
+    try {
+        if (files.empty()) {
+            interpreter->RunStream(&std::cin, &std::cout);
+        }
+        for (const auto& file : files) {
+            interpreter->RunFile(file, &std::cout);
+        }
+    } catch (std::exception& e) {
+        std::cout.flush();
+        std::cerr << "[ERROR]: " << e.what() << std::endl;
+        return 1;
+    } catch (...) {
+        std::cout.flush();
+        std::cerr << "[ERROR]: Some error occured" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+    // `--bytecode` switches to the compiling engine. `--batch` or file arguments run whole scripts instead of reading
+    // one expression per line. Scripts are read line by line, each expression runs as soon as it is complete.
+    Engine engine = Engine::TREE_WALKER;
+    bool is_batch = false;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--bytecode") {
+            engine = Engine::BYTECODE;
+        } else if (arg == "--batch") {
+            is_batch = true;
+        } else {
+            files.emplace_back(arg);
+        }
+    }
+    Interpreter interpreter(engine);
+    if (is_batch || !files.empty()) {
+        return RunBatch(&interpreter, files);
+    }
 
-int main() {
-    Interpreter interpreter;
     std::string s;
     std::cout << "> ";
     while (std::getline(std::cin, s)) {
         try {
-            std::cout << interpreter.Run(s) << std::endl;
+            interpreter.Run(s, &std::cout);
+            std::cout << '\n';
         } catch (std::exception& e) {
             std::cerr << "[ERROR]: " << e.what() << std::endl;
         } catch (...) {
             std::cerr << "[ERROR]: Some error occured" << std::endl;
         }
+        // Reading from std::cin flushes the prompt.
         std::cout << "> ";
     }
 }
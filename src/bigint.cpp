@@ -0,0 +1,362 @@
+#include "bigint.h"
+
+#include <bit>
+#include <span>
+#include <utility>
+
+namespace {
+using Limbs = std::vector<uint32_t>;
+using LimbSpan = std::span<const uint32_t>;
+
+//! Products of operands shorter than this many limbs are computed by the schoolbook algorithm, which is faster for
+//! them than splitting further.
+constexpr size_t kKaratsubaThreshold = 32;
+
+//! Largest power of ten which fits into a limb, decimal conversions work with 9 digits at once.
+constexpr uint32_t kDecimalBase = 1'000'000'000;
+constexpr size_t kDecimalBaseDigits = 9;
+
+void Trim(Limbs* limbs) {
+    while (!limbs->empty() && limbs->back() == 0) {
+        limbs->pop_back();
+    }
+}
+
+LimbSpan Trimmed(LimbSpan limbs) {
+    while (!limbs.empty() && limbs.back() == 0) {
+        limbs = limbs.first(limbs.size() - 1);
+    }
+    return limbs;
+}
+
+//! Compares magnitudes without leading zero limbs.
+int CompareMagnitudes(LimbSpan lhs, LimbSpan rhs) {
+    if (lhs.size() != rhs.size()) {
+        return lhs.size() < rhs.size() ? -1 : 1;
+    }
+    for (size_t i = lhs.size(); i-- > 0;) {
+        if (lhs[i] != rhs[i]) {
+            return lhs[i] < rhs[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+//! Adds `value` to `result` starting at limb `offset`. `result` must be long enough to hold the sum.
+void AddAt(Limbs* result, LimbSpan value, size_t offset) {
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i < value.size(); ++i) {
+        carry += static_cast<uint64_t>((*result)[offset + i]) + value[i];
+        (*result)[offset + i] = static_cast<uint32_t>(carry);
+        carry >>= 32;
+    }
+    for (; carry != 0; ++i) {
+        carry += (*result)[offset + i];
+        (*result)[offset + i] = static_cast<uint32_t>(carry);
+        carry >>= 32;
+    }
+}
+
+//! Subtracts `value` from `result` starting at limb `offset`. The difference must not be negative.
+void SubtractAt(Limbs* result, LimbSpan value, size_t offset) {
+    int64_t borrow = 0;
+    size_t i = 0;
+    for (; i < value.size(); ++i) {
+        int64_t difference = static_cast<int64_t>((*result)[offset + i]) - value[i] - borrow;
+        (*result)[offset + i] = static_cast<uint32_t>(difference);
+        borrow = difference < 0;
+    }
+    for (; borrow != 0; ++i) {
+        int64_t difference = static_cast<int64_t>((*result)[offset + i]) - borrow;
+        (*result)[offset + i] = static_cast<uint32_t>(difference);
+        borrow = difference < 0;
+    }
+}
+
+Limbs AddMagnitudes(LimbSpan lhs, LimbSpan rhs) {
+    if (lhs.size() < rhs.size()) {
+        std::swap(lhs, rhs);
+    }
+    Limbs result(lhs.begin(), lhs.end());
+    result.push_back(0);
+    AddAt(&result, rhs, 0);
+    Trim(&result);
+    return result;
+}
+
+//! `lhs` must not be less than `rhs`.
+Limbs SubtractMagnitudes(LimbSpan lhs, LimbSpan rhs) {
+    Limbs result(lhs.begin(), lhs.end());
+    SubtractAt(&result, rhs, 0);
+    Trim(&result);
+    return result;
+}
+
+Limbs MultiplySchoolbook(LimbSpan lhs, LimbSpan rhs) {
+    Limbs result(lhs.size() + rhs.size(), 0);
+    for (size_t i = 0; i < lhs.size(); ++i) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < rhs.size(); ++j) {
+            // At most (2^32 - 1)^2 + 2 * (2^32 - 1), which is exactly 2^64 - 1.
+            carry += static_cast<uint64_t>(lhs[i]) * rhs[j] + result[i + j];
+            result[i + j] = static_cast<uint32_t>(carry);
+            carry >>= 32;
+        }
+        result[i + rhs.size()] = static_cast<uint32_t>(carry);
+    }
+    Trim(&result);
+    return result;
+}
+
+//! Karatsuba multiplication: with both operands split at `half` limbs into high and low parts, the middle part of the
+//! product is (low + high) * (low' + high') - low * low' - high * high', so three half-size products suffice instead
+//! of four.
+Limbs MultiplyMagnitudes(LimbSpan lhs, LimbSpan rhs) {
+    lhs = Trimmed(lhs);
+    rhs = Trimmed(rhs);
+    if (lhs.size() < rhs.size()) {
+        std::swap(lhs, rhs);
+    }
+    if (rhs.size() < kKaratsubaThreshold) {
+        return MultiplySchoolbook(lhs, rhs);
+    }
+    size_t half = lhs.size() / 2;
+    auto lhs_low = lhs.first(half);
+    auto lhs_high = lhs.subspan(half);
+    Limbs result(lhs.size() + rhs.size(), 0);
+    if (rhs.size() <= half) {
+        // Operands are unbalanced, only the longer one is split.
+        AddAt(&result, MultiplyMagnitudes(lhs_low, rhs), 0);
+        AddAt(&result, MultiplyMagnitudes(lhs_high, rhs), half);
+    } else {
+        auto rhs_low = rhs.first(half);
+        auto rhs_high = rhs.subspan(half);
+        auto low = MultiplyMagnitudes(lhs_low, rhs_low);
+        auto high = MultiplyMagnitudes(lhs_high, rhs_high);
+        auto middle = MultiplyMagnitudes(AddMagnitudes(lhs_low, lhs_high), AddMagnitudes(rhs_low, rhs_high));
+        SubtractAt(&middle, low, 0);
+        SubtractAt(&middle, high, 0);
+        Trim(&middle);
+        AddAt(&result, low, 0);
+        AddAt(&result, high, 2 * half);
+        AddAt(&result, middle, half);
+    }
+    Trim(&result);
+    return result;
+}
+
+//! Divides `limbs` by a single limb in place and returns the remainder.
+uint32_t DivideBySmall(Limbs* limbs, uint32_t divisor) {
+    uint64_t remainder = 0;
+    for (size_t i = limbs->size(); i-- > 0;) {
+        uint64_t current = (remainder << 32) | (*limbs)[i];
+        (*limbs)[i] = static_cast<uint32_t>(current / divisor);
+        remainder = current % divisor;
+    }
+    Trim(limbs);
+    return static_cast<uint32_t>(remainder);
+}
+
+void MultiplyAddSmall(Limbs* limbs, uint32_t factor, uint32_t addend) {
+    uint64_t carry = addend;
+    for (auto& limb : *limbs) {
+        carry += static_cast<uint64_t>(limb) * factor;
+        limb = static_cast<uint32_t>(carry);
+        carry >>= 32;
+    }
+    if (carry != 0) {
+        limbs->push_back(static_cast<uint32_t>(carry));
+    }
+}
+
+//! Shifts `limbs` left by `shift` < 32 bits into a buffer with `extra` more limbs.
+Limbs ShiftLeft(LimbSpan limbs, int shift, size_t extra) {
+    Limbs result(limbs.size() + extra, 0);
+    for (size_t i = 0; i < limbs.size(); ++i) {
+        result[i] |= limbs[i] << shift;
+        if (shift != 0) {
+            result[i + 1] |= limbs[i] >> (32 - shift);
+        }
+    }
+    return result;
+}
+
+//! Quotient of magnitudes without leading zero limbs by Knuth's algorithm D. The divisor must not be zero.
+Limbs DivideMagnitudes(LimbSpan dividend, LimbSpan divisor) {
+    if (CompareMagnitudes(dividend, divisor) < 0) {
+        return {};
+    }
+    if (divisor.size() == 1) {
+        Limbs quotient(dividend.begin(), dividend.end());
+        DivideBySmall(&quotient, divisor[0]);
+        return quotient;
+    }
+    // With the highest bit of the divisor set, a quotient limb estimated from the top limbs is at most two too large.
+    int shift = std::countl_zero(divisor.back());
+    auto v = ShiftLeft(divisor, shift, 1);
+    v.pop_back();
+    auto u = ShiftLeft(dividend, shift, 1);
+    size_t n = divisor.size();
+    Limbs quotient(dividend.size() - n + 1, 0);
+    for (size_t j = quotient.size(); j-- > 0;) {
+        uint64_t numerator = (static_cast<uint64_t>(u[j + n]) << 32) | u[j + n - 1];
+        uint64_t estimate = numerator / v[n - 1];
+        uint64_t rest = numerator % v[n - 1];
+        while (estimate > UINT32_MAX || estimate * v[n - 2] > ((rest << 32) | u[j + n - 2])) {
+            --estimate;
+            rest += v[n - 1];
+            if (rest > UINT32_MAX) {
+                break;
+            }
+        }
+        // u[j..j+n] -= estimate * v
+        int64_t borrow = 0;
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t product = estimate * v[i];
+            int64_t difference = static_cast<int64_t>(u[i + j]) - borrow - static_cast<int64_t>(product & UINT32_MAX);
+            u[i + j] = static_cast<uint32_t>(difference);
+            borrow = static_cast<int64_t>(product >> 32) - (difference >> 32);
+        }
+        int64_t difference = static_cast<int64_t>(u[j + n]) - borrow;
+        u[j + n] = static_cast<uint32_t>(difference);
+        if (difference < 0) {
+            // The estimate was still one too large, so v is added back.
+            --estimate;
+            uint64_t carry = 0;
+            for (size_t i = 0; i < n; ++i) {
+                carry += static_cast<uint64_t>(u[i + j]) + v[i];
+                u[i + j] = static_cast<uint32_t>(carry);
+                carry >>= 32;
+            }
+            u[j + n] += static_cast<uint32_t>(carry);
+        }
+        quotient[j] = static_cast<uint32_t>(estimate);
+    }
+    Trim(&quotient);
+    return quotient;
+}
+}  // namespace
+
+BigInt::BigInt(int64_t value) : is_negative_(value < 0) {
+    uint64_t magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : value;
+    for (; magnitude != 0; magnitude >>= 32) {
+        limbs_.push_back(static_cast<uint32_t>(magnitude));
+    }
+}
+
+BigInt::BigInt(bool is_negative, std::vector<uint32_t> limbs) : is_negative_(is_negative), limbs_(std::move(limbs)) {
+    Trim(&limbs_);
+    if (limbs_.empty()) {
+        is_negative_ = false;
+    }
+}
+
+BigInt BigInt::FromString(std::string_view text) {
+    bool is_negative = false;
+    if (!text.empty() && (text[0] == '+' || text[0] == '-')) {
+        is_negative = text[0] == '-';
+        text.remove_prefix(1);
+    }
+    // The first chunk is shorter, so that the rest have exactly `kDecimalBaseDigits` digits.
+    size_t chunk = text.size() % kDecimalBaseDigits;
+    if (chunk == 0) {
+        chunk = kDecimalBaseDigits;
+    }
+    Limbs limbs;
+    for (size_t position = 0; position < text.size(); position += chunk, chunk = kDecimalBaseDigits) {
+        uint32_t value = 0;
+        uint32_t scale = 1;
+        for (char c : text.substr(position, chunk)) {
+            value = value * 10 + (c - '0');
+            scale *= 10;
+        }
+        MultiplyAddSmall(&limbs, scale, value);
+    }
+    return BigInt(is_negative, std::move(limbs));
+}
+
+std::optional<int64_t> BigInt::ToInt64() const {
+    if (limbs_.size() > 2) {
+        return std::nullopt;
+    }
+    uint64_t magnitude = 0;
+    for (size_t i = limbs_.size(); i-- > 0;) {
+        magnitude = (magnitude << 32) | limbs_[i];
+    }
+    // Magnitude of the most negative value is one more than of the most positive one.
+    const uint64_t limit = is_negative_ ? static_cast<uint64_t>(INT64_MAX) + 1 : INT64_MAX;
+    if (magnitude > limit) {
+        return std::nullopt;
+    }
+    return static_cast<int64_t>(is_negative_ ? 0 - magnitude : magnitude);
+}
+
+size_t BigInt::Hash() const {
+    size_t hash = is_negative_;
+    for (auto limb : limbs_) {
+        hash = hash * 0x9e3779b97f4a7c15 + limb;
+    }
+    return hash;
+}
+
+std::string BigInt::ToString() const {
+    if (IsZero()) {
+        return "0";
+    }
+    auto rest = limbs_;
+    std::vector<uint32_t> chunks;
+    while (!rest.empty()) {
+        chunks.push_back(DivideBySmall(&rest, kDecimalBase));
+    }
+    std::string result = is_negative_ ? "-" : "";
+    result += std::to_string(chunks.back());
+    for (size_t i = chunks.size() - 1; i-- > 0;) {
+        auto digits = std::to_string(chunks[i]);
+        result.append(kDecimalBaseDigits - digits.size(), '0');
+        result += digits;
+    }
+    return result;
+}
+
+BigInt BigInt::operator-() const {
+    return BigInt(!is_negative_, limbs_);
+}
+
+BigInt BigInt::Abs() const {
+    return BigInt(false, limbs_);
+}
+
+BigInt operator+(const BigInt& lhs, const BigInt& rhs) {
+    if (lhs.is_negative_ == rhs.is_negative_) {
+        return BigInt(lhs.is_negative_, AddMagnitudes(lhs.limbs_, rhs.limbs_));
+    }
+    // Signs differ, so the magnitude is the difference and the sign is of the larger operand.
+    if (CompareMagnitudes(lhs.limbs_, rhs.limbs_) >= 0) {
+        return BigInt(lhs.is_negative_, SubtractMagnitudes(lhs.limbs_, rhs.limbs_));
+    }
+    return BigInt(rhs.is_negative_, SubtractMagnitudes(rhs.limbs_, lhs.limbs_));
+}
+
+BigInt operator-(const BigInt& lhs, const BigInt& rhs) {
+    return lhs + -rhs;
+}
+
+BigInt operator*(const BigInt& lhs, const BigInt& rhs) {
+    return BigInt(lhs.is_negative_ != rhs.is_negative_, MultiplyMagnitudes(lhs.limbs_, rhs.limbs_));
+}
+
+BigInt operator/(const BigInt& lhs, const BigInt& rhs) {
+    return BigInt(lhs.is_negative_ != rhs.is_negative_, DivideMagnitudes(lhs.limbs_, rhs.limbs_));
+}
+
+std::strong_ordering operator<=>(const BigInt& lhs, const BigInt& rhs) {
+    if (lhs.is_negative_ != rhs.is_negative_) {
+        return lhs.is_negative_ ? std::strong_ordering::less : std::strong_ordering::greater;
+    }
+    auto order = CompareMagnitudes(lhs.limbs_, rhs.limbs_);
+    if (lhs.is_negative_) {
+        order = -order;
+    }
+    return order <=> 0;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//! Arbitrary-precision integer stored as a sign and a magnitude in base 2^32 limbs, least significant first, without
+//! leading zero limbs. Zero has no limbs and is never negative, so equal values have equal representations.
+class BigInt {
+public:
+    BigInt() = default;
+    BigInt(int64_t value);
+
+    //! Parses an optional sign followed by decimal digits. The text must be valid, e.g. a checked token.
+    static BigInt FromString(std::string_view text);
+
+    bool IsZero() const {
+        return limbs_.empty();
+    }
+    bool IsNegative() const {
+        return is_negative_;
+    }
+    //! Returns the value if it fits into `int64_t`.
+    std::optional<int64_t> ToInt64() const;
+    std::string ToString() const;
+    size_t Hash() const;
+
+    BigInt operator-() const;
+    BigInt Abs() const;
+
+    friend BigInt operator+(const BigInt& lhs, const BigInt& rhs);
+    friend BigInt operator-(const BigInt& lhs, const BigInt& rhs);
+    //! Uses Karatsuba's algorithm when both operands are long enough.
+    friend BigInt operator*(const BigInt& lhs, const BigInt& rhs);
+    //! Rounds towards zero like `/` on built-in integers. The divisor must not be zero.
+    friend BigInt operator/(const BigInt& lhs, const BigInt& rhs);
+
+    friend bool operator==(const BigInt& lhs, const BigInt& rhs) = default;
+    friend std::strong_ordering operator<=>(const BigInt& lhs, const BigInt& rhs);
+
+private:
+    BigInt(bool is_negative, std::vector<uint32_t> limbs);
+
+    bool is_negative_ = false;
+    std::vector<uint32_t> limbs_;
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "object.h"
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+enum class OpCode : uint8_t {
+    CONSTANT,             // push constants[arg]
+    LOCAL,                // push slot `arg` of the frame `depth` levels up
+    GLOBAL,               // push value of symbol `arg` looked up by name
+    GLOBAL_REF,           // push value of the `GlobalRef` in constants[arg], looked up through its cache
+    DEFINE_LOCAL,         // pop value into slot `arg` of the frame `depth` levels up, push its name
+    DEFINE_GLOBAL,        // pop value, define symbol `arg` in the current context, push the symbol
+    SET_LOCAL,            // pop value, assign local variable, push the old value
+    SET_GLOBAL,           // pop value, assign symbol `arg`, push the old value
+    POP,                  // drop top of the stack
+    JUMP,                 // continue at `arg`
+    JUMP_IF_FALSE,        // pop condition, continue at `arg` if it is #f
+    JUMP_IF_FALSE_OR_POP, // continue at `arg` keeping top if it is #f, pop it otherwise
+    JUMP_IF_TRUE_OR_POP,  // continue at `arg` keeping top if it is not #f, pop it otherwise
+    MAKE_CLOSURE,         // push closure of functions[arg] over the current context
+    CALL,                 // call function below `arg` arguments, replace all of them with the result
+    TAIL_CALL,            // same as CALL, but a compiled callee replaces the current frame
+    EVAL,                 // push result of tree-walking evaluation of constants[arg]
+    RETURN,               // pop result and return it to the caller
+};
+
+struct Instruction {
+    OpCode opcode;
+    uint16_t depth = 0;
+    uint32_t arg = 0;
+};
+
+//! Compiled body of a lambda or of a top-level expression.
+struct CodeObject {
+    std::vector<Instruction> instructions;
+    std::vector<ObjectPtr> constants;
+    std::vector<std::shared_ptr<const CodeObject>> functions;
+    //! Frame layout of the lambda, nullptr for top-level code which runs right in the given context.
+    std::shared_ptr<const LambdaTemplate> layout;
+    //! Value of `special_forms_epoch` when the code was made. Special forms are compiled as they were bound then, so
+    //! once one is rebound, calls of the lambda fall back to walking its template.
+    uint64_t epoch = special_forms_epoch.load(std::memory_order_relaxed);
+};
+
+//! Lambda compiled to bytecode.
+struct Closure : public Procedure, public Collectable {
+    Closure() : Procedure(ObjectType::CLOSURE) {
+    }
+
+    std::shared_ptr<const CodeObject> code;
+    std::shared_ptr<Context> context;
+    virtual ObjectPtr Call(std::span<const ObjectPtr> args) const override;
+
+    virtual void Trace(const std::function<void(Collectable*)>& visit) const override;
+    virtual void Clear() override;
+    virtual long UseCount() const override;
+    virtual std::shared_ptr<const void> Retain() const override;
+};
+DECLARE_TYPE_RANGE(Closure, CLOSURE, CLOSURE);
+
+//! Compiles expression returned by `Read` for evaluation in `context`.
+std::shared_ptr<const CodeObject> Compile(const ObjectPtr& ast, const std::shared_ptr<Context>& context);
+
+//! Runs compiled code in `context` until it returns.
+ObjectPtr Execute(std::shared_ptr<const CodeObject> code, const std::shared_ptr<Context>& context);
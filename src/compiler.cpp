@@ -0,0 +1,247 @@
+#include "bytecode.h"
+
+#include "error.h"
+#include "object.h"
+#include "operations.h"
+#include "resolver.h"
+
+#include <memory>
+#include <vector>
+
+namespace {
+
+class Compiler {
+public:
+    Compiler(const std::shared_ptr<Context>& context) : context_(context) {
+    }
+
+    std::shared_ptr<const CodeObject> CompileTopLevel(const ObjectPtr& ast) {
+        auto code = std::make_shared<CodeObject>();
+        Compile(ast, code.get(), true);
+        Emit(code.get(), OpCode::RETURN);
+        return code;
+    }
+
+    std::shared_ptr<const CodeObject> CompileLambda(const std::shared_ptr<const LambdaTemplate>& lambda) {
+        auto code = std::make_shared<CodeObject>();
+        code->layout = lambda;
+        if (lambda->commands.empty()) {
+            Emit(code.get(), OpCode::CONSTANT, AddConstant(code.get(), nullptr));
+        }
+        for (size_t i = 0; i < lambda->commands.size(); ++i) {
+            if (i != 0) {
+                Emit(code.get(), OpCode::POP);
+            }
+            Compile(lambda->commands[i], code.get(), i + 1 == lambda->commands.size());
+        }
+        Emit(code.get(), OpCode::RETURN);
+        return code;
+    }
+
+private:
+    static size_t Emit(CodeObject* code, OpCode opcode, uint32_t arg = 0, uint16_t depth = 0) {
+        code->instructions.push_back(Instruction{opcode, depth, arg});
+        return code->instructions.size() - 1;
+    }
+
+    static void PatchJump(CodeObject* code, size_t jump) {
+        code->instructions[jump].arg = code->instructions.size();
+    }
+
+    static uint32_t AddConstant(CodeObject* code, ObjectPtr value) {
+        code->constants.emplace_back(std::move(value));
+        return code->constants.size() - 1;
+    }
+
+    //! Checks if `head` names the special form `T`. Heads in lambda bodies are resolved to `GlobalRef`s.
+    template <class T>
+    bool IsKeyword(const ObjectPtr& head) const {
+        SymbolId id;
+        if (auto symbol = Borrow<Symbol>(head)) {
+            id = symbol->GetId();
+        } else if (auto ref = Borrow<GlobalRef>(head)) {
+            id = ref->GetId();
+        } else {
+            return false;
+        }
+        Context* holder;
+        auto binding = context_->Find(id, &holder);
+        return binding != nullptr && Is<T>(holder->Load(*binding));
+    }
+
+    static bool ToVector(ObjectPtr list, std::vector<ObjectPtr>* result) {
+        for (; Is<Cell>(list); list = Borrow<Cell>(list)->GetSecond()) {
+            result->emplace_back(Borrow<Cell>(list)->GetFirst());
+        }
+        return list == nullptr;
+    }
+
+    //! Leaves the expression to the tree walker, which also reports errors of malformed special forms.
+    void CompileFallback(const ObjectPtr& expr, CodeObject* code) {
+        Emit(code, OpCode::EVAL, AddConstant(code, expr));
+    }
+
+    void CompileClosure(const std::shared_ptr<const LambdaTemplate>& lambda, CodeObject* code) {
+        code->functions.emplace_back(CompileLambda(lambda));
+        Emit(code, OpCode::MAKE_CLOSURE, code->functions.size() - 1);
+    }
+
+    //! Compiles `expr` so that it pushes its value. Calls in tail position reuse the current frame.
+    void Compile(const ObjectPtr& expr, CodeObject* code, bool is_tail = false) {
+        if (Is<Integer>(expr) || Is<Boolean>(expr) || Is<Vector>(expr)) {
+            Emit(code, OpCode::CONSTANT, AddConstant(code, expr));
+        } else if (Is<Symbol>(expr)) {
+            Emit(code, OpCode::GLOBAL, Borrow<Symbol>(expr)->GetId());
+        } else if (Is<GlobalRef>(expr)) {
+            Emit(code, OpCode::GLOBAL_REF, AddConstant(code, expr));
+        } else if (Is<LocalRef>(expr)) {
+            auto ref = As<LocalRef>(expr);
+            Emit(code, OpCode::LOCAL, ref->GetSlot(), ref->GetDepth());
+        } else if (Is<LambdaExpr>(expr)) {
+            CompileClosure(Borrow<LambdaExpr>(expr)->GetCode(), code);
+        } else if (Is<Cell>(expr)) {
+            CompileForm(expr, code, is_tail);
+        } else {
+            CompileFallback(expr, code);
+        }
+    }
+
+    void CompileForm(const ObjectPtr& expr, CodeObject* code, bool is_tail) {
+        auto head = Borrow<Cell>(expr)->GetFirst();
+        std::vector<ObjectPtr> args;
+        if (!ToVector(Borrow<Cell>(expr)->GetSecond(), &args)) {
+            CompileFallback(expr, code);
+            return;
+        }
+        if (IsKeyword<QuoteOp>(head)) {
+            if (args.size() != 1) {
+                CompileFallback(expr, code);
+                return;
+            }
+            Emit(code, OpCode::CONSTANT, AddConstant(code, args[0]));
+        } else if (IsKeyword<IfOp>(head)) {
+            if (args.size() != 2 && args.size() != 3) {
+                CompileFallback(expr, code);
+                return;
+            }
+            Compile(args[0], code);
+            auto to_else = Emit(code, OpCode::JUMP_IF_FALSE);
+            Compile(args[1], code, is_tail);
+            auto to_end = Emit(code, OpCode::JUMP);
+            PatchJump(code, to_else);
+            if (args.size() == 3) {
+                Compile(args[2], code, is_tail);
+            } else {
+                Emit(code, OpCode::CONSTANT, AddConstant(code, nullptr));
+            }
+            PatchJump(code, to_end);
+        } else if (IsKeyword<AndOp>(head) || IsKeyword<OrOp>(head)) {
+            bool is_and = IsKeyword<AndOp>(head);
+            std::vector<size_t> to_end;
+            for (size_t i = 0; i < args.size(); ++i) {
+                Compile(args[i], code, is_tail && i + 1 == args.size());
+                to_end.push_back(Emit(code, is_and ? OpCode::JUMP_IF_FALSE_OR_POP : OpCode::JUMP_IF_TRUE_OR_POP));
+            }
+            // The last value is the result as is: the only false value is #f, which is what `or` yields anyway.
+            if (!to_end.empty()) {
+                code->instructions.pop_back();
+                to_end.pop_back();
+            } else {
+                Emit(code, OpCode::CONSTANT, AddConstant(code, MakeBoolean(is_and)));
+            }
+            for (auto jump : to_end) {
+                PatchJump(code, jump);
+            }
+        } else if (IsKeyword<LambdaOp>(head)) {
+            if (args.size() < 2) {
+                CompileFallback(expr, code);
+                return;
+            }
+            CompileClosure(ResolveLambda(args[0], {args.begin() + 1, args.end()}, context_), code);
+        } else if (IsKeyword<FutureOp>(head)) {
+            if (args.size() != 1) {
+                CompileFallback(expr, code);
+                return;
+            }
+            Emit(code, OpCode::CONSTANT, AddConstant(code, std::make_shared<SpawnFutureOp>()));
+            // Inside lambdas the expression is resolved to a lambda already, at the top level it is not.
+            if (Is<LambdaExpr>(args[0])) {
+                Compile(args[0], code);
+            } else {
+                CompileClosure(ResolveLambda(nullptr, {&args[0], 1}, context_), code);
+            }
+            Emit(code, OpCode::CALL, 1);
+        } else if (IsKeyword<DefineOp>(head)) {
+            CompileDefine(expr, args, code);
+        } else if (IsKeyword<SetOp>(head)) {
+            if (args.size() != 2 || !(Is<Symbol>(args[0]) || Is<LocalRef>(args[0]))) {
+                CompileFallback(expr, code);
+                return;
+            }
+            Compile(args[1], code);
+            if (Is<Symbol>(args[0])) {
+                Emit(code, OpCode::SET_GLOBAL, Borrow<Symbol>(args[0])->GetId());
+            } else {
+                auto ref = As<LocalRef>(args[0]);
+                Emit(code, OpCode::SET_LOCAL, ref->GetSlot(), ref->GetDepth());
+            }
+        } else if (IsKeyword<Function>(head) && !IsKeyword<Procedure>(head)) {
+            // Any other special form.
+            CompileFallback(expr, code);
+        } else {
+            Compile(head, code);
+            for (const auto& arg : args) {
+                Compile(arg, code);
+            }
+            Emit(code, is_tail ? OpCode::TAIL_CALL : OpCode::CALL, args.size());
+        }
+    }
+
+    void CompileDefine(const ObjectPtr& expr, const std::vector<ObjectPtr>& args, CodeObject* code) {
+        if (args.empty()) {
+            CompileFallback(expr, code);
+            return;
+        }
+        ObjectPtr target = args[0];
+        bool is_function = Is<Cell>(target);
+        if (is_function) {
+            // Function definition at the top level, its body was not resolved yet.
+            target = Borrow<Cell>(target)->GetFirst();
+            if (!Is<Symbol>(target)) {
+                CompileFallback(expr, code);
+                return;
+            }
+        } else if (args.size() != 2 || !(Is<Symbol>(target) || Is<LocalRef>(target))) {
+            CompileFallback(expr, code);
+            return;
+        }
+        // `define-memoized` binds the value wrapped by `memoize`.
+        bool is_memoized = IsKeyword<DefineMemoizedOp>(Borrow<Cell>(expr)->GetFirst());
+        if (is_memoized) {
+            Emit(code, OpCode::CONSTANT, AddConstant(code, std::make_shared<MemoizeOp>()));
+        }
+        if (is_function) {
+            CompileClosure(ResolveLambda(Borrow<Cell>(args[0])->GetSecond(), {args.begin() + 1, args.end()}, context_),
+                           code);
+        } else {
+            Compile(args[1], code);
+        }
+        if (is_memoized) {
+            Emit(code, OpCode::CALL, 1);
+        }
+        if (Is<Symbol>(target)) {
+            Emit(code, OpCode::DEFINE_GLOBAL, Borrow<Symbol>(target)->GetId());
+        } else {
+            auto ref = As<LocalRef>(target);
+            Emit(code, OpCode::DEFINE_LOCAL, ref->GetSlot(), ref->GetDepth());
+        }
+    }
+
+    std::shared_ptr<Context> context_;
+};
+
+}  // namespace
+
+std::shared_ptr<const CodeObject> Compile(const ObjectPtr& ast, const std::shared_ptr<Context>& context) {
+    return Compiler(context).CompileTopLevel(ast);
+}
@@ -0,0 +1,35 @@
+#include "concurrency.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <thread>
+
+namespace {
+constexpr int kLockBits = 8;
+
+//! Each lock takes a cache line of its own, so threads taking different locks do not slow each other down.
+struct alignas(64) PaddedLock {
+    concurrency::SpinLock lock;
+};
+
+std::array<PaddedLock, size_t{1} << kLockBits> locks;
+
+std::atomic<uint64_t> last_owner{0};
+}  // namespace
+
+uint64_t concurrency::NewOwner() {
+    return last_owner.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+void concurrency::SpinLock::Pause() {
+    // The holder may be preempted, let it run instead of burning the time slice.
+    std::this_thread::yield();
+}
+
+concurrency::SpinLock& concurrency::LockFor(const void* address) {
+    auto hash = std::hash<const void*>()(address) * 0x9e3779b97f4a7c15;
+    return locks[hash >> (64 - kLockBits)].lock;
+}
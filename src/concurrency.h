@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+//! Interpreter state is shared by parallel tasks (see `TaskPool`) only while some of them run. Single-threaded code
+//! checks `IsParallel()` and skips all synchronization otherwise, so it does not pay for tasks it never starts.
+//! Interpreters run by an `InterpreterPool` share only frozen contexts and what those refer to, so bindings need no
+//! locks for them, but process-wide structures such as the symbol table do; those check `IsConcurrent()`.
+//!
+//! Every context belongs to the code which created it: a parallel task, or the code running outside of tasks. While
+//! tasks run, only the owner may change bindings of a context, and it does so under a lock; others read them under the
+//! same lock. Owners read their own contexts without locking, since nobody else may change them.
+namespace concurrency {
+
+//! Number of tasks which were submitted and did not finish yet. Incremented before a task becomes visible to other
+//! threads and decremented only after it released everything it used.
+inline std::atomic<size_t> active_tasks{0};
+
+inline bool IsParallel() {
+    return active_tasks.load(std::memory_order_acquire) != 0;
+}
+
+//! Number of interpreter pools alive, whose workers run interpreters at the same time.
+inline std::atomic<size_t> active_pools{0};
+
+//! Whether other threads may use interpreter objects now, either as parallel tasks or as workers of a pool.
+inline bool IsConcurrent() {
+    return IsParallel() || active_pools.load(std::memory_order_acquire) != 0;
+}
+
+//! Owner of contexts created by code running on this thread: 0 outside of tasks, the task's own id inside one.
+inline thread_local uint64_t current_owner = 0;
+
+//! Returns an owner id which was never returned before.
+uint64_t NewOwner();
+
+//! Lock for critical sections of a few instructions, which are not worth putting a thread to sleep.
+class SpinLock {
+public:
+    void lock() {
+        while (flag_.test_and_set(std::memory_order_acquire)) {
+            Pause();
+        }
+    }
+    void unlock() {
+        flag_.clear(std::memory_order_release);
+    }
+
+private:
+    static void Pause();
+
+    std::atomic_flag flag_ = ATOMIC_FLAG_INIT;
+};
+
+//! Returns one of a fixed set of locks chosen by `address`, which guards small pieces of shared data such as a single
+//! binding. Different addresses may share a lock, so no other lock may be taken while holding one.
+SpinLock& LockFor(const void* address);
+
+//! Locks `mutex` only while other threads may use interpreter objects.
+template <class Mutex>
+std::unique_lock<Mutex> LockIfConcurrent(Mutex& mutex) {
+    return IsConcurrent() ? std::unique_lock<Mutex>(mutex) : std::unique_lock<Mutex>(mutex, std::defer_lock);
+}
+
+//! Copy of `ptr` which another thread may assign concurrently under `LockFor(&ptr)`.
+template <class T>
+std::shared_ptr<T> LoadShared(const std::shared_ptr<T>& ptr) {
+    std::lock_guard lock(LockFor(&ptr));
+    return ptr;
+}
+
+//! Assigns `value` to `ptr` under `LockFor(&ptr)` and returns the previous value, which is released by the caller
+//! outside of the lock.
+template <class T>
+std::shared_ptr<T> ExchangeShared(std::shared_ptr<T>& ptr, std::shared_ptr<T> value) {
+    {
+        std::lock_guard lock(LockFor(&ptr));
+        ptr.swap(value);
+    }
+    return value;
+}
+
+}  // namespace concurrency
@@ -0,0 +1,250 @@
+#include "gc.h"
+
+#include "concurrency.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+//! Collection runs once created collectables outnumber the survivors of the previous one, so its cost is amortized
+//! over allocations.
+constexpr size_t kMinCollectionThreshold = 10000;
+
+}  // namespace
+
+struct CollectableRegistry {
+    //! Taken only while other threads may use collectables; one may be destroyed on another thread than it was
+    //! created on.
+    std::mutex mutex;
+    Collectable* head = nullptr;
+    size_t size = 0;
+    //! Tasks of the owning thread create collectables and check the counters too. Changes are made under the mutex
+    //! when that may happen, so atomics are only needed to read them, and plain loads and stores suffice.
+    std::atomic<size_t> created_since_collection = 0;
+    std::atomic<size_t> threshold = kMinCollectionThreshold;
+    //! Unfinished tasks which register collectables here.
+    std::atomic<size_t> active_tasks = 0;
+};
+
+namespace {
+
+struct Registries {
+    std::mutex mutex;
+    //! Registries of all running threads which created a collectable, and of finished ones whose objects outlive them.
+    std::vector<CollectableRegistry*> all;
+    //! Registries of finished threads which still have collectables. New threads take them over instead of creating
+    //! registries of their own, so their number stays bounded by the number of threads running at once.
+    std::vector<CollectableRegistry*> spare;
+};
+
+Registries& GetRegistries() {
+    static Registries registries;
+    return registries;
+}
+
+// Constant-initialized, so that accesses need no guard.
+thread_local CollectableRegistry* thread_registry = nullptr;
+
+//! Registry of the thread, which is freed or left to other threads once it exits.
+struct RegistryOwner {
+    CollectableRegistry* registry = nullptr;
+
+    ~RegistryOwner() {
+        auto& registries = GetRegistries();
+        std::lock_guard lock(registries.mutex);
+        {
+            std::lock_guard registry_lock(registry->mutex);
+            if (registry->size != 0 || registry->active_tasks.load(std::memory_order_acquire) != 0) {
+                registries.spare.push_back(registry);
+                registry = nullptr;
+            }
+        }
+        if (registry != nullptr) {
+            std::erase(registries.all, registry);
+            delete registry;
+        }
+        thread_registry = nullptr;
+    }
+};
+
+}  // namespace
+
+CollectableRegistry* GetThreadRegistry() {
+    if (thread_registry == nullptr) [[unlikely]] {
+        static thread_local RegistryOwner owner;
+        auto& registries = GetRegistries();
+        std::lock_guard lock(registries.mutex);
+        if (!registries.spare.empty()) {
+            owner.registry = registries.spare.back();
+            registries.spare.pop_back();
+        } else {
+            owner.registry = new CollectableRegistry();
+            registries.all.push_back(owner.registry);
+        }
+        thread_registry = owner.registry;
+    }
+    return thread_registry;
+}
+
+void BeginTask(CollectableRegistry* registry) {
+    registry->active_tasks.fetch_add(1, std::memory_order_relaxed);
+}
+
+void EndTask(CollectableRegistry* registry) {
+    registry->active_tasks.fetch_sub(1, std::memory_order_release);
+}
+
+RegistryActivation::RegistryActivation(CollectableRegistry* registry) : previous_(thread_registry) {
+    thread_registry = registry;
+}
+
+RegistryActivation::~RegistryActivation() {
+    thread_registry = previous_;
+}
+
+Collectable::Collectable() : registry_(GetThreadRegistry()) {
+    auto lock = concurrency::LockIfConcurrent(registry_->mutex);
+    Link();
+    auto& created = registry_->created_since_collection;
+    created.store(created.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+Collectable::Collectable(const Collectable&) : Collectable() {
+}
+
+Collectable& Collectable::operator=(const Collectable&) {
+    return *this;
+}
+
+Collectable::~Collectable() {
+    auto lock = concurrency::LockIfConcurrent(registry_->mutex);
+    Unlink();
+}
+
+void Collectable::Link() {
+    next_ = registry_->head;
+    if (next_ != nullptr) {
+        next_->prev_ = this;
+    }
+    registry_->head = this;
+    ++registry_->size;
+}
+
+void Collectable::Unlink() {
+    if (prev_ != nullptr) {
+        prev_->next_ = next_;
+    } else {
+        registry_->head = next_;
+    }
+    if (next_ != nullptr) {
+        next_->prev_ = prev_;
+    }
+    --registry_->size;
+}
+
+size_t Collectable::CollectCycles(const std::vector<CollectableRegistry*>& registries, bool is_shared) {
+    std::vector<Collectable*> nodes;
+    // Other threads may release shared collectables meanwhile, so those are retained first; ones which are being
+    // destroyed already can not be referenced by anything and are skipped.
+    std::vector<std::shared_ptr<const void>> retained;
+    for (auto registry : registries) {
+        std::lock_guard lock(registry->mutex);
+        for (auto node = registry->head; node != nullptr; node = node->next_) {
+            if (is_shared) {
+                auto reference = node->Retain();
+                if (reference == nullptr) {
+                    continue;
+                }
+                retained.push_back(std::move(reference));
+            }
+            node->gc_refs_ = node->UseCount() - (is_shared ? 1 : 0);
+            node->is_reachable_ = false;
+            nodes.push_back(node);
+        }
+    }
+    // Collectables of other registries are neither counted nor traversed, another thread may be collecting them.
+    auto registry = is_shared ? registries.front() : nullptr;
+    auto is_counted = [is_shared, registry](Collectable* node) { return !is_shared || node->registry_ == registry; };
+    for (auto node : nodes) {
+        node->Trace([&is_counted](Collectable* child) {
+            if (is_counted(child)) {
+                --child->gc_refs_;
+            }
+        });
+    }
+
+    // Objects which are not owned by a shared pointer at all are still being constructed, treat them as roots too.
+    std::vector<Collectable*> stack;
+    for (auto node : nodes) {
+        if (node->gc_refs_ > 0 || node->UseCount() == 0) {
+            node->is_reachable_ = true;
+            stack.push_back(node);
+        }
+    }
+    while (!stack.empty()) {
+        auto node = stack.back();
+        stack.pop_back();
+        node->Trace([&stack, &is_counted](Collectable* child) {
+            if (is_counted(child) && !child->is_reachable_) {
+                child->is_reachable_ = true;
+                stack.push_back(child);
+            }
+        });
+    }
+
+    std::vector<std::shared_ptr<const void>> garbage;
+    std::vector<Collectable*> garbage_nodes;
+    for (auto node : nodes) {
+        if (!node->is_reachable_) {
+            if (!is_shared) {
+                garbage.push_back(node->Retain());
+            }
+            garbage_nodes.push_back(node);
+        }
+    }
+    for (auto node : garbage_nodes) {
+        node->Clear();
+    }
+    auto freed = garbage_nodes.size();
+    garbage_nodes.clear();
+    garbage.clear();
+    retained.clear();
+
+    size_t survivors = 0;
+    for (auto registry : registries) {
+        std::lock_guard lock(registry->mutex);
+        survivors += registry->size;
+    }
+    for (auto registry : registries) {
+        registry->created_since_collection.store(0, std::memory_order_relaxed);
+        registry->threshold.store(std::max(kMinCollectionThreshold, survivors), std::memory_order_relaxed);
+    }
+    return freed;
+}
+
+size_t CollectGarbage() {
+    if (concurrency::IsConcurrent()) {
+        auto registry = GetThreadRegistry();
+        if (registry->active_tasks.load(std::memory_order_acquire) != 0) {
+            return 0;
+        }
+        return Collectable::CollectCycles({registry}, true);
+    }
+    auto& registries = GetRegistries();
+    std::lock_guard lock(registries.mutex);
+    return Collectable::CollectCycles(registries.all, false);
+}
+
+void CollectGarbageIfNeeded() {
+    // Only collectables of the current thread are counted, which keeps the check free of shared data.
+    auto registry = GetThreadRegistry();
+    if (registry->created_since_collection.load(std::memory_order_relaxed) >=
+        registry->threshold.load(std::memory_order_relaxed)) {
+        CollectGarbage();
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+//! Collectables created by one thread and the tasks it started.
+struct CollectableRegistry;
+
+//! Objects are owned by reference counting, which can not reclaim cycles such as a lambda defined in a context that
+//! refers back to it. Every object which may take part in a cycle is a `Collectable` and is known to the collector.
+//! Collection counts references between collectables; those with more owners than that are referenced from outside
+//! (C++ locals, interpreters, evaluation stacks) and are roots. Collectables not reachable from roots are garbage
+//! cycles, which are broken so that reference counting frees them.
+//!
+//! Each thread registers collectables it creates in a registry of its own, and tasks in the registry of the thread
+//! which started them. While other threads use interpreter objects, registries are locked and collection of all of
+//! them does not happen, since it needs every thread to stay away from the objects. Workers of interpreter pools do not
+//! share objects they create, so each of them collects its own registry meanwhile unless its tasks run; its
+//! collectables referenced by other threads' ones count as referenced from outside.
+class Collectable {
+public:
+    Collectable();
+    Collectable(const Collectable&);
+    Collectable& operator=(const Collectable&);
+    virtual ~Collectable();
+
+    //! Calls `visit` with each collectable this one holds an owning reference to, once per reference.
+    virtual void Trace(const std::function<void(Collectable*)>& visit) const = 0;
+    //! Drops all references this object holds.
+    virtual void Clear() = 0;
+    //! Number of owning references to this object.
+    virtual long UseCount() const = 0;
+    //! Owning reference to this object, which keeps it alive while the collector breaks cycles. Empty if the object is
+    //! being destroyed or is not owned by a shared pointer yet.
+    virtual std::shared_ptr<const void> Retain() const = 0;
+
+private:
+    friend size_t CollectGarbage();
+
+    //! Collects cycles among collectables of `registries`. If other threads may use them, `is_shared` is set and
+    //! references from other registries are treated as references from outside.
+    static size_t CollectCycles(const std::vector<CollectableRegistry*>& registries, bool is_shared);
+
+    void Link();
+    void Unlink();
+
+    CollectableRegistry* registry_;
+    Collectable* prev_ = nullptr;
+    Collectable* next_ = nullptr;
+    // References to a single object never come close to 2^31, so the counter leaves room for the flag in a word.
+    int32_t gc_refs_ = 0;
+    bool is_reachable_ = false;
+};
+
+//! Registry which collectables created on this thread go to.
+CollectableRegistry* GetThreadRegistry();
+
+//! Sends collectables created on this thread to another registry for its lifetime. Parallel tasks use it to register
+//! what they create with the thread which started them, which collects those later.
+class RegistryActivation {
+public:
+    explicit RegistryActivation(CollectableRegistry* registry);
+    ~RegistryActivation();
+
+    RegistryActivation(const RegistryActivation&) = delete;
+    RegistryActivation& operator=(const RegistryActivation&) = delete;
+
+private:
+    CollectableRegistry* previous_;
+};
+
+//! Marks a parallel task which registers collectables in `registry` as started or finished. Collectables of a registry
+//! are not collected while it has unfinished tasks, since those may use them.
+void BeginTask(CollectableRegistry* registry);
+void EndTask(CollectableRegistry* registry);
+
+//! Reclaims all unreachable cycles and returns how many collectables were freed. While other threads use interpreter
+//! objects, only cycles in the registry of the current thread are reclaimed, and only if it has no unfinished tasks.
+size_t CollectGarbage();
+
+//! Runs collection if enough collectables were created since the last one. Must be called only where every
+//! collectable in use is owned by something, e.g. right before a call.
+void CollectGarbageIfNeeded();
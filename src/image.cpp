@@ -0,0 +1,1172 @@
+#include "image.h"
+
+#include "bytecode.h"
+#include "error.h"
+#include "memoize.h"
+#include "object.h"
+#include "operations.h"
+#include "resolver.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace {
+
+//! Starts every image. Changes of the format change it too, so old images are rejected instead of being misread.
+constexpr std::string_view kSignature = "hse-scheme image 1\n";
+
+const char* const kMalformedError = "Malformed image";
+
+//! Kinds of records of objects.
+enum class Tag : uint8_t {
+    // Objects which may be parts of cycles, created empty.
+    CELL,
+    VECTOR,
+    HASH_TABLE,
+    LAMBDA,
+    CLOSURE,
+    // Objects created complete.
+    NUMBER,
+    BIG_INTEGER,
+    BOOLEAN,
+    SYMBOL,
+    UNBOUND,
+    BUILTIN,
+    SPAWN_FUTURE,
+    LOCAL_REF,
+    GLOBAL_REF,
+    LAMBDA_EXPR,
+    CONSTANT_EXPR,
+    MEMOIZED,
+    // Lambda templates and compiled code, which are not objects but are written among them.
+    TEMPLATE,
+    CODE,
+};
+
+//! References to contexts: the global scope, builtins, or a frame by its number plus `kFirstFrame`.
+constexpr uint64_t kScopeReference = 0;
+constexpr uint64_t kKeywordsReference = 1;
+constexpr uint64_t kFirstFrame = 2;
+
+//! Whether symbol arguments of instructions with `opcode` are symbol ids, which differ between processes.
+bool HasSymbolArgument(OpCode opcode) {
+    return opcode == OpCode::GLOBAL || opcode == OpCode::DEFINE_GLOBAL || opcode == OpCode::SET_GLOBAL;
+}
+
+bool IsCreatedEmpty(const Object* object) {
+    switch (object->GetType()) {
+        case ObjectType::CELL:
+        case ObjectType::VECTOR:
+        case ObjectType::HASH_TABLE:
+        case ObjectType::LAMBDA:
+        case ObjectType::CLOSURE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+class ImageWriter {
+public:
+    explicit ImageWriter(const std::shared_ptr<Context>& scope) : scope_(scope) {
+        for (const auto& [id, value] : Context::GetKeywords()->GetNameTable()) {
+            const auto& builtin = *value;
+            builtin_names_.emplace(typeid(builtin), id);
+        }
+    }
+
+    std::string Write() {
+        // Frozen frames may have values assigned through the scope.
+        Context::ScopeActivation activation(scope_.get());
+        auto bindings = CollectBindings();
+        std::vector<Node> roots;
+        for (const auto& [id, value] : bindings) {
+            if (value != nullptr) {
+                roots.push_back({Node::OBJECT, value.get()});
+            }
+        }
+        Sort(roots);
+
+        // Hash tables hash their keys once filled, so they are filled after everything else.
+        std::vector<const Object*> empty;
+        std::vector<Node> complete;
+        std::vector<const Context*> frames;
+        for (const auto& node : order_) {
+            if (node.kind == Node::CONTEXT) {
+                if (AsContext(node)->IsFrame()) {
+                    frames.push_back(AsContext(node));
+                }
+            } else if (node.kind == Node::OBJECT && IsCreatedEmpty(AsObject(node))) {
+                empty.push_back(AsObject(node));
+            } else {
+                complete.push_back(node);
+            }
+        }
+        std::stable_partition(empty.begin(), empty.end(),
+                              [](const auto* object) { return object->GetType() != ObjectType::HASH_TABLE; });
+
+        WriteNumber(empty.size());
+        for (const auto* object : empty) {
+            WriteEmpty(object);
+        }
+        WriteNumber(complete.size());
+        for (const auto& node : complete) {
+            WriteComplete(node);
+        }
+        WriteNumber(frames.size());
+        for (const auto* frame : frames) {
+            WriteFrames(frame);
+        }
+        for (const auto* object : empty) {
+            WriteFill(object);
+        }
+        WriteNumber(bindings.size());
+        for (const auto& [id, value] : bindings) {
+            WriteSymbol(id);
+            WriteReference(value.get());
+        }
+
+        // Symbols are numbered as they are written, so their names go to the beginning once all of them are known.
+        auto body = std::move(out_);
+        out_ = kSignature;
+        WriteNumber(symbols_.size());
+        for (auto id : symbols_) {
+            const auto& name = Symbol::GetName(id);
+            WriteNumber(name.size());
+            out_ += name;
+        }
+        return out_ + body;
+    }
+
+private:
+    //! Object, lambda template, compiled code or context of the saved graph.
+    struct Node {
+        enum Kind : uint8_t { OBJECT, TEMPLATE, CODE, CONTEXT } kind;
+        const void* address;
+    };
+
+    static const Object* AsObject(const Node& node) {
+        return static_cast<const Object*>(node.address);
+    }
+    static const Context* AsContext(const Node& node) {
+        return static_cast<const Context*>(node.address);
+    }
+
+    //! Global bindings visible from the scope, nearer ones shadowing those of frozen environments.
+    std::vector<std::pair<SymbolId, ObjectPtr>> CollectBindings() const {
+        std::vector<std::pair<SymbolId, ObjectPtr>> bindings;
+        std::unordered_set<SymbolId> names;
+        for (auto* context = scope_.get(); context != nullptr && context != Context::GetKeywords().get();
+             context = context->GetUpper()) {
+            for (const auto& [id, value] : context->GetNameTable()) {
+                if (names.insert(id).second) {
+                    bindings.emplace_back(id, context->Load(value));
+                }
+            }
+        }
+        return bindings;
+    }
+
+    template <class F>
+    void ForEachChild(const Node& node, F&& visit) const {
+        auto visit_object = [&visit](const ObjectPtr& object) {
+            if (object != nullptr) {
+                visit(Node{Node::OBJECT, object.get()});
+            }
+        };
+        switch (node.kind) {
+            case Node::OBJECT: {
+                const auto* object = AsObject(node);
+                switch (object->GetType()) {
+                    case ObjectType::CELL:
+                        visit_object(static_cast<const Cell*>(object)->GetFirst());
+                        visit_object(static_cast<const Cell*>(object)->GetSecond());
+                        break;
+                    case ObjectType::VECTOR:
+                        for (const auto& element : static_cast<const Vector*>(object)->GetElements()) {
+                            visit_object(element);
+                        }
+                        break;
+                    case ObjectType::HASH_TABLE:
+                        for (const auto& [key, value] : static_cast<const HashTable*>(object)->GetEntries()) {
+                            visit_object(key);
+                            visit_object(value);
+                        }
+                        break;
+                    case ObjectType::LAMBDA:
+                        visit(Node{Node::TEMPLATE, static_cast<const Lambda*>(object)->code.get()});
+                        visit(Node{Node::CONTEXT, static_cast<const Lambda*>(object)->context.get()});
+                        break;
+                    case ObjectType::CLOSURE:
+                        visit(Node{Node::CODE, static_cast<const Closure*>(object)->code.get()});
+                        visit(Node{Node::CONTEXT, static_cast<const Closure*>(object)->context.get()});
+                        break;
+                    case ObjectType::MEMOIZED:
+                        visit_object(static_cast<const Memoized*>(object)->GetFunction());
+                        break;
+                    case ObjectType::LAMBDA_EXPR:
+                        visit(Node{Node::TEMPLATE, static_cast<const LambdaExpr*>(object)->GetCode().get()});
+                        break;
+                    case ObjectType::CONSTANT_EXPR:
+                        visit_object(static_cast<const ConstantExpr*>(object)->GetValue());
+                        visit_object(static_cast<const ConstantExpr*>(object)->GetExpression());
+                        break;
+                    default:
+                        break;
+                }
+                break;
+            }
+            case Node::TEMPLATE:
+                for (const auto& command : static_cast<const LambdaTemplate*>(node.address)->commands) {
+                    visit_object(command);
+                }
+                break;
+            case Node::CODE: {
+                const auto* code = static_cast<const CodeObject*>(node.address);
+                for (const auto& constant : code->constants) {
+                    visit_object(constant);
+                }
+                for (const auto& function : code->functions) {
+                    visit(Node{Node::CODE, function.get()});
+                }
+                if (code->layout != nullptr) {
+                    visit(Node{Node::TEMPLATE, code->layout.get()});
+                }
+                break;
+            }
+            case Node::CONTEXT: {
+                const auto* context = AsContext(node);
+                if (!context->IsFrame()) {
+                    break;
+                }
+                visit(Node{Node::CONTEXT, context->GetUpper()});
+                visit(Node{Node::TEMPLATE, context->GetLayout().get()});
+                for (size_t i = 0; i < context->GetLayout()->names.size(); ++i) {
+                    visit_object(context->Load(context->GetSlot(i)));
+                }
+                break;
+            }
+        }
+    }
+
+    //! Puts all nodes reachable from `roots` to `order_`, each after the ones it refers to unless they form a cycle.
+    void Sort(const std::vector<Node>& roots) {
+        std::unordered_set<const void*> visited;
+        std::vector<std::pair<Node, bool>> stack;
+        for (const auto& root : roots) {
+            stack.emplace_back(root, false);
+        }
+        while (!stack.empty()) {
+            auto [node, is_expanded] = stack.back();
+            stack.pop_back();
+            if (is_expanded) {
+                order_.push_back(node);
+                continue;
+            }
+            if (!visited.insert(node.address).second) {
+                continue;
+            }
+            stack.emplace_back(node, true);
+            ForEachChild(node, [&](const Node& child) {
+                if (!visited.contains(child.address)) {
+                    stack.emplace_back(child, false);
+                }
+            });
+        }
+    }
+
+    void WriteByte(uint8_t value) {
+        out_ += static_cast<char>(value);
+    }
+
+    //! Numbers are written in 7-bit groups, lowest first, with the high bit set on all but the last one.
+    void WriteNumber(uint64_t value) {
+        while (value >= 0x80) {
+            WriteByte(static_cast<uint8_t>(value) | 0x80);
+            value >>= 7;
+        }
+        WriteByte(value);
+    }
+
+    void WriteSymbol(SymbolId id) {
+        auto [it, is_new] = symbol_indices_.emplace(id, symbols_.size());
+        if (is_new) {
+            symbols_.push_back(id);
+        }
+        WriteNumber(it->second);
+    }
+
+    void WriteName(const std::optional<SymbolId>& name) {
+        WriteNumber(name.has_value());
+        if (name.has_value()) {
+            WriteSymbol(*name);
+        }
+    }
+
+    //! Writes 0 for nullptr, otherwise the number of the written node plus one.
+    void WriteReference(const void* address) {
+        if (address == nullptr) {
+            WriteNumber(0);
+            return;
+        }
+        auto it = indices_.find(address);
+        if (it == indices_.end()) {
+            // Only a cycle of objects which are created complete may refer to one which is not written yet.
+            throw RuntimeError("Unable to save a cyclic structure to an image");
+        }
+        WriteNumber(it->second + 1);
+    }
+
+    void WriteContext(const Context* context) {
+        if (context == Context::GetKeywords().get()) {
+            WriteNumber(kKeywordsReference);
+        } else if (!context->IsFrame()) {
+            WriteNumber(kScopeReference);
+        } else {
+            WriteNumber(indices_.at(context) + kFirstFrame);
+        }
+    }
+
+    void WriteEmpty(const Object* object) {
+        indices_.emplace(object, object_count_++);
+        switch (object->GetType()) {
+            case ObjectType::CELL:
+                WriteByte(static_cast<uint8_t>(Tag::CELL));
+                break;
+            case ObjectType::VECTOR:
+                WriteByte(static_cast<uint8_t>(Tag::VECTOR));
+                WriteNumber(static_cast<const Vector*>(object)->GetSize());
+                break;
+            case ObjectType::HASH_TABLE:
+                WriteByte(static_cast<uint8_t>(Tag::HASH_TABLE));
+                break;
+            case ObjectType::LAMBDA:
+                WriteByte(static_cast<uint8_t>(Tag::LAMBDA));
+                break;
+            default:
+                WriteByte(static_cast<uint8_t>(Tag::CLOSURE));
+                break;
+        }
+    }
+
+    void WriteComplete(const Node& node) {
+        if (node.kind == Node::TEMPLATE) {
+            const auto* layout = static_cast<const LambdaTemplate*>(node.address);
+            WriteByte(static_cast<uint8_t>(Tag::TEMPLATE));
+            WriteNumber(layout->names.size());
+            for (auto id : layout->names) {
+                WriteSymbol(id);
+            }
+            WriteNumber(layout->arg_count);
+            WriteNumber(layout->commands.size());
+            for (const auto& command : layout->commands) {
+                WriteReference(command.get());
+            }
+            indices_.emplace(node.address, template_count_++);
+            return;
+        }
+        if (node.kind == Node::CODE) {
+            const auto* code = static_cast<const CodeObject*>(node.address);
+            WriteByte(static_cast<uint8_t>(Tag::CODE));
+            WriteNumber(code->instructions.size());
+            for (const auto& instruction : code->instructions) {
+                WriteByte(static_cast<uint8_t>(instruction.opcode));
+                WriteNumber(instruction.depth);
+                if (HasSymbolArgument(instruction.opcode)) {
+                    WriteSymbol(instruction.arg);
+                } else {
+                    WriteNumber(instruction.arg);
+                }
+            }
+            WriteNumber(code->constants.size());
+            for (const auto& constant : code->constants) {
+                WriteReference(constant.get());
+            }
+            WriteNumber(code->functions.size());
+            for (const auto& function : code->functions) {
+                WriteReference(function.get());
+            }
+            WriteReference(code->layout.get());
+            indices_.emplace(node.address, code_count_++);
+            return;
+        }
+        WriteObject(AsObject(node));
+        indices_.emplace(node.address, object_count_++);
+    }
+
+    void WriteObject(const Object* object) {
+        switch (object->GetType()) {
+            case ObjectType::NUMBER: {
+                auto value = static_cast<const Number*>(object)->GetValue();
+                WriteByte(static_cast<uint8_t>(Tag::NUMBER));
+                // Zigzag encoding keeps small negative numbers short.
+                WriteNumber((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+                break;
+            }
+            case ObjectType::BIG_INTEGER: {
+                auto digits = static_cast<const BigInteger*>(object)->GetValue().ToString();
+                WriteByte(static_cast<uint8_t>(Tag::BIG_INTEGER));
+                WriteNumber(digits.size());
+                out_ += digits;
+                break;
+            }
+            case ObjectType::BOOLEAN:
+                WriteByte(static_cast<uint8_t>(Tag::BOOLEAN));
+                WriteByte(static_cast<const Boolean*>(object)->GetValue());
+                break;
+            case ObjectType::SYMBOL:
+                WriteByte(static_cast<uint8_t>(Tag::SYMBOL));
+                WriteSymbol(static_cast<const Symbol*>(object)->GetId());
+                break;
+            case ObjectType::LOCAL_REF: {
+                const auto* ref = static_cast<const LocalRef*>(object);
+                WriteByte(static_cast<uint8_t>(Tag::LOCAL_REF));
+                WriteNumber(ref->GetDepth());
+                WriteNumber(ref->GetSlot());
+                WriteSymbol(ref->GetId());
+                break;
+            }
+            case ObjectType::GLOBAL_REF: {
+                const auto* ref = static_cast<const GlobalRef*>(object);
+                WriteByte(static_cast<uint8_t>(Tag::GLOBAL_REF));
+                WriteNumber(ref->GetDepth());
+                WriteSymbol(ref->GetId());
+                break;
+            }
+            case ObjectType::LAMBDA_EXPR:
+                WriteByte(static_cast<uint8_t>(Tag::LAMBDA_EXPR));
+                WriteReference(static_cast<const LambdaExpr*>(object)->GetCode().get());
+                break;
+            case ObjectType::CONSTANT_EXPR: {
+                const auto* constant = static_cast<const ConstantExpr*>(object);
+                WriteByte(static_cast<uint8_t>(Tag::CONSTANT_EXPR));
+                WriteByte(constant->IsValid());
+                WriteReference(constant->GetValue().get());
+                WriteReference(constant->GetExpression().get());
+                break;
+            }
+            case ObjectType::MEMOIZED: {
+                const auto* memoized = static_cast<const Memoized*>(object);
+                WriteByte(static_cast<uint8_t>(Tag::MEMOIZED));
+                WriteReference(memoized->GetFunction().get());
+                WriteNumber(memoized->GetStats().capacity);
+                WriteName(memoized->name);
+                break;
+            }
+            case ObjectType::SPECIAL_FORM:
+            case ObjectType::PROCEDURE: {
+                // Builtins keep no state, so any instance of a builtin's class may stand for it.
+                if (dynamic_cast<const SpawnFutureOp*>(object) != nullptr) {
+                    WriteByte(static_cast<uint8_t>(Tag::SPAWN_FUTURE));
+                    break;
+                }
+                auto it = builtin_names_.find(typeid(*object));
+                if (it == builtin_names_.end()) {
+                    throw RuntimeError("Unable to save an unknown builtin to an image");
+                }
+                WriteByte(static_cast<uint8_t>(Tag::BUILTIN));
+                WriteSymbol(it->second);
+                break;
+            }
+            case ObjectType::FUTURE:
+                throw RuntimeError("Futures can not be saved to an image");
+            default:
+                if (object != UnboundMarker().get()) {
+                    throw RuntimeError("Unable to save an object of unknown kind to an image");
+                }
+                WriteByte(static_cast<uint8_t>(Tag::UNBOUND));
+                break;
+        }
+    }
+
+    //! Writes `frame` after the frames it is nested into, unless they are written already.
+    void WriteFrames(const Context* frame) {
+        std::vector<const Context*> chain;
+        for (auto* context = frame; context->IsFrame() && !indices_.contains(context); context = context->GetUpper()) {
+            chain.push_back(context);
+        }
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+            const auto* context = *it;
+            WriteContext(context->GetUpper());
+            WriteReference(context->GetLayout().get());
+            for (size_t i = 0; i < context->GetLayout()->names.size(); ++i) {
+                WriteReference(context->Load(context->GetSlot(i)).get());
+            }
+            indices_.emplace(context, frame_count_++);
+        }
+    }
+
+    void WriteFill(const Object* object) {
+        switch (object->GetType()) {
+            case ObjectType::CELL:
+                WriteReference(static_cast<const Cell*>(object)->GetFirst().get());
+                WriteReference(static_cast<const Cell*>(object)->GetSecond().get());
+                break;
+            case ObjectType::VECTOR:
+                for (const auto& element : static_cast<const Vector*>(object)->GetElements()) {
+                    WriteReference(element.get());
+                }
+                break;
+            case ObjectType::HASH_TABLE: {
+                auto entries = static_cast<const HashTable*>(object)->GetEntries();
+                WriteNumber(entries.size());
+                for (const auto& [key, value] : entries) {
+                    WriteReference(key.get());
+                    WriteReference(value.get());
+                }
+                break;
+            }
+            case ObjectType::LAMBDA: {
+                const auto* lambda = static_cast<const Lambda*>(object);
+                WriteReference(lambda->code.get());
+                WriteContext(lambda->context.get());
+                WriteName(lambda->name);
+                break;
+            }
+            default: {
+                const auto* closure = static_cast<const Closure*>(object);
+                WriteReference(closure->code.get());
+                WriteContext(closure->context.get());
+                WriteName(closure->name);
+                break;
+            }
+        }
+    }
+
+    std::shared_ptr<Context> scope_;
+    std::unordered_map<std::type_index, SymbolId> builtin_names_;
+    std::vector<Node> order_;
+    //! Numbers of written nodes, each kind of them numbered separately.
+    std::unordered_map<const void*, size_t> indices_;
+    size_t object_count_ = 0;
+    size_t template_count_ = 0;
+    size_t code_count_ = 0;
+    size_t frame_count_ = 0;
+    std::vector<SymbolId> symbols_;
+    std::unordered_map<SymbolId, size_t> symbol_indices_;
+    std::string out_;
+};
+
+class ImageReader {
+public:
+    ImageReader(std::string_view image, const std::shared_ptr<Context>& scope)
+        : image_(image), scope_(scope), builtins_(Context::GetKeywords()->GetNameTable()) {
+    }
+
+    void Read() {
+        if (!image_.starts_with(kSignature)) {
+            throw RuntimeError(kMalformedError);
+        }
+        position_ = kSignature.size();
+        symbols_.resize(ReadCount());
+        for (auto& id : symbols_) {
+            id = Symbol::Intern(ReadString())->GetId();
+        }
+
+        std::vector<ObjectPtr> empty(ReadCount());
+        for (auto& object : empty) {
+            object = ReadEmpty();
+            objects_.push_back(object);
+        }
+        auto complete_count = ReadCount();
+        objects_.reserve(objects_.size() + complete_count);
+        for (; complete_count != 0; --complete_count) {
+            ReadComplete();
+        }
+        for (auto count = ReadCount(); count != 0; --count) {
+            auto upper = ReadContext();
+            auto layout = ReadTemplate();
+            if (layout == nullptr) {
+                throw RuntimeError(kMalformedError);
+            }
+            auto frame = Make<Context>(std::move(upper), layout);
+            for (size_t i = 0; i < layout->names.size(); ++i) {
+                frame->GetSlot(i) = ReadObject();
+            }
+            frames_.push_back(std::move(frame));
+        }
+        for (const auto& object : empty) {
+            Fill(object);
+        }
+        max_depth_ = templates_.size() + codes_.size() + frames_.size() + 1;
+        for (auto context = scope_.get(); context != nullptr; context = context->GetUpper()) {
+            ++max_depth_;
+        }
+        for (const auto& [unit, context] : created_) {
+            CheckContext(Resolve(unit), context.get());
+        }
+        for (auto count = ReadCount(); count != 0; --count) {
+            auto id = ReadSymbol();
+            auto value = ReadObject();
+            scope_->Define(id, std::move(value));
+        }
+        if (position_ != image_.size()) {
+            throw RuntimeError(kMalformedError);
+        }
+    }
+
+private:
+    uint8_t ReadByte() {
+        if (position_ == image_.size()) {
+            throw RuntimeError(kMalformedError);
+        }
+        return image_[position_++];
+    }
+
+    uint64_t ReadNumber() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            auto byte = ReadByte();
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        throw RuntimeError(kMalformedError);
+    }
+
+    //! Number of items which follow, each of them takes at least a byte.
+    size_t ReadCount() {
+        auto count = ReadNumber();
+        if (count > image_.size() - position_) {
+            throw RuntimeError(kMalformedError);
+        }
+        return count;
+    }
+
+    std::string_view ReadString() {
+        auto size = ReadCount();
+        auto result = image_.substr(position_, size);
+        position_ += size;
+        return result;
+    }
+
+    SymbolId ReadSymbol() {
+        return At(symbols_, ReadNumber());
+    }
+
+    std::optional<SymbolId> ReadName() {
+        if (ReadByte() == 0) {
+            return std::nullopt;
+        }
+        return ReadSymbol();
+    }
+
+    template <class T>
+    static const T& At(const std::vector<T>& table, uint64_t index) {
+        if (index >= table.size()) {
+            throw RuntimeError(kMalformedError);
+        }
+        return table[index];
+    }
+
+    //! Returns nullptr for reference 0, otherwise the node numbered one less from `table`.
+    template <class T>
+    T ReadReference(const std::vector<T>& table) {
+        auto reference = ReadNumber();
+        return reference == 0 ? nullptr : At(table, reference - 1);
+    }
+
+    ObjectPtr ReadObject() {
+        return ReadReference(objects_);
+    }
+
+    std::shared_ptr<const LambdaTemplate> ReadTemplate() {
+        return ReadReference(templates_);
+    }
+
+    std::shared_ptr<const CodeObject> ReadCode() {
+        return ReadReference(codes_);
+    }
+
+    std::shared_ptr<Context> ReadContext() {
+        auto reference = ReadNumber();
+        if (reference == kScopeReference) {
+            return scope_;
+        }
+        if (reference == kKeywordsReference) {
+            return Context::GetKeywords();
+        }
+        return At(frames_, reference - kFirstFrame);
+    }
+
+    ObjectPtr ReadEmpty() {
+        switch (static_cast<Tag>(ReadByte())) {
+            case Tag::CELL:
+                return Make<Cell>();
+            case Tag::VECTOR:
+                return Make<Vector>(std::vector<ObjectPtr>(ReadCount()));
+            case Tag::HASH_TABLE:
+                return Make<HashTable>();
+            case Tag::LAMBDA:
+                return Make<Lambda>();
+            case Tag::CLOSURE:
+                return Make<Closure>();
+            default:
+                throw RuntimeError(kMalformedError);
+        }
+    }
+
+    void ReadComplete() {
+        auto tag = static_cast<Tag>(ReadByte());
+        if (tag == Tag::TEMPLATE) {
+            auto layout = std::make_shared<LambdaTemplate>();
+            layout->names.resize(ReadCount());
+            for (auto& id : layout->names) {
+                id = ReadSymbol();
+            }
+            layout->arg_count = ReadNumber();
+            layout->commands.resize(ReadCount());
+            for (auto& command : layout->commands) {
+                command = ReadObject();
+            }
+            if (layout->arg_count > layout->names.size()) {
+                throw RuntimeError(kMalformedError);
+            }
+            templates_.push_back(std::move(layout));
+            return;
+        }
+        if (tag == Tag::CODE) {
+            auto code = std::make_shared<CodeObject>();
+            code->instructions.resize(ReadCount());
+            for (auto& instruction : code->instructions) {
+                auto opcode = ReadByte();
+                auto depth = ReadNumber();
+                if (opcode > static_cast<uint8_t>(OpCode::RETURN) || depth > UINT16_MAX) {
+                    throw RuntimeError(kMalformedError);
+                }
+                instruction.opcode = static_cast<OpCode>(opcode);
+                instruction.depth = depth;
+                if (HasSymbolArgument(instruction.opcode)) {
+                    instruction.arg = ReadSymbol();
+                } else {
+                    auto arg = ReadNumber();
+                    if (arg > UINT32_MAX) {
+                        throw RuntimeError(kMalformedError);
+                    }
+                    instruction.arg = arg;
+                }
+            }
+            code->constants.resize(ReadCount());
+            for (auto& constant : code->constants) {
+                constant = ReadObject();
+            }
+            code->functions.resize(ReadCount());
+            for (auto& function : code->functions) {
+                function = ReadCode();
+            }
+            code->layout = ReadTemplate();
+            codes_.push_back(std::move(code));
+            return;
+        }
+        objects_.push_back(ReadObject(tag));
+    }
+
+    ObjectPtr ReadObject(Tag tag) {
+        switch (tag) {
+            case Tag::NUMBER: {
+                auto value = ReadNumber();
+                return MakeNumber(static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1));
+            }
+            case Tag::BIG_INTEGER:
+                return MakeInteger(BigInt::FromString(ReadString()));
+            case Tag::BOOLEAN:
+                return MakeBoolean(ReadByte() != 0);
+            case Tag::SYMBOL:
+                return Symbol::Intern(ReadSymbol());
+            case Tag::UNBOUND:
+                return UnboundMarker();
+            case Tag::BUILTIN: {
+                auto it = builtins_.find(ReadSymbol());
+                if (it == builtins_.end()) {
+                    throw RuntimeError(kMalformedError);
+                }
+                return it->second;
+            }
+            case Tag::SPAWN_FUTURE:
+                return std::make_shared<SpawnFutureOp>();
+            case Tag::LOCAL_REF: {
+                auto depth = ReadNumber();
+                auto slot = ReadNumber();
+                // Slots are numbered as in instructions, whose arguments take 32 bits.
+                if (slot > UINT32_MAX) {
+                    throw RuntimeError(kMalformedError);
+                }
+                return Make<LocalRef>(depth, slot, ReadSymbol());
+            }
+            case Tag::GLOBAL_REF: {
+                auto depth = ReadNumber();
+                return Make<GlobalRef>(depth, ReadSymbol());
+            }
+            case Tag::LAMBDA_EXPR: {
+                auto code = ReadTemplate();
+                if (code == nullptr) {
+                    throw RuntimeError(kMalformedError);
+                }
+                return std::make_shared<LambdaExpr>(std::move(code));
+            }
+            case Tag::CONSTANT_EXPR: {
+                auto is_valid = ReadByte() != 0;
+                auto value = ReadObject();
+                auto expression = ReadObject();
+                // A constant which got stale is evaluated as written, and so is its expression.
+                if (!is_valid) {
+                    return expression;
+                }
+                return Make<ConstantExpr>(std::move(value), std::move(expression));
+            }
+            case Tag::MEMOIZED: {
+                auto function = ReadObject();
+                auto capacity = ReadNumber();
+                if (!Is<Procedure>(function)) {
+                    throw RuntimeError(kMalformedError);
+                }
+                auto memoized = Make<Memoized>(std::move(function), capacity);
+                memoized->name = ReadName();
+                return memoized;
+            }
+            default:
+                throw RuntimeError(kMalformedError);
+        }
+    }
+
+    void Fill(const ObjectPtr& object) {
+        switch (object->GetType()) {
+            case ObjectType::CELL: {
+                auto first = ReadObject();
+                auto second = ReadObject();
+                Borrow<Cell>(object)->SetFirst(std::move(first));
+                Borrow<Cell>(object)->SetSecond(std::move(second));
+                break;
+            }
+            case ObjectType::VECTOR: {
+                auto vector = Borrow<Vector>(object);
+                for (size_t i = 0; i < vector->GetSize(); ++i) {
+                    vector->Set(i, ReadObject());
+                }
+                break;
+            }
+            case ObjectType::HASH_TABLE: {
+                auto table = Borrow<HashTable>(object);
+                for (auto count = ReadCount(); count != 0; --count) {
+                    auto key = ReadObject();
+                    auto value = ReadObject();
+                    table->Set(key, std::move(value));
+                }
+                break;
+            }
+            case ObjectType::LAMBDA: {
+                auto lambda = Borrow<Lambda>(object);
+                lambda->code = ReadTemplate();
+                lambda->context = ReadContext();
+                lambda->name = ReadName();
+                if (lambda->code == nullptr) {
+                    throw RuntimeError(kMalformedError);
+                }
+                created_.emplace_back(GetUnit(lambda->code.get()), lambda->context);
+                break;
+            }
+            default: {
+                auto closure = Borrow<Closure>(object);
+                closure->code = ReadCode();
+                closure->context = ReadContext();
+                closure->name = ReadName();
+                if (closure->code == nullptr || closure->code->layout == nullptr) {
+                    throw RuntimeError(kMalformedError);
+                }
+                created_.emplace_back(GetUnit(closure->code.get()), closure->context);
+                break;
+            }
+        }
+    }
+
+    // Code read from an image is run without checks, so before anything is defined every lambda is checked to refer
+    // only to variables its frames have and to keep the stack of the virtual machine within its own part.
+
+    //! What code needs from contexts above the one it is created in: element `k` is for the context `k` levels up,
+    //! which must exist, and unless the element is 0, must be a frame with at least that many slots.
+    using Requirements = std::vector<size_t>;
+
+    //! Lambda template or compiled code together with what it and lambdas created by it need from outer contexts.
+    struct Unit {
+        enum class State { NEW, SCANNING, DONE };
+
+        const LambdaTemplate* layout;
+        const CodeObject* code = nullptr;
+        State state = State::NEW;
+        Requirements requirements;
+        std::vector<Unit*> nested;
+    };
+
+    Unit* GetUnit(const LambdaTemplate* layout) {
+        auto [it, is_new] = units_.try_emplace(layout);
+        it->second.layout = layout;
+        return &it->second;
+    }
+
+    Unit* GetUnit(const CodeObject* code) {
+        if (code == nullptr || code->layout == nullptr) {
+            throw RuntimeError(kMalformedError);
+        }
+        auto [it, is_new] = units_.try_emplace(code);
+        it->second.layout = code->layout.get();
+        it->second.code = code;
+        return &it->second;
+    }
+
+    static void Require(Requirements* requirements, size_t level, size_t slot_count) {
+        if (requirements->size() <= level) {
+            requirements->resize(level + 1);
+        }
+        (*requirements)[level] = std::max((*requirements)[level], slot_count);
+    }
+
+    //! Notes that code of `unit` uses the context `depth` levels up from its own frame, with `slot_count` as above.
+    void Expect(Unit* unit, size_t depth, size_t slot_count) {
+        if (depth > max_depth_) {
+            throw RuntimeError(kMalformedError);
+        }
+        if (depth == 0) {
+            if (slot_count > unit->layout->names.size()) {
+                throw RuntimeError(kMalformedError);
+            }
+            return;
+        }
+        Require(&unit->requirements, depth - 1, slot_count);
+    }
+
+    //! Notes variables which expressions evaluated in frames of `unit` refer to, and lambdas created by them.
+    void ScanExpressions(Unit* unit, std::vector<const Object*> stack) {
+        std::unordered_set<const Object*> visited(stack.begin(), stack.end());
+        auto push = [&stack, &visited](const ObjectPtr& object) {
+            if (object != nullptr && visited.insert(object.get()).second) {
+                stack.push_back(object.get());
+            }
+        };
+        while (!stack.empty()) {
+            auto object = stack.back();
+            stack.pop_back();
+            switch (object->GetType()) {
+                case ObjectType::CELL:
+                    push(static_cast<const Cell*>(object)->GetFirst());
+                    push(static_cast<const Cell*>(object)->GetSecond());
+                    break;
+                case ObjectType::LOCAL_REF: {
+                    auto reference = static_cast<const LocalRef*>(object);
+                    Expect(unit, reference->GetDepth(), reference->GetSlot() + 1);
+                    break;
+                }
+                case ObjectType::GLOBAL_REF:
+                    Expect(unit, static_cast<const GlobalRef*>(object)->GetDepth(), 0);
+                    break;
+                case ObjectType::LAMBDA_EXPR:
+                    unit->nested.push_back(GetUnit(static_cast<const LambdaExpr*>(object)->GetCode().get()));
+                    break;
+                case ObjectType::CONSTANT_EXPR:
+                    push(static_cast<const ConstantExpr*>(object)->GetExpression());
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    //! Checks operands of instructions and that the stack never goes below the part of the frame.
+    void ScanCode(Unit* unit) {
+        const auto& code = *unit->code;
+        const auto size = code.instructions.size();
+        std::vector<const Object*> evaluated;
+        for (const auto& instruction : code.instructions) {
+            switch (instruction.opcode) {
+                case OpCode::CONSTANT:
+                case OpCode::EVAL:
+                    if (instruction.arg >= code.constants.size()) {
+                        throw RuntimeError(kMalformedError);
+                    }
+                    if (instruction.opcode == OpCode::EVAL && code.constants[instruction.arg] != nullptr) {
+                        evaluated.push_back(code.constants[instruction.arg].get());
+                    }
+                    break;
+                case OpCode::GLOBAL_REF:
+                    if (instruction.arg >= code.constants.size() || !Is<GlobalRef>(code.constants[instruction.arg])) {
+                        throw RuntimeError(kMalformedError);
+                    }
+                    Expect(unit, Borrow<GlobalRef>(code.constants[instruction.arg])->GetDepth(), 0);
+                    break;
+                case OpCode::LOCAL:
+                case OpCode::DEFINE_LOCAL:
+                case OpCode::SET_LOCAL:
+                    Expect(unit, instruction.depth, static_cast<size_t>(instruction.arg) + 1);
+                    break;
+                case OpCode::MAKE_CLOSURE:
+                    if (instruction.arg >= code.functions.size()) {
+                        throw RuntimeError(kMalformedError);
+                    }
+                    unit->nested.push_back(GetUnit(code.functions[instruction.arg].get()));
+                    break;
+                default:
+                    break;
+            }
+        }
+        ScanExpressions(unit, std::move(evaluated));
+
+        constexpr size_t kUnknown = SIZE_MAX;
+        std::vector<size_t> heights(size, kUnknown);
+        std::vector<size_t> pending;
+        auto reach = [&](size_t pc, size_t height) {
+            if (pc >= size || (heights[pc] != kUnknown && heights[pc] != height)) {
+                throw RuntimeError(kMalformedError);
+            }
+            if (heights[pc] == kUnknown) {
+                heights[pc] = height;
+                pending.push_back(pc);
+            }
+        };
+        reach(0, 0);
+        while (!pending.empty()) {
+            auto pc = pending.back();
+            pending.pop_back();
+            const auto& instruction = code.instructions[pc];
+            auto height = heights[pc];
+            auto pop = [height](size_t count) {
+                if (height < count) {
+                    throw RuntimeError(kMalformedError);
+                }
+                return height - count;
+            };
+            switch (instruction.opcode) {
+                case OpCode::CONSTANT:
+                case OpCode::LOCAL:
+                case OpCode::GLOBAL:
+                case OpCode::GLOBAL_REF:
+                case OpCode::MAKE_CLOSURE:
+                case OpCode::EVAL:
+                    reach(pc + 1, height + 1);
+                    break;
+                case OpCode::DEFINE_LOCAL:
+                case OpCode::DEFINE_GLOBAL:
+                case OpCode::SET_LOCAL:
+                case OpCode::SET_GLOBAL:
+                    reach(pc + 1, pop(1) + 1);
+                    break;
+                case OpCode::POP:
+                    reach(pc + 1, pop(1));
+                    break;
+                case OpCode::JUMP:
+                    reach(instruction.arg, height);
+                    break;
+                case OpCode::JUMP_IF_FALSE:
+                    reach(instruction.arg, pop(1));
+                    reach(pc + 1, pop(1));
+                    break;
+                case OpCode::JUMP_IF_FALSE_OR_POP:
+                case OpCode::JUMP_IF_TRUE_OR_POP:
+                    reach(instruction.arg, height);
+                    reach(pc + 1, pop(1));
+                    break;
+                case OpCode::CALL:
+                case OpCode::TAIL_CALL:
+                    reach(pc + 1, pop(static_cast<size_t>(instruction.arg) + 1) + 1);
+                    break;
+                case OpCode::RETURN:
+                    pop(1);
+                    break;
+            }
+        }
+    }
+
+    //! Returns what `root` needs from the context it is created in and above, including needs of nested lambdas.
+    const Requirements& Resolve(Unit* root) {
+        std::vector<std::pair<Unit*, size_t>> stack;
+        auto enter = [this, &stack](Unit* unit) {
+            unit->state = Unit::State::SCANNING;
+            if (unit->code != nullptr) {
+                ScanCode(unit);
+            } else {
+                std::vector<const Object*> commands;
+                for (const auto& command : unit->layout->commands) {
+                    if (command != nullptr) {
+                        commands.push_back(command.get());
+                    }
+                }
+                ScanExpressions(unit, std::move(commands));
+            }
+            stack.emplace_back(unit, 0);
+        };
+        if (root->state == Unit::State::NEW) {
+            enter(root);
+        }
+        while (!stack.empty()) {
+            auto [unit, next] = stack.back();
+            if (next < unit->nested.size()) {
+                ++stack.back().second;
+                auto nested = unit->nested[next];
+                if (nested->state == Unit::State::SCANNING) {
+                    // A lambda can not be nested into itself.
+                    throw RuntimeError(kMalformedError);
+                }
+                if (nested->state == Unit::State::NEW) {
+                    enter(nested);
+                }
+                continue;
+            }
+            // Nested lambdas are created in frames of this one.
+            for (auto nested : unit->nested) {
+                const auto& requirements = nested->requirements;
+                if (!requirements.empty() && requirements[0] > unit->layout->names.size()) {
+                    throw RuntimeError(kMalformedError);
+                }
+                for (size_t level = 1; level < requirements.size(); ++level) {
+                    Require(&unit->requirements, level - 1, requirements[level]);
+                }
+            }
+            unit->state = Unit::State::DONE;
+            stack.pop_back();
+        }
+        return root->requirements;
+    }
+
+    static void CheckContext(const Requirements& requirements, const Context* context) {
+        for (auto slot_count : requirements) {
+            if (context == nullptr || (slot_count != 0 && (!context->IsFrame() ||
+                                                           context->GetLayout()->names.size() < slot_count))) {
+                throw RuntimeError(kMalformedError);
+            }
+            context = context->GetUpper();
+        }
+    }
+
+    std::string_view image_;
+    size_t position_ = 0;
+    std::shared_ptr<Context> scope_;
+    std::unordered_map<SymbolId, ObjectPtr> builtins_;
+    std::vector<SymbolId> symbols_;
+    std::vector<ObjectPtr> objects_;
+    std::vector<std::shared_ptr<const LambdaTemplate>> templates_;
+    std::vector<std::shared_ptr<const CodeObject>> codes_;
+    std::vector<std::shared_ptr<Context>> frames_;
+    //! Lambdas and closures with contexts they were created in.
+    std::vector<std::pair<Unit*, std::shared_ptr<Context>>> created_;
+    std::unordered_map<const void*, Unit> units_;
+    //! Deeper references can not reach any context.
+    size_t max_depth_ = 0;
+};
+
+}  // namespace
+
+void WriteImage(const std::shared_ptr<Context>& scope, std::ostream* out) {
+    auto image = ImageWriter(scope).Write();
+    out->write(image.data(), image.size());
+}
+
+void ReadImage(std::string_view image, const std::shared_ptr<Context>& scope) {
+    ImageReader(image, scope).Read();
+}
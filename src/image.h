@@ -0,0 +1,23 @@
+#pragma once
+
+#include "object.h"
+
+#include <memory>
+#include <ostream>
+#include <string_view>
+
+//! Image is a compact binary form of the definitions of an interpreter, which restores them without reading and
+//! evaluating their source again. It holds everything reachable from global bindings: data, closures together with the
+//! frames they captured, and their resolved or compiled code. Objects shared in the saved graph stay shared, and cycles
+//! are kept. Builtins are stored by name, memoized procedures start with empty caches; futures can not be saved.
+//!
+//! Objects refer to each other by their numbers in the image. Ones which may be parts of cycles are stored empty first
+//! and filled at the end, the rest after everything they refer to, so an image is read in a single pass.
+
+//! Writes an image of all definitions visible from `scope`, a global scope which must not be used by running tasks.
+//! Definitions of frozen environments under it are saved as if they were made in the scope itself.
+void WriteImage(const std::shared_ptr<Context>& scope, std::ostream* out);
+
+//! Defines everything saved in `image` in the global scope `scope`. Throws `RuntimeError` if the image is malformed,
+//! which includes code referring to variables its frames do not have and bytecode which breaks the stack.
+void ReadImage(std::string_view image, const std::shared_ptr<Context>& scope);
@@ -0,0 +1,137 @@
+#include "memoize.h"
+
+#include "concurrency.h"
+#include "error.h"
+#include "pool.h"
+
+#include <iterator>
+#include <list>
+#include <utility>
+
+namespace {
+//! Copies pairs and vectors of `value` deeply, other objects are shared. Structure is walked with an explicit stack.
+ObjectPtr CopyStructure(const ObjectPtr& value) {
+    std::vector<std::pair<const Object*, Object*>> pending;
+    auto copy = [&pending](const ObjectPtr& part) -> ObjectPtr {
+        if (Is<Cell>(part)) {
+            auto cell = Make<Cell>();
+            pending.emplace_back(part.get(), cell.get());
+            return cell;
+        }
+        if (auto vector = Borrow<Vector>(part)) {
+            auto result = Make<Vector>(std::vector<ObjectPtr>(vector->GetSize()));
+            pending.emplace_back(part.get(), result.get());
+            return result;
+        }
+        return part;
+    };
+    auto result = copy(value);
+    while (!pending.empty()) {
+        auto [source, target] = pending.back();
+        pending.pop_back();
+        if (source->GetType() == ObjectType::CELL) {
+            auto cell = static_cast<const Cell*>(source);
+            static_cast<Cell*>(target)->SetFirst(copy(cell->GetFirst()));
+            static_cast<Cell*>(target)->SetSecond(copy(cell->GetSecond()));
+        } else {
+            auto vector = static_cast<const Vector*>(source);
+            for (size_t i = 0; i < vector->GetSize(); ++i) {
+                static_cast<Vector*>(target)->Set(i, copy(vector->Get(i)));
+            }
+        }
+    }
+    return result;
+}
+}  // namespace
+
+Memoized::Memoized(ObjectPtr function, size_t capacity)
+    : Procedure(ObjectType::MEMOIZED), function_(std::move(function)), capacity_(capacity) {
+    name = Borrow<Function>(function_)->name;
+}
+
+const ObjectPtr& Memoized::GetFunction() const {
+    return function_;
+}
+
+MemoStats Memoized::GetStats() const {
+    auto lock = concurrency::LockIfConcurrent(mutex_);
+    return MemoStats{hits_, misses_, entries_.size(), capacity_};
+}
+
+ObjectPtr Memoized::Call(std::span<const ObjectPtr> args) const {
+    {
+        auto lock = concurrency::LockIfConcurrent(mutex_);
+        if (auto it = index_.find(args); it != index_.end()) {
+            ++hits_;
+            entries_.splice(entries_.begin(), entries_, it->second);
+            return it->second->result;
+        }
+        ++misses_;
+    }
+    // The wrapped function is not reported to the profiler separately, its time is counted as the memoized one's.
+    // The lock is not held meanwhile, so parallel tasks may compute results for the same arguments at once.
+    auto result = Borrow<Procedure>(function_)->Call(args);
+    std::vector<ObjectPtr> copied_args;
+    copied_args.reserve(args.size());
+    for (const auto& arg : args) {
+        copied_args.push_back(CopyStructure(arg));
+    }
+    std::list<Entry> evicted;
+    auto lock = concurrency::LockIfConcurrent(mutex_);
+    // A recursive call could have remembered the same arguments already.
+    if (index_.contains(args)) {
+        return result;
+    }
+    entries_.push_front(Entry{std::move(copied_args), result});
+    index_.emplace(entries_.front().args, entries_.begin());
+    if (entries_.size() > capacity_) {
+        index_.erase(entries_.back().args);
+        // Evicted objects are released after the lock, their destruction may take a while.
+        evicted.splice(evicted.begin(), entries_, std::prev(entries_.end()));
+    }
+    return result;
+}
+
+size_t Memoized::ArgumentsHash::operator()(std::span<const ObjectPtr> args) const {
+    size_t hash = args.size();
+    for (const auto& arg : args) {
+        hash ^= Hash(arg) + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+    }
+    return hash;
+}
+
+bool Memoized::ArgumentsEqual::operator()(std::span<const ObjectPtr> lhs, std::span<const ObjectPtr> rhs) const {
+    if (lhs.size() != rhs.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < lhs.size(); ++i) {
+        if (!Equal(lhs[i], rhs[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Memoized::Trace(const std::function<void(Collectable*)>& visit) const {
+    TraceObject(function_, visit);
+    for (const auto& entry : entries_) {
+        for (const auto& arg : entry.args) {
+            TraceObject(arg, visit);
+        }
+        TraceObject(entry.result, visit);
+    }
+}
+
+void Memoized::Clear() {
+    function_ = nullptr;
+    index_.clear();
+    entries_.clear();
+}
+
+long Memoized::UseCount() const {
+    return weak_from_this().use_count();
+}
+
+std::shared_ptr<const void> Memoized::Retain() const {
+    return weak_from_this().lock();
+}
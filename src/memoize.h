@@ -0,0 +1,67 @@
+#pragma once
+
+#include "gc.h"
+#include "object.h"
+
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+//! Counters of a memoized procedure.
+struct MemoStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    //! Number of remembered results.
+    size_t size = 0;
+    size_t capacity = 0;
+};
+
+//! Procedure which remembers results of another one by its arguments, compared with `equal?`, so repeated calls with
+//! equal arguments cost a hash probe. At most `capacity` results are kept, the least recently used one is forgotten
+//! first. Pairs and vectors among arguments are copied when remembered, so later changes to them do not affect the
+//! cache; cyclic arguments are not supported. The cache may be used by several parallel tasks at once.
+struct Memoized : public Procedure, public Collectable {
+    Memoized(ObjectPtr function, size_t capacity);
+
+    static constexpr size_t kDefaultCapacity = 1024;
+
+    const ObjectPtr& GetFunction() const;
+    MemoStats GetStats() const;
+    virtual ObjectPtr Call(std::span<const ObjectPtr> args) const override;
+
+    virtual void Trace(const std::function<void(Collectable*)>& visit) const override;
+    virtual void Clear() override;
+    virtual long UseCount() const override;
+    virtual std::shared_ptr<const void> Retain() const override;
+
+private:
+    struct Entry {
+        std::vector<ObjectPtr> args;
+        ObjectPtr result;
+    };
+
+    struct ArgumentsHash {
+        size_t operator()(std::span<const ObjectPtr> args) const;
+    };
+
+    struct ArgumentsEqual {
+        bool operator()(std::span<const ObjectPtr> lhs, std::span<const ObjectPtr> rhs) const;
+    };
+
+    ObjectPtr function_;
+    size_t capacity_;
+    // Most recently used entries go first. Keys of the index point to arguments of list entries.
+    mutable std::list<Entry> entries_;
+    mutable std::unordered_map<std::span<const ObjectPtr>, std::list<Entry>::iterator, ArgumentsHash, ArgumentsEqual>
+        index_;
+    mutable uint64_t hits_ = 0;
+    mutable uint64_t misses_ = 0;
+    //! Guards the cache and counters while tasks run.
+    mutable std::mutex mutex_;
+};
+DECLARE_TYPE_RANGE(Memoized, MEMOIZED, MEMOIZED);
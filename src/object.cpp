@@ -1,80 +1,685 @@
 #include "object.h"
 
+#include "concurrency.h"
 #include "error.h"
+#include "pool.h"
+#include "profiler.h"
 
+#include <array>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <string_view>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace {
+//! Names are interned by parallel tasks and pool workers too, so the table is locked while those run. Creating a symbol
+//! object interns its name again, hence the lock is recursive.
+class SymbolTable {
+public:
+    SymbolId GetId(std::string_view name) {
+        auto lock = concurrency::LockIfConcurrent(mutex_);
+        auto it = ids_.find(name);
+        if (it != ids_.end()) {
+            return it->second;
+        }
+        SymbolId id = names_.size();
+        // Deque never relocates its elements, so views into stored names stay valid.
+        const auto& stored = names_.emplace_back(name);
+        ids_.emplace(stored, id);
+        symbols_.emplace_back(nullptr);
+        return id;
+    }
+
+    const std::string& GetName(SymbolId id) const {
+        auto lock = concurrency::LockIfConcurrent(mutex_);
+        return names_[id];
+    }
+
+    std::shared_ptr<Symbol> GetSymbol(SymbolId id) {
+        auto lock = concurrency::LockIfConcurrent(mutex_);
+        if (symbols_[id] == nullptr) {
+            symbols_[id] = std::make_shared<Symbol>(names_[id]);
+        }
+        return symbols_[id];
+    }
+
+private:
+    mutable std::recursive_mutex mutex_;
+    std::unordered_map<std::string_view, SymbolId> ids_;
+    std::deque<std::string> names_;
+    std::vector<std::shared_ptr<Symbol>> symbols_;
+};
+
+SymbolTable& GetSymbolTable() {
+    static SymbolTable table;
+    return table;
+}
+}  // namespace
+
+namespace {
+constexpr const char* kFrozenError = "Variables of a frozen environment can not be changed";
+}  // namespace
+
+const ObjectPtr& UnboundMarker() {
+    static const ObjectPtr kUnbound = std::make_shared<Object>();
+    return kUnbound;
+}
 
 Context::Context(std::shared_ptr<Context> upper) : upper_(upper) {
 }
 
-ObjectPtr Context::Get(const std::string& name) {
-    auto current_context = this;
-    while (current_context != nullptr && !current_context->name_table_.contains(name)) {
-        current_context = current_context->upper_.get();
+Context::Context(std::shared_ptr<Context> upper, std::shared_ptr<const LambdaTemplate> layout)
+    : slots_(layout->names.size(), UnboundMarker()), layout_(std::move(layout)), upper_(std::move(upper)) {
+}
+
+Context::~Context() {
+    if (!name_table_.empty()) {
+        bindings_epoch.fetch_add(1, std::memory_order_relaxed);
     }
-    if (current_context == nullptr) {
-        throw NameError("Unable to find symbol " + name);
+}
+
+SymbolId Context::GetSlotName(size_t index) const {
+    return layout_->names[index];
+}
+
+ObjectPtr* Context::FindHere(SymbolId id) {
+    if (layout_ != nullptr) {
+        for (size_t i = 0; i < layout_->names.size(); ++i) {
+            if (layout_->names[i] == id && Load(slots_[i]) != UnboundMarker()) {
+                return &slots_[i];
+            }
+        }
+    }
+    // The owner may add names while tasks run, others look them up under the same lock.
+    std::unique_lock<concurrency::SpinLock> lock;
+    if (concurrency::IsParallel() && !IsOwned()) [[unlikely]] {
+        lock = std::unique_lock(concurrency::LockFor(&name_table_));
     }
-    return current_context->name_table_.at(name);
+    auto it = name_table_.find(id);
+    return it != name_table_.end() ? &it->second : nullptr;
 }
-void Context::Set(const std::string& name, ObjectPtr value) {
-    auto current_context = this;
-    while (current_context != nullptr && !current_context->name_table_.contains(name)) {
-        current_context = current_context->upper_.get();
+
+ObjectPtr* Context::Find(SymbolId id, Context** holder) {
+    auto scope = current_scope;
+    for (auto current_context = this; current_context != nullptr; current_context = current_context->upper_.get()) {
+        if (current_context == scope) {
+            scope = nullptr;
+        } else if (scope != nullptr && current_context->is_frozen_ && !current_context->IsFrame()) [[unlikely]] {
+            // Code of the frozen environment reached it without passing the scope, which shadows it nevertheless.
+            if (auto binding = scope->FindOver(current_context, id, holder)) {
+                return binding;
+            }
+            scope = nullptr;
+        }
+        if (auto binding = current_context->FindHere(id)) {
+            if (holder != nullptr) {
+                *holder = current_context;
+            }
+            return binding;
+        }
+    }
+    return nullptr;
+}
+
+ObjectPtr* Context::FindOver(const Context* base, SymbolId id, Context** holder) {
+    auto is_over = false;
+    for (auto layer = upper_.get(); layer != nullptr && !is_over; layer = layer->upper_.get()) {
+        is_over = layer == base;
+    }
+    for (auto layer = this; is_over && layer != base; layer = layer->upper_.get()) {
+        if (auto binding = layer->FindHere(id)) {
+            if (holder != nullptr) {
+                *holder = layer;
+            }
+            return binding;
+        }
+    }
+    return nullptr;
+}
+
+ObjectPtr Context::Get(SymbolId id) {
+    Context* holder;
+    if (auto binding = Find(id, &holder)) {
+        return holder->Load(*binding);
+    }
+    throw NameError("Unable to find symbol " + Symbol::GetName(id));
+}
+void Context::Set(SymbolId id, ObjectPtr value) {
+    NoteBinding(id);
+    Context* holder;
+    if (auto binding = Find(id, &holder)) {
+        if (holder->is_frozen_ && !holder->IsFrame() && current_scope != nullptr) {
+            current_scope->Bind(id, std::move(value));
+        } else {
+            holder->Exchange(*binding, std::move(value));
+        }
+        return;
+    }
+    throw NameError("Unable to find symbol " + Symbol::GetName(id));
+}
+void Context::Define(SymbolId id, ObjectPtr value) {
+    NoteBinding(id);
+    NameFunction(value, id);
+    Bind(id, std::move(value));
+}
+
+void Context::Bind(SymbolId id, ObjectPtr value) {
+    if (layout_ != nullptr) {
+        for (size_t i = 0; i < layout_->names.size(); ++i) {
+            if (layout_->names[i] == id) {
+                Exchange(slots_[i], std::move(value));
+                return;
+            }
+        }
+    }
+    if (is_frozen_) {
+        throw RuntimeError(kFrozenError);
+    }
+    if (concurrency::IsParallel()) [[unlikely]] {
+        CheckOwned();
+        if (auto it = name_table_.find(id); it != name_table_.end()) {
+            Exchange(it->second, std::move(value));
+            return;
+        }
+        std::lock_guard lock(concurrency::LockFor(&name_table_));
+        name_table_.emplace(id, std::move(value));
+    } else if (!name_table_.insert_or_assign(id, std::move(value)).second) {
+        return;
+    }
+    bindings_epoch.fetch_add(1, std::memory_order_relaxed);
+}
+
+ObjectPtr Context::LoadFrozen(const ObjectPtr& binding) const {
+    auto scope = current_scope;
+    if (scope == nullptr) {
+        return binding;
+    }
+    // The owner of the scope may assign variables while its tasks read them.
+    std::unique_lock<concurrency::SpinLock> lock;
+    if (concurrency::IsParallel() && !scope->IsOwned()) [[unlikely]] {
+        lock = std::unique_lock(concurrency::LockFor(&scope->overrides_));
+    }
+    if (scope->overrides_ == nullptr) {
+        return binding;
+    }
+    auto it = scope->overrides_->find(&binding);
+    return it != scope->overrides_->end() ? it->second : binding;
+}
+
+ObjectPtr Context::ExchangeFrozen(const ObjectPtr& binding, ObjectPtr value) {
+    auto scope = current_scope;
+    if (!IsFrame() || scope == nullptr) {
+        throw RuntimeError(kFrozenError);
+    }
+    std::unique_lock<concurrency::SpinLock> lock;
+    if (concurrency::IsParallel()) [[unlikely]] {
+        scope->CheckOwned();
+        lock = std::unique_lock(concurrency::LockFor(&scope->overrides_));
+    }
+    if (scope->overrides_ == nullptr) {
+        scope->overrides_ = std::make_unique<std::unordered_map<const ObjectPtr*, ObjectPtr>>();
+    }
+    auto& stored = scope->overrides_->try_emplace(&binding, binding).first->second;
+    std::swap(stored, value);
+    return value;
+}
+
+void Context::CheckOwned() const {
+    if (owner_ != concurrency::current_owner) {
+        throw RuntimeError("Variables shared between parallel tasks can not be changed while they run");
+    }
+}
+
+namespace {
+template <class T>
+void FreezeData(T* object, Context::FrozenData* data) {
+    if (!object->IsFrozen()) {
+        object->Freeze();
+        data->emplace_back(object, object->Retain());
+    }
+}
+}  // namespace
+
+void Context::FreezeReachable(FrozenData* data) {
+    std::unordered_set<Collectable*> visited = {this};
+    std::vector<Collectable*> stack = {this};
+    while (!stack.empty()) {
+        auto node = stack.back();
+        stack.pop_back();
+        if (auto context = dynamic_cast<Context*>(node)) {
+            context->Freeze();
+        } else if (auto cell = dynamic_cast<Cell*>(node)) {
+            FreezeData(cell, data);
+        } else if (auto vector = dynamic_cast<Vector*>(node)) {
+            FreezeData(vector, data);
+        } else if (auto table = dynamic_cast<HashTable*>(node)) {
+            FreezeData(table, data);
+        }
+        node->Trace([&visited, &stack](Collectable* child) {
+            if (visited.insert(child).second) {
+                stack.push_back(child);
+            }
+        });
     }
-    if (current_context == nullptr) {
-        throw NameError("Unable to find symbol " + name);
+}
+
+void Context::Thaw(const FrozenData& data) {
+    for (const auto& [node, reference] : data) {
+        if (auto cell = dynamic_cast<Cell*>(node)) {
+            cell->Thaw();
+        } else if (auto vector = dynamic_cast<Vector*>(node)) {
+            vector->Thaw();
+        } else if (auto table = dynamic_cast<HashTable*>(node)) {
+            table->Thaw();
+        }
+    }
+}
+
+std::shared_ptr<Context> Context::MakeScope(std::shared_ptr<Context> base) const {
+    auto scope = Make<Context>(std::move(base));
+    if (overrides_ != nullptr) {
+        scope->overrides_ = std::make_unique<std::unordered_map<const ObjectPtr*, ObjectPtr>>(*overrides_);
     }
-    current_context->name_table_[name] = value;
+    return scope;
+}
+
+Context::ScopeActivation::ScopeActivation(Context* scope) : previous_(current_scope) {
+    current_scope = scope;
+}
+
+Context::ScopeActivation::~ScopeActivation() {
+    current_scope = previous_;
+}
+
+ObjectPtr Context::Get(const std::string& name) {
+    return Get(Symbol::Intern(name)->GetId());
+}
+void Context::Set(const std::string& name, ObjectPtr value) {
+    Set(Symbol::Intern(name)->GetId(), value);
 }
 void Context::Define(const std::string& name, ObjectPtr value) {
-    name_table_[name] = value;
+    Define(Symbol::Intern(name)->GetId(), value);
+}
+
+void Context::Trace(const std::function<void(Collectable*)>& visit) const {
+    for (const auto& [id, value] : name_table_) {
+        TraceObject(value, visit);
+    }
+    for (const auto& value : slots_) {
+        TraceObject(value, visit);
+    }
+    if (overrides_ != nullptr) {
+        for (const auto& [binding, value] : *overrides_) {
+            TraceObject(value, visit);
+        }
+    }
+    if (upper_ != nullptr) {
+        visit(upper_.get());
+    }
+}
+
+void Context::Clear() {
+    if (!name_table_.empty()) {
+        bindings_epoch.fetch_add(1, std::memory_order_relaxed);
+    }
+    name_table_.clear();
+    slots_.clear();
+    overrides_ = nullptr;
+    upper_ = nullptr;
+}
+
+long Context::UseCount() const {
+    return weak_from_this().use_count();
 }
 
-ObjectPtr Evaluate(ObjectPtr ptr, std::shared_ptr<Context> context) {
+std::shared_ptr<const void> Context::Retain() const {
+    return weak_from_this().lock();
+}
+
+void NoteBinding(SymbolId id) {
+    if (Context::IsPureBuiltinName(id)) [[unlikely]] {
+        pure_builtins_epoch.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (Context::IsSpecialFormName(id)) [[unlikely]] {
+        special_forms_epoch.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void NameFunction(const ObjectPtr& value, SymbolId id) {
+    if (auto function = Borrow<Function>(value); function != nullptr && !function->name.has_value()) {
+        function->name = id;
+    }
+}
+
+void TraceObject(const ObjectPtr& ptr, const std::function<void(Collectable*)>& visit) {
+    if (ptr == nullptr) {
+        return;
+    }
+    // Cells are the vast majority of collectables, so they avoid the RTTI cast.
+    if (ptr->GetType() == ObjectType::CELL) {
+        visit(static_cast<Cell*>(ptr.get()));
+    } else if (ptr->GetType() == ObjectType::VECTOR) {
+        visit(static_cast<Vector*>(ptr.get()));
+    } else if (ptr->GetType() == ObjectType::HASH_TABLE) {
+        visit(static_cast<HashTable*>(ptr.get()));
+    } else if (ptr->GetType() == ObjectType::LAMBDA || ptr->GetType() == ObjectType::CLOSURE ||
+               ptr->GetType() == ObjectType::MEMOIZED || ptr->GetType() == ObjectType::FUTURE) {
+        visit(dynamic_cast<Collectable*>(ptr.get()));
+    }
+}
+
+ObjectPtr Evaluate(const ObjectPtr& ptr, const std::shared_ptr<Context>& context) {
     if (ptr == nullptr) {
         throw RuntimeError("Empty list can not be evaluated");
     }
     return ptr->Evaluate(context);
 }
-std::string Serialize(ObjectPtr ptr) {
+std::string Serialize(const ObjectPtr& ptr) {
     if (ptr == nullptr) {
         return "()";
     }
     return ptr->Serialize();
 }
 
-Number::Number(int64_t number) : value_(number) {
+namespace {
+bool IsContainer(const Object* object) {
+    return object != nullptr && (object->GetType() == ObjectType::CELL || object->GetType() == ObjectType::VECTOR);
+}
+
+//! `Equal` of two distinct objects which are not pairs or vectors.
+bool EqualAtoms(const Object* left, const Object* right) {
+    if (left == nullptr || right == nullptr || left->GetType() != right->GetType()) {
+        return false;
+    }
+    switch (left->GetType()) {
+        case ObjectType::NUMBER:
+            return static_cast<const Number*>(left)->GetValue() == static_cast<const Number*>(right)->GetValue();
+        case ObjectType::BIG_INTEGER:
+            return static_cast<const BigInteger*>(left)->GetValue() ==
+                   static_cast<const BigInteger*>(right)->GetValue();
+        case ObjectType::BOOLEAN:
+            return static_cast<const Boolean*>(left)->GetValue() == static_cast<const Boolean*>(right)->GetValue();
+        default:
+            // Symbols are interned, so equal symbols are the same object.
+            return false;
+    }
+}
+
+//! Hash of an object which is not a pair or vector.
+size_t HashAtom(const Object* object) {
+    if (object == nullptr) {
+        return 0;
+    }
+    switch (object->GetType()) {
+        case ObjectType::NUMBER:
+            return std::hash<int64_t>{}(static_cast<const Number*>(object)->GetValue());
+        case ObjectType::BIG_INTEGER:
+            return static_cast<const BigInteger*>(object)->GetValue().Hash();
+        case ObjectType::BOOLEAN:
+            return static_cast<const Boolean*>(object)->GetValue() ? 1 : 2;
+        default:
+            return std::hash<const Object*>{}(object);
+    }
+}
+
+size_t CombineHash(size_t hash, size_t part) {
+    return hash ^ (part + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2));
+}
+}  // namespace
+
+bool Equal(const ObjectPtr& lhs, const ObjectPtr& rhs) {
+    if (lhs == rhs) {
+        return true;
+    }
+    if (!IsContainer(lhs.get()) || !IsContainer(rhs.get())) {
+        return EqualAtoms(lhs.get(), rhs.get());
+    }
+    std::vector<std::pair<const Object*, const Object*>> pending = {{lhs.get(), rhs.get()}};
+    while (!pending.empty()) {
+        auto [left, right] = pending.back();
+        pending.pop_back();
+        if (left == right) {
+            continue;
+        }
+        if (left == nullptr || right == nullptr || left->GetType() != right->GetType()) {
+            return false;
+        }
+        if (left->GetType() == ObjectType::CELL) {
+            auto left_cell = static_cast<const Cell*>(left);
+            auto right_cell = static_cast<const Cell*>(right);
+            // Cars are compared first, so walking a long flat list keeps the stack small.
+            pending.emplace_back(left_cell->GetSecond().get(), right_cell->GetSecond().get());
+            pending.emplace_back(left_cell->GetFirst().get(), right_cell->GetFirst().get());
+        } else if (left->GetType() == ObjectType::VECTOR) {
+            auto left_vector = static_cast<const Vector*>(left);
+            auto right_vector = static_cast<const Vector*>(right);
+            if (left_vector->GetSize() != right_vector->GetSize()) {
+                return false;
+            }
+            for (size_t i = left_vector->GetSize(); i-- > 0;) {
+                pending.emplace_back(left_vector->Get(i).get(), right_vector->Get(i).get());
+            }
+        } else if (!EqualAtoms(left, right)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t Hash(const ObjectPtr& ptr) {
+    if (!IsContainer(ptr.get())) {
+        return CombineHash(0, HashAtom(ptr.get()));
+    }
+    constexpr size_t kHashedNodes = 64;
+    size_t hash = 0;
+    std::vector<const Object*> pending = {ptr.get()};
+    for (size_t nodes = 0; !pending.empty() && nodes < kHashedNodes; ++nodes) {
+        auto object = pending.back();
+        pending.pop_back();
+        size_t part;
+        if (IsContainer(object) && object->GetType() == ObjectType::CELL) {
+            auto cell = static_cast<const Cell*>(object);
+            pending.push_back(cell->GetSecond().get());
+            pending.push_back(cell->GetFirst().get());
+            part = 3;
+        } else if (IsContainer(object)) {
+            auto vector = static_cast<const Vector*>(object);
+            for (size_t i = vector->GetSize(); i-- > 0;) {
+                pending.push_back(vector->Get(i).get());
+            }
+            part = 4 + vector->GetSize();
+        } else {
+            part = HashAtom(object);
+        }
+        hash = CombineHash(hash, part);
+    }
+    return hash;
+}
+
+void Serialize(const ObjectPtr& ptr, std::ostream* out, const SerializeOptions& options) {
+    // Output can be infinite only through an infinite chain of cdrs or infinite nesting of lists and vectors. The
+    // first is caught by Brent's cycle detection on each list, the second by an object being the start of two open
+    // lists at once. Either way a cycle may be written out once more before it is caught.
+    struct Frame {
+        //! Next element, nullptr once elements are over.
+        const Cell* cell;
+        size_t written;
+        //! Non-list end of an improper list.
+        const ObjectPtr* tail;
+        const Object* start;
+        //! State of Brent's algorithm: a saved cell and steps made since saving it, up to a power of two.
+        const Cell* saved;
+        size_t steps;
+        size_t power;
+        bool is_elided;
+        //! Set if this frame writes a vector instead of a list, its elements are taken by `written`.
+        const Vector* vector = nullptr;
+    };
+    std::vector<Frame> stack;
+    std::unordered_set<const Object*> open;
+
+    auto begin_value = [&](const ObjectPtr& value) {
+        auto cell = Borrow<Cell>(value);
+        auto vector = Borrow<Vector>(value);
+        if (cell == nullptr && vector == nullptr) {
+            *out << ::Serialize(value);
+        } else if (options.max_depth != 0 && stack.size() == options.max_depth) {
+            *out << "...";
+        } else if (options.detect_cycles && !open.insert(value.get()).second) {
+            *out << "...";
+        } else if (cell != nullptr) {
+            *out << '(';
+            stack.push_back(Frame{cell, 0, nullptr, cell, cell, 0, 1, false});
+        } else {
+            *out << "#(";
+            stack.push_back(Frame{nullptr, 0, nullptr, vector, nullptr, 0, 1, false, vector});
+        }
+    };
+
+    begin_value(ptr);
+    while (!stack.empty()) {
+        auto& frame = stack.back();
+        bool is_over = frame.vector != nullptr ? frame.written == frame.vector->GetSize() : frame.cell == nullptr;
+        if (is_over) {
+            if (frame.is_elided) {
+                *out << " ...";
+            } else if (frame.tail != nullptr) {
+                *out << " . " << ::Serialize(*frame.tail);
+            }
+            *out << ')';
+            if (options.detect_cycles) {
+                open.erase(frame.start);
+            }
+            stack.pop_back();
+            continue;
+        }
+        if (frame.written != 0) {
+            *out << ' ';
+        }
+        if (options.max_length != 0 && frame.written == options.max_length) {
+            *out << "...)";
+            if (options.detect_cycles) {
+                open.erase(frame.start);
+            }
+            stack.pop_back();
+            continue;
+        }
+        if (frame.vector != nullptr) {
+            // May push a new frame, so `frame` must not be used after it.
+            begin_value(frame.vector->Get(frame.written++));
+            continue;
+        }
+        auto cell = frame.cell;
+        ++frame.written;
+        const auto& next = cell->GetSecond();
+        frame.cell = Borrow<Cell>(next);
+        if (frame.cell == nullptr && next != nullptr) {
+            frame.tail = &next;
+        }
+        if (options.detect_cycles && frame.cell != nullptr) {
+            if (frame.cell == frame.saved) {
+                // Elements after this one were written already.
+                frame.cell = nullptr;
+                frame.is_elided = true;
+            } else if (++frame.steps == frame.power) {
+                frame.saved = frame.cell;
+                frame.steps = 0;
+                frame.power *= 2;
+            }
+        }
+        begin_value(cell->GetFirst());
+    }
+}
+
+BigInt Integer::ToBigInt() const {
+    if (GetType() == ObjectType::NUMBER) {
+        return BigInt(static_cast<const Number*>(this)->GetValue());
+    }
+    return static_cast<const BigInteger*>(this)->GetValue();
+}
+
+Number::Number(int64_t number) : Integer(ObjectType::NUMBER), value_(number) {
 }
 
 int64_t Number::GetValue() const {
     return value_;
 }
 
-ObjectPtr Number::Evaluate([[maybe_unused]] std::shared_ptr<Context> context) {
+ObjectPtr Number::Evaluate([[maybe_unused]] const std::shared_ptr<Context>& context) {
     return this->shared_from_this();
 }
 std::string Number::Serialize() {
     return std::to_string(value_);
 }
 
-Boolean::Boolean(bool value) : value_(value) {
+namespace {
+constexpr int64_t kSmallNumberMin = -128;
+constexpr int64_t kSmallNumberMax = 1023;
+}  // namespace
+
+std::shared_ptr<Number> MakeNumber(int64_t value) {
+    static const auto kSmallNumbers = [] {
+        std::array<std::shared_ptr<Number>, kSmallNumberMax - kSmallNumberMin + 1> numbers;
+        for (int64_t i = kSmallNumberMin; i <= kSmallNumberMax; ++i) {
+            numbers[i - kSmallNumberMin] = Make<Number>(i);
+        }
+        return numbers;
+    }();
+    if (value >= kSmallNumberMin && value <= kSmallNumberMax) {
+        return kSmallNumbers[value - kSmallNumberMin];
+    }
+    return Make<Number>(value);
+}
+
+BigInteger::BigInteger(BigInt value) : Integer(ObjectType::BIG_INTEGER), value_(std::move(value)) {
+}
+
+const BigInt& BigInteger::GetValue() const {
+    return value_;
+}
+
+ObjectPtr BigInteger::Evaluate([[maybe_unused]] const std::shared_ptr<Context>& context) {
+    return this->shared_from_this();
+}
+
+std::string BigInteger::Serialize() {
+    return value_.ToString();
+}
+
+std::shared_ptr<Integer> MakeInteger(BigInt value) {
+    if (auto small = value.ToInt64()) {
+        return MakeNumber(*small);
+    }
+    return Make<BigInteger>(std::move(value));
 }
 
-Boolean::Boolean(ObjectPtr obj) {
+Boolean::Boolean(bool value) : Object(ObjectType::BOOLEAN), value_(value) {
+}
+
+Boolean::Boolean(ObjectPtr obj) : Object(ObjectType::BOOLEAN) {
     if (Is<Boolean>(obj)) {
-        value_ = As<Boolean>(obj)->GetValue();
+        value_ = Borrow<Boolean>(obj)->GetValue();
     } else {
         value_ = true;
     }
 }
 
+std::shared_ptr<Boolean> MakeBoolean(bool value) {
+    static const auto kTrue = std::make_shared<Boolean>(true);
+    static const auto kFalse = std::make_shared<Boolean>(false);
+    return value ? kTrue : kFalse;
+}
+
 bool Boolean::GetValue() const {
     return value_;
 }
 
-ObjectPtr Boolean::Evaluate([[maybe_unused]] std::shared_ptr<Context> context) {
+ObjectPtr Boolean::Evaluate([[maybe_unused]] const std::shared_ptr<Context>& context) {
     return this->shared_from_this();
 }
 
@@ -82,56 +687,281 @@ std::string Boolean::Serialize() {
     return value_ ? "#t" : "#f";
 }
 
-Symbol::Symbol(const std::string& name) : name_(name) {
+Symbol::Symbol(const std::string& name) : Object(ObjectType::SYMBOL), id_(GetSymbolTable().GetId(name)) {
+}
+
+std::shared_ptr<Symbol> Symbol::Intern(std::string_view name) {
+    auto& table = GetSymbolTable();
+    return table.GetSymbol(table.GetId(name));
+}
+
+std::shared_ptr<Symbol> Symbol::Intern(SymbolId id) {
+    return GetSymbolTable().GetSymbol(id);
+}
+
+const std::string& Symbol::GetName(SymbolId id) {
+    return GetSymbolTable().GetName(id);
+}
+
+SymbolId Symbol::GetId() const {
+    return id_;
 }
 
 const std::string& Symbol::GetName() const {
-    return name_;
+    return GetSymbolTable().GetName(id_);
 }
 
-ObjectPtr Symbol::Evaluate(std::shared_ptr<Context> context) {
-    return context->Get(name_);
+ObjectPtr Symbol::Evaluate(const std::shared_ptr<Context>& context) {
+    return context->Get(id_);
 }
 std::string Symbol::Serialize() {
-    return name_;
+    return GetName();
 }
 
-ObjectPtr Cell::GetFirst() {
+const ObjectPtr& Cell::GetFirst() const {
     return first_;
 }
-ObjectPtr Cell::GetSecond() {
+const ObjectPtr& Cell::GetSecond() const {
     return second_;
 }
 
-Cell::Cell(ObjectPtr first, ObjectPtr second) : first_(first), second_(second) {
+Cell::Cell() : Object(ObjectType::CELL) {
+}
+Cell::Cell(ObjectPtr first, ObjectPtr second)
+    : Object(ObjectType::CELL), first_(std::move(first)), second_(std::move(second)) {
+}
+
+Cell::~Cell() {
+    // Destroying a long or deeply nested list recursively would take a C++ frame per pair. Instead, pairs which are
+    // about to die are queued and destroyed one by one by the outermost destructor.
+    static thread_local std::vector<ObjectPtr> dying;
+    static thread_local bool is_destroying = false;
+    for (auto child : {&first_, &second_}) {
+        if (*child != nullptr && (*child)->GetType() == ObjectType::CELL && child->use_count() == 1) {
+            dying.push_back(std::move(*child));
+        }
+    }
+    if (is_destroying) {
+        return;
+    }
+    is_destroying = true;
+    while (!dying.empty()) {
+        auto cell = std::move(dying.back());
+        dying.pop_back();
+    }
+    is_destroying = false;
 }
 
 void Cell::SetFirst(ObjectPtr ptr) {
-    first_ = ptr;
+    first_ = std::move(ptr);
 }
 void Cell::SetSecond(ObjectPtr ptr) {
-    second_ = ptr;
+    second_ = std::move(ptr);
 }
 
-ObjectPtr Cell::Evaluate(std::shared_ptr<Context> context) {
-    auto evaluated = ::Evaluate(first_, context);
-    if (!Is<Function>(evaluated)) {
-        throw RuntimeError("First element of list isn't applicable (not a function)");
+ObjectPtr Cell::Evaluate(const std::shared_ptr<Context>& context) {
+    ObjectPtr expression = this->shared_from_this();
+    // Context of a tail call is kept here, the caller's one is used until then without copying.
+    std::shared_ptr<Context> tail_context;
+    const std::shared_ptr<Context>* current_context = &context;
+    TailCall tail;
+    ProfilerScope profiler_scope;
+    while (true) {
+        auto cell = static_cast<Cell*>(expression.get());
+        auto evaluated = ::Evaluate(cell->first_, *current_context);
+        auto function = Borrow<Function>(evaluated);
+        if (function == nullptr) {
+            throw RuntimeError("First element of list isn't applicable (not a function)");
+        }
+        if (auto profiler = profiler_scope.GetProfiler()) [[unlikely]] {
+            // A lambda in tail position replaces the calls made so far, other functions are nested into them.
+            if (Is<Lambda>(evaluated)) {
+                profiler->Unwind(profiler_scope.GetDepth());
+            }
+            profiler->Enter(*function);
+        }
+        auto result = function->ApplyTail(cell->second_, *current_context, &tail);
+        if (tail.context == nullptr) {
+            return result;
+        }
+        expression = std::move(tail.expression);
+        tail_context = std::move(tail.context);
+        current_context = &tail_context;
+        tail = TailCall{};
+        if (!Is<Cell>(expression)) {
+            return ::Evaluate(expression, tail_context);
+        }
     }
-    return As<Function>(evaluated)->Apply(second_, context);
 }
+void Cell::Trace(const std::function<void(Collectable*)>& visit) const {
+    TraceObject(first_, visit);
+    TraceObject(second_, visit);
+}
+
+void Cell::Clear() {
+    first_ = nullptr;
+    second_ = nullptr;
+}
+
+long Cell::UseCount() const {
+    return weak_from_this().use_count();
+}
+
+std::shared_ptr<const void> Cell::Retain() const {
+    return weak_from_this().lock();
+}
+
 std::string Cell::Serialize() {
-    std::string res = "(";
-    auto current = this->shared_from_this();
-    while (Is<Cell>(As<Cell>(current)->second_)) {
-        res += ::Serialize(As<Cell>(current)->first_) + " ";
-        current = As<Cell>(current)->second_;
-    }
-    if (As<Cell>(current)->second_ == nullptr) {
-        res += ::Serialize(As<Cell>(current)->first_) + ")";
-    } else {
-        res += ::Serialize(As<Cell>(current)->first_) + " . " +
-               ::Serialize(As<Cell>(current)->second_) + ")";
+    std::ostringstream out;
+    ::Serialize(shared_from_this(), &out);
+    return out.str();
+}
+
+Vector::Vector(std::vector<ObjectPtr> elements) : Object(ObjectType::VECTOR), elements_(std::move(elements)) {
+}
+
+ObjectPtr Vector::Evaluate([[maybe_unused]] const std::shared_ptr<Context>& context) {
+    return this->shared_from_this();
+}
+
+std::string Vector::Serialize() {
+    std::ostringstream out;
+    ::Serialize(shared_from_this(), &out);
+    return out.str();
+}
+
+void Vector::Trace(const std::function<void(Collectable*)>& visit) const {
+    for (const auto& element : elements_) {
+        TraceObject(element, visit);
+    }
+}
+
+void Vector::Clear() {
+    elements_.clear();
+}
+
+long Vector::UseCount() const {
+    return weak_from_this().use_count();
+}
+
+std::shared_ptr<const void> Vector::Retain() const {
+    return weak_from_this().lock();
+}
+
+HashTable::HashTable() : Object(ObjectType::HASH_TABLE) {
+    Rehash(0);
+}
+
+size_t HashTable::Probe(const ObjectPtr& key, size_t hash) const {
+    auto mixed = hash * 0x9e3779b97f4a7c15;
+    auto tag = static_cast<uint32_t>(mixed);
+    auto mask = buckets_.size() - 1;
+    auto first_removed = kEmpty;
+    for (size_t i = mixed >> shift_;; i = (i + 1) & mask) {
+        const auto& bucket = buckets_[i];
+        if (bucket.entry == kEmpty) {
+            return first_removed != kEmpty ? first_removed : i;
+        }
+        if (bucket.entry == kRemoved) {
+            if (first_removed == kEmpty) {
+                first_removed = i;
+            }
+        } else if (bucket.hash_tag == tag && entries_[bucket.entry].hash == hash &&
+                   Equal(entries_[bucket.entry].key, key)) {
+            return i;
+        }
+    }
+}
+
+const ObjectPtr* HashTable::Find(const ObjectPtr& key) const {
+    auto entry = buckets_[Probe(key, Hash(key))].entry;
+    return entry < kRemoved ? &entries_[entry].value : nullptr;
+}
+
+void HashTable::Set(const ObjectPtr& key, ObjectPtr value) {
+    auto hash = Hash(key);
+    auto& bucket = buckets_[Probe(key, hash)];
+    if (bucket.entry < kRemoved) {
+        entries_[bucket.entry].value = std::move(value);
+        return;
+    }
+    // Removed entries and buckets count as used, so that probe sequences always end at an empty bucket.
+    if ((entries_.size() + 1) * 4 > buckets_.size() * 3) {
+        Rehash(count_ + 1);
+        Set(key, std::move(value));
+        return;
+    }
+    bucket = Bucket{static_cast<uint32_t>(entries_.size()), static_cast<uint32_t>(hash * 0x9e3779b97f4a7c15)};
+    entries_.push_back(Entry{key, std::move(value), hash});
+    ++count_;
+}
+
+bool HashTable::Remove(const ObjectPtr& key) {
+    auto& bucket = buckets_[Probe(key, Hash(key))];
+    if (bucket.entry >= kRemoved) {
+        return false;
+    }
+    entries_[bucket.entry] = Entry{UnboundMarker(), nullptr, 0};
+    bucket.entry = kRemoved;
+    --count_;
+    return true;
+}
+
+void HashTable::Rehash(size_t count) {
+    std::erase_if(entries_, [](const Entry& entry) { return entry.key == UnboundMarker(); });
+    // At most half of the buckets are used right after rehashing.
+    shift_ = 61;
+    while ((size_t{1} << (64 - shift_)) < count * 2) {
+        --shift_;
     }
-    return res;
+    buckets_.assign(size_t{1} << (64 - shift_), Bucket{kEmpty, 0});
+    auto mask = buckets_.size() - 1;
+    for (size_t entry = 0; entry < entries_.size(); ++entry) {
+        auto mixed = entries_[entry].hash * 0x9e3779b97f4a7c15;
+        auto i = mixed >> shift_;
+        while (buckets_[i].entry != kEmpty) {
+            i = (i + 1) & mask;
+        }
+        buckets_[i] = Bucket{static_cast<uint32_t>(entry), static_cast<uint32_t>(mixed)};
+    }
+}
+
+std::vector<std::pair<ObjectPtr, ObjectPtr>> HashTable::GetEntries() const {
+    std::vector<std::pair<ObjectPtr, ObjectPtr>> result;
+    result.reserve(count_);
+    for (const auto& entry : entries_) {
+        if (entry.key != UnboundMarker()) {
+            result.emplace_back(entry.key, entry.value);
+        }
+    }
+    return result;
+}
+
+ObjectPtr HashTable::Evaluate([[maybe_unused]] const std::shared_ptr<Context>& context) {
+    return this->shared_from_this();
+}
+
+std::string HashTable::Serialize() {
+    return "#<hash-table>";
+}
+
+void HashTable::Trace(const std::function<void(Collectable*)>& visit) const {
+    for (const auto& entry : entries_) {
+        TraceObject(entry.key, visit);
+        TraceObject(entry.value, visit);
+    }
+}
+
+void HashTable::Clear() {
+    entries_.clear();
+    count_ = 0;
+    Rehash(0);
+}
+
+long HashTable::UseCount() const {
+    return weak_from_this().use_count();
+}
+
+std::shared_ptr<const void> HashTable::Retain() const {
+    return weak_from_this().lock();
 }
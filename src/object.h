@@ -1,68 +1,338 @@
 #pragma once
 
+#include "bigint.h"
+#include "concurrency.h"
 #include "error.h"
+#include "gc.h"
+#include "pool.h"
+#include <atomic>
+#include <cstdint>
 #include <memory>
+#include <optional>
+#include <ostream>
+#include <span>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 class Context;
+struct LambdaTemplate;
+
+//! Stable identifier of an interned symbol name. Equal names always have equal ids.
+using SymbolId = uint32_t;
+
+//! Concrete kind of an object, so that type checks are a compare instead of an RTTI walk. Kinds of functions are kept
+//! together at the end, so checks for `Function` and `Procedure` are range compares.
+enum class ObjectType : uint8_t {
+    OBJECT,
+    NUMBER,
+    BIG_INTEGER,
+    BOOLEAN,
+    SYMBOL,
+    CELL,
+    VECTOR,
+    HASH_TABLE,
+    FUTURE,
+    LOCAL_REF,
+    GLOBAL_REF,
+    LAMBDA_EXPR,
+    CONSTANT_EXPR,
+    SPECIAL_FORM,
+    PROCEDURE,
+    LAMBDA,
+    CLOSURE,
+    MEMOIZED,
+};
+
+//! Closed range of `ObjectType`s which objects of class T and its subclasses have. Classes without it (such as
+//! particular builtins) are checked with RTTI.
+template <class T>
+struct TypeRange;
+
+#define DECLARE_TYPE_RANGE(CLASS, FIRST, LAST)                  \
+    template <>                                                 \
+    struct TypeRange<CLASS> {                                   \
+        static constexpr ObjectType kFirst = ObjectType::FIRST; \
+        static constexpr ObjectType kLast = ObjectType::LAST;   \
+    }
 
 class Object : public std::enable_shared_from_this<Object> {
 public:
+    explicit Object(ObjectType type = ObjectType::OBJECT) : type_(type) {
+    }
     virtual ~Object() = default;
-    virtual std::shared_ptr<Object> Evaluate([[maybe_unused]] std::shared_ptr<Context> context) {
+    ObjectType GetType() const {
+        return type_;
+    }
+    virtual std::shared_ptr<Object> Evaluate([[maybe_unused]] const std::shared_ptr<Context>& context) {
         throw RuntimeError("Unimplemented evaluation of Object");
     }
     virtual std::string Serialize() {
         throw RuntimeError("Unimplemented serialization of Object");
     }
+
+private:
+    ObjectType type_;
 };
 
 // We want all objects to be mutable.
 using ObjectPtr = std::shared_ptr<Object>;
 
-class Context {
+//! Marker stored in frame slots of inner definitions which were not executed yet. It is never visible to user code.
+const ObjectPtr& UnboundMarker();
+
+//! Counts bindings and assignments of names of pure builtins anywhere. Code which relies on them keeping their meaning,
+//! such as expressions folded ahead of time, is valid only while the counter stays the same.
+inline std::atomic<uint64_t> pure_builtins_epoch{0};
+
+//! Counts bindings and assignments of names of builtin special forms anywhere. Code which treats these names as the
+//! forms, such as compiled bytecode, is valid only while the counter stays the same.
+inline std::atomic<uint64_t> special_forms_epoch{0};
+
+//! Counts changes of the set of names bound in name tables: new names, cleared and destroyed tables. Assignments and
+//! redefinitions change values in place and are not counted. Cached lookups stay valid while it stays the same.
+inline std::atomic<uint64_t> bindings_epoch{0};
+
+//! Must be called whenever `id` is bound or assigned, advances `pure_builtins_epoch` if it names a pure builtin and
+//! `special_forms_epoch` if it names a special form.
+void NoteBinding(SymbolId id);
+
+//! Context is either a name table (global scope, keywords) or a lambda call frame, whose parameters and inner
+//! definitions are kept in a fixed-size slot array laid out by the lambda's template and addressed by resolved
+//! `LocalRef`s. Lookups by id work for both kinds, so unresolved code still sees frame variables.
+//!
+//! Bindings are read with `Load` and changed with `Exchange`, which follow the rules of `concurrency` while parallel
+//! tasks run: only the owner of a context, the task or other code which created it, may change it then.
+//!
+//! Frozen contexts never change, so any number of threads read them without locking. Builtins are frozen, and so is
+//! an environment that interpreters were forked from (see `Interpreter::Fork`). Each interpreter evaluates code in a
+//! scope of its own put over the frozen ones, which is current on the thread meanwhile. Definitions in the scope shadow
+//! frozen globals, also for functions defined in the frozen environment, and the scope keeps values assigned to
+//! variables of frozen frames. Hence every interpreter sees the environment as its own copy.
+class Context : public std::enable_shared_from_this<Context>, public Collectable {
 public:
     Context() = default;
     Context(std::shared_ptr<Context> upper);
+    Context(std::shared_ptr<Context> upper, std::shared_ptr<const LambdaTemplate> layout);
+    ~Context();
+
+    ObjectPtr Get(SymbolId id);
+    void Set(SymbolId id, ObjectPtr value);
+    void Define(SymbolId id, ObjectPtr value);
 
     ObjectPtr Get(const std::string& name);
     void Set(const std::string& name, ObjectPtr value);
     void Define(const std::string& name, ObjectPtr value);
 
-    static std::shared_ptr<Context> GetKeywords();
+    static const std::shared_ptr<Context>& GetKeywords();
+    //! Whether `id` is the name of a builtin which is pure, see `Function::is_pure`.
+    static bool IsPureBuiltinName(SymbolId id);
+    //! Whether `id` is the name of a builtin special form, that is of a function which is not a procedure.
+    static bool IsSpecialFormName(SymbolId id);
 
-    std::unordered_map<std::string, ObjectPtr> GetNameTable() {
+    std::unordered_map<SymbolId, ObjectPtr> GetNameTable() {
         return name_table_;
     }
-    void SetNameTable(std::unordered_map<std::string, ObjectPtr> name_table) {
+    void SetNameTable(std::unordered_map<SymbolId, ObjectPtr> name_table) {
+        pure_builtins_epoch.fetch_add(1, std::memory_order_relaxed);
+        special_forms_epoch.fetch_add(1, std::memory_order_relaxed);
+        bindings_epoch.fetch_add(1, std::memory_order_relaxed);
         name_table_ = name_table;
     }
-    ObjectPtr StraightGet(const std::string& name) {
-        return name_table_.contains(name) ? name_table_[name] : std::make_shared<Object>();
+    ObjectPtr StraightGet(SymbolId id) {
+        return name_table_.contains(id) ? name_table_[id] : std::make_shared<Object>();
+    }
+
+    //! Returns binding visible from this context, or nullptr if the name is not bound. The context holding the binding
+    //! is stored to `holder`, its `Load` must be used to read the binding.
+    ObjectPtr* Find(SymbolId id, Context** holder = nullptr);
+
+    //! Value of a binding of this context.
+    ObjectPtr Load(const ObjectPtr& binding) const {
+        if (is_frozen_) [[unlikely]] {
+            return IsFrame() ? LoadFrozen(binding) : binding;
+        }
+        if (concurrency::IsParallel() && owner_ != concurrency::current_owner) [[unlikely]] {
+            return concurrency::LoadShared(binding);
+        }
+        return binding;
+    }
+    //! Changes a binding of this context and returns its previous value. Throws if tasks run and the current code does
+    //! not own the context, or if it is a frozen name table.
+    ObjectPtr Exchange(ObjectPtr& binding, ObjectPtr value) {
+        if (is_frozen_) [[unlikely]] {
+            return ExchangeFrozen(binding, std::move(value));
+        }
+        if (concurrency::IsParallel()) [[unlikely]] {
+            CheckOwned();
+            return concurrency::ExchangeShared(binding, std::move(value));
+        }
+        std::swap(binding, value);
+        return value;
+    }
+    //! Forbids changes of this context, see above.
+    void Freeze() {
+        is_frozen_ = true;
+    }
+    //! Pairs, vectors and hash tables frozen by `FreezeReachable`, each with a reference which keeps it alive.
+    using FrozenData = std::vector<std::pair<Collectable*, std::shared_ptr<const void>>>;
+    //! Freezes this context and every context, pair, vector and hash table reachable from it. Appends pairs, vectors
+    //! and hash tables which were not frozen before to `data`.
+    void FreezeReachable(FrozenData* data);
+    //! Lets pairs, vectors and hash tables of `data` be changed again. Contexts stay frozen, scopes are put over them.
+    static void Thaw(const FrozenData& data);
+
+    //! Scope of the interpreter whose code runs on this thread, if any.
+    static Context* GetCurrentScope() {
+        return current_scope;
+    }
+    //! Makes a scope current for its lifetime, restoring the previous one afterwards.
+    class ScopeActivation {
+    public:
+        explicit ScopeActivation(Context* scope);
+        ~ScopeActivation();
+
+        ScopeActivation(const ScopeActivation&) = delete;
+        ScopeActivation& operator=(const ScopeActivation&) = delete;
+
+    private:
+        Context* previous_;
+    };
+    //! Whether this scope has no definitions of its own.
+    bool IsEmptyScope() const {
+        return name_table_.empty();
+    }
+    //! Returns a new scope over the frozen `base`, which starts with the values this scope assigned to variables of
+    //! frozen frames.
+    std::shared_ptr<Context> MakeScope(std::shared_ptr<Context> base) const;
+
+    ObjectPtr& GetSlot(size_t index) {
+        return slots_[index];
+    }
+    const ObjectPtr& GetSlot(size_t index) const {
+        return slots_[index];
     }
+    SymbolId GetSlotName(size_t index) const;
+    Context* GetUpper() const {
+        return upper_.get();
+    }
+    //! Whether this is a lambda call frame rather than a name table.
+    bool IsFrame() const {
+        return layout_ != nullptr;
+    }
+    //! Template which lays out slots of a frame, nullptr for name tables.
+    const std::shared_ptr<const LambdaTemplate>& GetLayout() const {
+        return layout_;
+    }
+
+    virtual void Trace(const std::function<void(Collectable*)>& visit) const override;
+    virtual void Clear() override;
+    virtual long UseCount() const override;
+    virtual std::shared_ptr<const void> Retain() const override;
 
 private:
-    std::unordered_map<std::string, ObjectPtr> name_table_;
+    ObjectPtr* FindHere(SymbolId id);
+    //! Looks `id` up in this scope and the ones under it down to `base`, which must be frozen and under this scope.
+    ObjectPtr* FindOver(const Context* base, SymbolId id, Context** holder);
+    //! Same as `Define`, but leaves the name of a function alone.
+    void Bind(SymbolId id, ObjectPtr value);
+    ObjectPtr LoadFrozen(const ObjectPtr& binding) const;
+    ObjectPtr ExchangeFrozen(const ObjectPtr& binding, ObjectPtr value);
+    bool IsOwned() const {
+        return is_frozen_ || owner_ == concurrency::current_owner;
+    }
+    void CheckOwned() const;
+
+    static inline thread_local Context* current_scope = nullptr;
+
+    std::unordered_map<SymbolId, ObjectPtr> name_table_;
+    std::vector<ObjectPtr, pool::Allocator<ObjectPtr>> slots_;
+    std::shared_ptr<const LambdaTemplate> layout_ = nullptr;
     std::shared_ptr<Context> upper_ = nullptr;
+    //! Values assigned through this scope to variables of frozen frames, keyed by their bindings.
+    std::unique_ptr<std::unordered_map<const ObjectPtr*, ObjectPtr>> overrides_;
+    uint64_t owner_ = concurrency::current_owner;
+    bool is_frozen_ = false;
 };
 
+//! Gives a function which is being defined under `id` that name, unless it already has one.
+void NameFunction(const ObjectPtr& value, SymbolId id);
+
+//! Reports `ptr` to a collector's visitor if it is a collectable object.
+void TraceObject(const ObjectPtr& ptr, const std::function<void(Collectable*)>& visit);
+
 //! Function that either calls a method or throwss if argument is nullptr.
-ObjectPtr Evaluate(ObjectPtr ptr, std::shared_ptr<Context> context);
+ObjectPtr Evaluate(const ObjectPtr& ptr, const std::shared_ptr<Context>& context);
 //! Function that either calls a method or returns `()` if argument is nullptr.
-std::string Serialize(ObjectPtr ptr);
+std::string Serialize(const ObjectPtr& ptr);
+
+//! Structural equality of `equal?`: integers and booleans are compared by value, pairs and vectors element by element,
+//! everything else by identity. Nesting is walked with an explicit stack; cyclic structures make it loop forever.
+bool Equal(const ObjectPtr& lhs, const ObjectPtr& rhs);
+
+//! Hash consistent with `Equal`. Only the first few dozen nodes of a structure are hashed, so it takes bounded time
+//! even for huge or cyclic ones.
+size_t Hash(const ObjectPtr& ptr);
+
+//! Limits of serialized output, parts beyond them are written as `...`.
+struct SerializeOptions {
+    //! Lists nested deeper than this are elided, 0 means no limit.
+    size_t max_depth = 0;
+    //! Elements of a list after this many are elided, 0 means no limit.
+    size_t max_length = 0;
+    //! Whether a pair which is being written already is elided instead of looping forever.
+    bool detect_cycles = true;
+};
+
+//! Writes serialization of `ptr` to `out` as it goes, without building intermediate strings. Lists are walked with an
+//! explicit stack, so deep nesting does not overflow the C++ one.
+void Serialize(const ObjectPtr& ptr, std::ostream* out, const SerializeOptions& options = {});
+
+//! Integer of either representation. Arithmetic works on `Number`s while results fit into 64 bits and promotes them
+//! to `BigInteger`s only on overflow; results which fit again are always turned back into `Number`s.
+class Integer : public Object {
+public:
+    using Object::Object;
+
+    //! Value of the integer in arbitrary precision, which is slow for `Number`s.
+    BigInt ToBigInt() const;
+};
+DECLARE_TYPE_RANGE(Integer, NUMBER, BIG_INTEGER);
 
-class Number : public Object {
+class Number : public Integer {
 public:
     Number(int64_t value);
 
     int64_t GetValue() const;
-    virtual ObjectPtr Evaluate(std::shared_ptr<Context> context) override;
+    virtual ObjectPtr Evaluate(const std::shared_ptr<Context>& context) override;
     virtual std::string Serialize() override;
 
 private:
     int64_t value_;
 };
+DECLARE_TYPE_RANGE(Number, NUMBER, NUMBER);
+
+//! Returns a number object for given value. Small integers are preallocated and shared, so producing them never
+//! allocates (numbers are immutable, thus sharing is invisible to the user).
+std::shared_ptr<Number> MakeNumber(int64_t value);
+
+class BigInteger : public Integer {
+public:
+    explicit BigInteger(BigInt value);
+
+    const BigInt& GetValue() const;
+    virtual ObjectPtr Evaluate(const std::shared_ptr<Context>& context) override;
+    virtual std::string Serialize() override;
+
+private:
+    BigInt value_;
+};
+DECLARE_TYPE_RANGE(BigInteger, BIG_INTEGER, BIG_INTEGER);
+
+//! Returns `value` as a `Number` if it fits into one, otherwise as a `BigInteger`.
+std::shared_ptr<Integer> MakeInteger(BigInt value);
 
 class Boolean : public Object {
 public:
@@ -71,55 +341,272 @@ public:
     explicit Boolean(ObjectPtr obj);
 
     bool GetValue() const;
-    virtual ObjectPtr Evaluate(std::shared_ptr<Context> context) override;
+    virtual ObjectPtr Evaluate(const std::shared_ptr<Context>& context) override;
     virtual std::string Serialize() override;
 
 private:
     bool value_;
 };
+DECLARE_TYPE_RANGE(Boolean, BOOLEAN, BOOLEAN);
+
+//! Returns one of two shared `#t`/`#f` singletons, never allocates.
+std::shared_ptr<Boolean> MakeBoolean(bool value);
 
 class Symbol : public Object {
 public:
     Symbol(const std::string& name);
 
+    //! Returns the canonical symbol object for the name, so all occurrences of a name share one object.
+    static std::shared_ptr<Symbol> Intern(std::string_view name);
+    static std::shared_ptr<Symbol> Intern(SymbolId id);
+    //! Returns the name an id was interned for.
+    static const std::string& GetName(SymbolId id);
+
+    SymbolId GetId() const;
     const std::string& GetName() const;
-    virtual ObjectPtr Evaluate(std::shared_ptr<Context> context) override;
+    virtual ObjectPtr Evaluate(const std::shared_ptr<Context>& context) override;
     virtual std::string Serialize() override;
 
 private:
-    std::string name_;
+    SymbolId id_;
 };
+DECLARE_TYPE_RANGE(Symbol, SYMBOL, SYMBOL);
 
-class Cell : public Object {
+class Cell : public Object, public Collectable {
 public:
-    Cell() = default;
+    Cell();
     Cell(ObjectPtr first, ObjectPtr second);
+    ~Cell();
 
-    ObjectPtr GetFirst();
-    ObjectPtr GetSecond();
+    const ObjectPtr& GetFirst() const;
+    const ObjectPtr& GetSecond() const;
 
     void SetFirst(ObjectPtr);
     void SetSecond(ObjectPtr);
 
-    virtual ObjectPtr Evaluate(std::shared_ptr<Context> context) override;
+    //! Frozen pairs are shared by forked interpreters, builtins refuse to change them.
+    bool IsFrozen() const {
+        return is_frozen_;
+    }
+    void Freeze() {
+        is_frozen_ = true;
+    }
+    void Thaw() {
+        is_frozen_ = false;
+    }
+
+    virtual ObjectPtr Evaluate(const std::shared_ptr<Context>& context) override;
     virtual std::string Serialize() override;
 
+    virtual void Trace(const std::function<void(Collectable*)>& visit) const override;
+    virtual void Clear() override;
+    virtual long UseCount() const override;
+    virtual std::shared_ptr<const void> Retain() const override;
+
 private:
     ObjectPtr first_;
     ObjectPtr second_;
+    bool is_frozen_ = false;
+};
+DECLARE_TYPE_RANGE(Cell, CELL, CELL);
+
+//! Fixed-size array of objects with constant-time indexed access. Vectors evaluate to themselves.
+class Vector : public Object, public Collectable {
+public:
+    explicit Vector(std::vector<ObjectPtr> elements = {});
+
+    size_t GetSize() const {
+        return elements_.size();
+    }
+    //! Bounds are not checked.
+    const ObjectPtr& Get(size_t index) const {
+        return elements_[index];
+    }
+    void Set(size_t index, ObjectPtr value) {
+        elements_[index] = std::move(value);
+    }
+    const std::vector<ObjectPtr>& GetElements() const {
+        return elements_;
+    }
+    //! Same as `Cell::IsFrozen`.
+    bool IsFrozen() const {
+        return is_frozen_;
+    }
+    void Freeze() {
+        is_frozen_ = true;
+    }
+    void Thaw() {
+        is_frozen_ = false;
+    }
+
+    virtual ObjectPtr Evaluate(const std::shared_ptr<Context>& context) override;
+    virtual std::string Serialize() override;
+
+    virtual void Trace(const std::function<void(Collectable*)>& visit) const override;
+    virtual void Clear() override;
+    virtual long UseCount() const override;
+    virtual std::shared_ptr<const void> Retain() const override;
+
+private:
+    std::vector<ObjectPtr> elements_;
+    bool is_frozen_ = false;
 };
+DECLARE_TYPE_RANGE(Vector, VECTOR, VECTOR);
+
+//! Mutable map with keys compared by `Equal`. Entries are kept in a dense array in insertion order, which is also the
+//! order of iteration; an open-addressing index with linear probing maps hashes to their positions. Buckets hold a
+//! part of the hash, so probing rarely touches entries of other keys. Keys must not be changed while they are in the
+//! table. Hash tables evaluate to themselves.
+class HashTable : public Object, public Collectable {
+public:
+    HashTable();
+
+    size_t GetCount() const {
+        return count_;
+    }
+    //! Returns the value bound to `key`, or nullptr if there is none.
+    const ObjectPtr* Find(const ObjectPtr& key) const;
+    void Set(const ObjectPtr& key, ObjectPtr value);
+    //! Returns whether there was a value to remove.
+    bool Remove(const ObjectPtr& key);
+    //! Key and value pairs in insertion order.
+    std::vector<std::pair<ObjectPtr, ObjectPtr>> GetEntries() const;
+    //! Same as `Cell::IsFrozen`.
+    bool IsFrozen() const {
+        return is_frozen_;
+    }
+    void Freeze() {
+        is_frozen_ = true;
+    }
+    void Thaw() {
+        is_frozen_ = false;
+    }
+
+    virtual ObjectPtr Evaluate(const std::shared_ptr<Context>& context) override;
+    virtual std::string Serialize() override;
+
+    virtual void Trace(const std::function<void(Collectable*)>& visit) const override;
+    virtual void Clear() override;
+    virtual long UseCount() const override;
+    virtual std::shared_ptr<const void> Retain() const override;
+
+private:
+    struct Entry {
+        ObjectPtr key;
+        ObjectPtr value;
+        size_t hash;
+    };
+
+    struct Bucket {
+        //! Position in `entries_`, or one of the markers below.
+        uint32_t entry;
+        uint32_t hash_tag;
+    };
+
+    static constexpr uint32_t kEmpty = UINT32_MAX;
+    static constexpr uint32_t kRemoved = UINT32_MAX - 1;
+
+    //! Returns the bucket which holds `key`, or the empty bucket ending its probe sequence.
+    size_t Probe(const ObjectPtr& key, size_t hash) const;
+    //! Drops removed entries and rebuilds the index with room for at least `count` entries.
+    void Rehash(size_t count);
+
+    //! Removed entries stay here with `UnboundMarker()` as a key until the next rehash.
+    std::vector<Entry> entries_;
+    //! Size is a power of two, `2^(64 - shift_)`. Buckets are chosen by top bits of the multiplied hash.
+    std::vector<Bucket> buckets_;
+    int shift_;
+    size_t count_ = 0;
+    bool is_frozen_ = false;
+};
+DECLARE_TYPE_RANGE(HashTable, HASH_TABLE, HASH_TABLE);
+
+//! Returns `obj` as T without touching reference counts, or nullptr if it is not a T. The pointer is borrowed, so it
+//! is valid only while `obj` is.
+template <class T>
+T* Borrow(const ObjectPtr& obj) {
+    if constexpr (requires { TypeRange<T>::kFirst; }) {
+        if (obj == nullptr || obj->GetType() < TypeRange<T>::kFirst || obj->GetType() > TypeRange<T>::kLast) {
+            return nullptr;
+        }
+        return static_cast<T*>(obj.get());
+    } else {
+        return dynamic_cast<T*>(obj.get());
+    }
+}
 
 template <class T>
 std::shared_ptr<T> As(const ObjectPtr& obj) {
-    return std::dynamic_pointer_cast<T>(obj);
+    if (auto ptr = Borrow<T>(obj)) {
+        return std::shared_ptr<T>(obj, ptr);
+    }
+    return nullptr;
 }
 
 template <class T>
 bool Is(const ObjectPtr& obj) {
-    return std::dynamic_pointer_cast<T>(obj) != nullptr;
+    return Borrow<T>(obj) != nullptr;
 }
 
+//! Expression which is left to evaluate in tail position of a function application.
+struct TailCall {
+    ObjectPtr expression;
+    std::shared_ptr<Context> context;
+};
+
 struct Function : public Object {
-    virtual ObjectPtr Apply(ObjectPtr args, std::shared_ptr<Context> context) const = 0;
-    virtual ObjectPtr Evaluate(std::shared_ptr<Context> context) override;
+    explicit Function(ObjectType type = ObjectType::SPECIAL_FORM) : Object(type) {
+    }
+
+    //! Name the function was registered or first defined under, none for anonymous lambdas.
+    std::optional<SymbolId> name;
+    //! Set for builtins which have no side effects and give the same result every time they are called on integers,
+    //! booleans and symbols (`quote` on any datum), so such calls may be computed ahead of time.
+    bool is_pure = false;
+
+    virtual ObjectPtr Apply(const ObjectPtr& args, const std::shared_ptr<Context>& context) const = 0;
+    //! Same as `Apply`, but a function may fill `tail` with its final expression instead of evaluating it. The caller
+    //! then evaluates it in a loop, so tail calls need neither C++ stack nor live frames of finished calls. Returned
+    //! value matters only if `tail->context` was left empty.
+    virtual ObjectPtr ApplyTail(const ObjectPtr& args, const std::shared_ptr<Context>& context, TailCall* tail) const;
+    virtual ObjectPtr Evaluate(const std::shared_ptr<Context>& context) override;
+};
+
+//! Function which needs only values of its arguments, unlike special forms. `Apply` evaluates arguments in the
+//! caller's context and passes them to `Call`, which is also what compiled code uses directly.
+struct Procedure : public Function {
+    explicit Procedure(ObjectType type = ObjectType::PROCEDURE) : Function(type) {
+    }
+    virtual ObjectPtr Apply(const ObjectPtr& args, const std::shared_ptr<Context>& context) const override;
+    virtual ObjectPtr Call(std::span<const ObjectPtr> args) const = 0;
+};
+DECLARE_TYPE_RANGE(Function, SPECIAL_FORM, MEMOIZED);
+DECLARE_TYPE_RANGE(Procedure, PROCEDURE, MEMOIZED);
+
+//! Resolved lambda shared by all closures created from the same expression. Frame slots are parameters followed by
+//! inner definitions, in the order of `names`.
+struct LambdaTemplate {
+    std::vector<SymbolId> names;
+    size_t arg_count = 0;
+    std::vector<ObjectPtr> commands;
+};
+
+struct Lambda : public Procedure, public Collectable {
+    Lambda() : Procedure(ObjectType::LAMBDA) {
+    }
+
+    std::shared_ptr<const LambdaTemplate> code;
+    std::shared_ptr<Context> context;
+    virtual ObjectPtr ApplyTail(const ObjectPtr& args, const std::shared_ptr<Context>& context,
+                                TailCall* tail) const override;
+    virtual ObjectPtr Call(std::span<const ObjectPtr> args) const override;
+
+    virtual void Trace(const std::function<void(Collectable*)>& visit) const override;
+    virtual void Clear() override;
+    virtual long UseCount() const override;
+    virtual std::shared_ptr<const void> Retain() const override;
+
+private:
+    std::shared_ptr<Context> MakeFrame(std::span<const ObjectPtr> args) const;
 };
+DECLARE_TYPE_RANGE(Lambda, LAMBDA, LAMBDA);
@@ -0,0 +1,130 @@
+#pragma once
+
+#include "object.h"
+
+#include <memory>
+#include <span>
+
+// Special forms get their arguments unevaluated.
+#define DECLARE_FUNCTION(NAME)                                                                                  \
+    struct NAME : public Function {                                                                             \
+        virtual ObjectPtr Apply(const ObjectPtr& args, const std::shared_ptr<Context>& context) const override; \
+    }
+
+// Special forms which may leave their final expression to the caller as a tail call.
+#define DECLARE_TAIL_FUNCTION(NAME)                                                                             \
+    struct NAME : public Function {                                                                             \
+        virtual ObjectPtr Apply(const ObjectPtr& args, const std::shared_ptr<Context>& context) const override; \
+        virtual ObjectPtr ApplyTail(const ObjectPtr& args, const std::shared_ptr<Context>& context,             \
+                                    TailCall* tail) const override;                                             \
+    }
+
+// Procedures get their arguments already evaluated.
+#define DECLARE_PROCEDURE(NAME)                                                 \
+    struct NAME : public Procedure {                                            \
+        virtual ObjectPtr Call(std::span<const ObjectPtr> args) const override; \
+    }
+
+// Common function
+DECLARE_FUNCTION(QuoteOp);
+
+// Integer functions
+DECLARE_PROCEDURE(PlusOp);
+DECLARE_PROCEDURE(MinusOp);
+DECLARE_PROCEDURE(MultiplyOp);
+DECLARE_PROCEDURE(DivideOp);
+DECLARE_PROCEDURE(IntegerPredicate);
+DECLARE_PROCEDURE(EqualOp);
+DECLARE_PROCEDURE(LessOp);
+DECLARE_PROCEDURE(GreaterOp);
+DECLARE_PROCEDURE(LessEqualOp);
+DECLARE_PROCEDURE(GreaterEqualOp);
+DECLARE_PROCEDURE(MinOp);
+DECLARE_PROCEDURE(MaxOp);
+DECLARE_PROCEDURE(AbsOp);
+
+// List functions
+DECLARE_PROCEDURE(PairPredicate);
+DECLARE_PROCEDURE(NullPredicate);
+DECLARE_PROCEDURE(ListPredicate);
+DECLARE_PROCEDURE(ConsOp);
+DECLARE_PROCEDURE(CarOp);
+DECLARE_PROCEDURE(CdrOp);
+DECLARE_PROCEDURE(ListOp);
+DECLARE_PROCEDURE(ListRef);
+DECLARE_PROCEDURE(ListTail);
+DECLARE_PROCEDURE(LengthOp);
+DECLARE_PROCEDURE(AppendOp);
+DECLARE_PROCEDURE(ReverseOp);
+DECLARE_PROCEDURE(MapOp);
+DECLARE_PROCEDURE(ForEachOp);
+DECLARE_PROCEDURE(FilterOp);
+DECLARE_PROCEDURE(FoldLeftOp);
+DECLARE_PROCEDURE(FoldRightOp);
+DECLARE_PROCEDURE(MemberOp);
+DECLARE_PROCEDURE(AssocOp);
+DECLARE_PROCEDURE(SortOp);
+
+// Vector functions
+DECLARE_PROCEDURE(VectorPredicate);
+DECLARE_PROCEDURE(MakeVectorOp);
+DECLARE_PROCEDURE(VectorOp);
+DECLARE_PROCEDURE(VectorLength);
+DECLARE_PROCEDURE(VectorRef);
+DECLARE_PROCEDURE(VectorSet);
+DECLARE_PROCEDURE(VectorToList);
+DECLARE_PROCEDURE(ListToVector);
+
+// Hash table functions
+DECLARE_PROCEDURE(HashTablePredicate);
+DECLARE_PROCEDURE(MakeHashTableOp);
+DECLARE_PROCEDURE(HashTableRef);
+DECLARE_PROCEDURE(HashTableSet);
+DECLARE_PROCEDURE(HashTableDelete);
+DECLARE_PROCEDURE(HashTableContains);
+DECLARE_PROCEDURE(HashTableCount);
+DECLARE_PROCEDURE(HashTableWalk);
+DECLARE_PROCEDURE(HashTableToAlist);
+
+// Boolean functions
+DECLARE_PROCEDURE(BooleanPredicate);
+DECLARE_PROCEDURE(NotOp);
+DECLARE_TAIL_FUNCTION(AndOp);
+DECLARE_TAIL_FUNCTION(OrOp);
+
+// Variables functions
+struct DefineOp : public Function {
+    virtual ObjectPtr Apply(const ObjectPtr& args, const std::shared_ptr<Context>& context) const override;
+    //! Turns the value of a definition of `id` into what gets bound to it.
+    virtual ObjectPtr MakeBinding(ObjectPtr value, SymbolId id) const;
+};
+DECLARE_FUNCTION(SetOp);
+DECLARE_PROCEDURE(SymbolPredicate);
+DECLARE_PROCEDURE(SetCar);
+DECLARE_PROCEDURE(SetCdr);
+
+// Control flow
+DECLARE_TAIL_FUNCTION(IfOp);
+DECLARE_FUNCTION(LambdaOp);
+
+// Memoization
+DECLARE_PROCEDURE(MemoizeOp);
+// Same as `define`, but binds a memoized version of the defined function
+struct DefineMemoizedOp : public DefineOp {
+    virtual ObjectPtr MakeBinding(ObjectPtr value, SymbolId id) const override;
+};
+
+// Parallel evaluation
+// Starts computing its expression by a parallel task, returns a future of the value
+DECLARE_FUNCTION(FutureOp);
+// What compiled `future` forms call with a lambda computing the expression
+DECLARE_PROCEDURE(SpawnFutureOp);
+DECLARE_PROCEDURE(TouchOp);
+DECLARE_PROCEDURE(ParallelMapOp);
+
+// Evaluates its argument with profiling on and returns the profile
+DECLARE_FUNCTION(ProfileOp);
+
+#undef DECLARE_FUNCTION
+#undef DECLARE_TAIL_FUNCTION
+#undef DECLARE_PROCEDURE
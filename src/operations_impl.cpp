@@ -1,88 +1,53 @@
+#include "operations.h"
+
 #include "error.h"
+#include "gc.h"
+#include "memoize.h"
 #include "object.h"
+#include "parallel.h"
+#include "pool.h"
+#include "profiler.h"
+#include "resolver.h"
 
+#include <array>
+#include <functional>
 #include <memory>
+#include <span>
+#include <string>
+#include <utility>
 #include <vector>
 
-#define DECLARE_FUNCTION(NAME)                                                                    \
-    struct NAME : public Function {                                                               \
-        virtual ObjectPtr Apply(ObjectPtr args, std::shared_ptr<Context> context) const override; \
-    }
-
-// Common function
-DECLARE_FUNCTION(QuoteOp);
-
-// Integer functions
-DECLARE_FUNCTION(PlusOp);
-DECLARE_FUNCTION(MinusOp);
-DECLARE_FUNCTION(MultiplyOp);
-DECLARE_FUNCTION(DivideOp);
-DECLARE_FUNCTION(IntegerPredicate);
-DECLARE_FUNCTION(EqualOp);
-DECLARE_FUNCTION(LessOp);
-DECLARE_FUNCTION(GreaterOp);
-DECLARE_FUNCTION(LessEqualOp);
-DECLARE_FUNCTION(GreaterEqualOp);
-DECLARE_FUNCTION(MinOp);
-DECLARE_FUNCTION(MaxOp);
-DECLARE_FUNCTION(AbsOp);
-
-// List functions
-DECLARE_FUNCTION(PairPredicate);
-DECLARE_FUNCTION(NullPredicate);
-DECLARE_FUNCTION(ListPredicate);
-DECLARE_FUNCTION(ConsOp);
-DECLARE_FUNCTION(CarOp);
-DECLARE_FUNCTION(CdrOp);
-DECLARE_FUNCTION(ListOp);
-DECLARE_FUNCTION(ListRef);
-DECLARE_FUNCTION(ListTail);
-
-// Boolean functions
-DECLARE_FUNCTION(BooleanPredicate);
-DECLARE_FUNCTION(NotOp);
-DECLARE_FUNCTION(AndOp);
-DECLARE_FUNCTION(OrOp);
-
-// Variables functions
-DECLARE_FUNCTION(DefineOp);
-DECLARE_FUNCTION(SetOp);
-DECLARE_FUNCTION(SymbolPredicate);
-DECLARE_FUNCTION(SetCar);
-DECLARE_FUNCTION(SetCdr);
-
-// Control flow
-DECLARE_FUNCTION(IfOp);
-DECLARE_FUNCTION(LambdaOp);
-
-#undef DECLARE_FUNCTION
-
-struct Lambda : public Function {
-    std::vector<ObjectPtr> commands;
-    std::vector<std::string> arg_names;
-    std::shared_ptr<Context> context;
-    virtual ObjectPtr Apply(ObjectPtr args, std::shared_ptr<Context> context) const override;
-};
+namespace {
+template <class F>
+std::pair<const SymbolId, ObjectPtr> MakeKeyword(const char* name, bool is_pure = false) {
+    auto function = std::make_shared<F>();
+    function->name = Symbol::Intern(name)->GetId();
+    function->is_pure = is_pure;
+    return {*function->name, function};
+}
+}  // namespace
 
-#define REGISTER_KEYWORD(KEYWORD, FUNCTOR) {#KEYWORD, std::make_shared<FUNCTOR>()},
+#define REGISTER_KEYWORD(KEYWORD, FUNCTOR) MakeKeyword<FUNCTOR>(#KEYWORD),
+#define REGISTER_PURE_KEYWORD(KEYWORD, FUNCTOR) MakeKeyword<FUNCTOR>(#KEYWORD, true),
 
-std::shared_ptr<Context> Context::GetKeywords() {
-    static std::shared_ptr<Context> keywords = std::make_shared<Context>();
-    if (keywords->name_table_.empty()) {
+const std::shared_ptr<Context>& Context::GetKeywords() {
+    // Initialization of a static is thread-safe, interpreters may be created on several threads at once.
+    static const std::shared_ptr<Context> kKeywords = [] {
+        auto keywords = Make<Context>();
         keywords->name_table_ = {
-            REGISTER_KEYWORD(+, PlusOp)
-            REGISTER_KEYWORD(-, MinusOp)
-            REGISTER_KEYWORD(*, MultiplyOp)
-            REGISTER_KEYWORD(/, DivideOp)
-            REGISTER_KEYWORD(number?, IntegerPredicate)
-            REGISTER_KEYWORD(=, EqualOp)
-            REGISTER_KEYWORD(<, LessOp)
-            REGISTER_KEYWORD(>, GreaterOp)
-            REGISTER_KEYWORD(<=, LessEqualOp)
-            REGISTER_KEYWORD(>=, GreaterEqualOp)
-            REGISTER_KEYWORD(min, MinOp)
-            REGISTER_KEYWORD(max, MaxOp)
-            REGISTER_KEYWORD(abs, AbsOp)
+            REGISTER_PURE_KEYWORD(+, PlusOp)
+            REGISTER_PURE_KEYWORD(-, MinusOp)
+            REGISTER_PURE_KEYWORD(*, MultiplyOp)
+            REGISTER_PURE_KEYWORD(/, DivideOp)
+            REGISTER_PURE_KEYWORD(number?, IntegerPredicate)
+            REGISTER_PURE_KEYWORD(=, EqualOp)
+            REGISTER_PURE_KEYWORD(<, LessOp)
+            REGISTER_PURE_KEYWORD(>, GreaterOp)
+            REGISTER_PURE_KEYWORD(<=, LessEqualOp)
+            REGISTER_PURE_KEYWORD(>=, GreaterEqualOp)
+            REGISTER_PURE_KEYWORD(min, MinOp)
+            REGISTER_PURE_KEYWORD(max, MaxOp)
+            REGISTER_PURE_KEYWORD(abs, AbsOp)
             REGISTER_KEYWORD(pair?, PairPredicate)
             REGISTER_KEYWORD(null?, NullPredicate)
             REGISTER_KEYWORD(list?, ListPredicate)
@@ -92,55 +57,204 @@ std::shared_ptr<Context> Context::GetKeywords() {
             REGISTER_KEYWORD(list, ListOp)
             REGISTER_KEYWORD(list-ref, ListRef)
             REGISTER_KEYWORD(list-tail, ListTail)
-            REGISTER_KEYWORD(boolean?, BooleanPredicate)
-            REGISTER_KEYWORD(not, NotOp)
+            REGISTER_KEYWORD(length, LengthOp)
+            REGISTER_KEYWORD(append, AppendOp)
+            REGISTER_KEYWORD(reverse, ReverseOp)
+            REGISTER_KEYWORD(map, MapOp)
+            REGISTER_KEYWORD(for-each, ForEachOp)
+            REGISTER_KEYWORD(filter, FilterOp)
+            REGISTER_KEYWORD(fold-left, FoldLeftOp)
+            REGISTER_KEYWORD(fold-right, FoldRightOp)
+            REGISTER_KEYWORD(member, MemberOp)
+            REGISTER_KEYWORD(assoc, AssocOp)
+            REGISTER_KEYWORD(sort, SortOp)
+            REGISTER_KEYWORD(vector?, VectorPredicate)
+            REGISTER_KEYWORD(make-vector, MakeVectorOp)
+            REGISTER_KEYWORD(vector, VectorOp)
+            REGISTER_KEYWORD(vector-length, VectorLength)
+            REGISTER_KEYWORD(vector-ref, VectorRef)
+            REGISTER_KEYWORD(vector-set!, VectorSet)
+            REGISTER_KEYWORD(vector->list, VectorToList)
+            REGISTER_KEYWORD(list->vector, ListToVector)
+            REGISTER_KEYWORD(hash-table?, HashTablePredicate)
+            REGISTER_KEYWORD(make-hash-table, MakeHashTableOp)
+            REGISTER_KEYWORD(hash-table-ref, HashTableRef)
+            REGISTER_KEYWORD(hash-table-set!, HashTableSet)
+            REGISTER_KEYWORD(hash-table-delete!, HashTableDelete)
+            REGISTER_KEYWORD(hash-table-contains?, HashTableContains)
+            REGISTER_KEYWORD(hash-table-count, HashTableCount)
+            REGISTER_KEYWORD(hash-table-walk, HashTableWalk)
+            REGISTER_KEYWORD(hash-table->alist, HashTableToAlist)
+            REGISTER_PURE_KEYWORD(boolean?, BooleanPredicate)
+            REGISTER_PURE_KEYWORD(not, NotOp)
             REGISTER_KEYWORD(and, AndOp)
             REGISTER_KEYWORD(or, OrOp)
-            REGISTER_KEYWORD(quote, QuoteOp)
+            REGISTER_PURE_KEYWORD(quote, QuoteOp)
             REGISTER_KEYWORD(define, DefineOp)
             REGISTER_KEYWORD(set!, SetOp)
             REGISTER_KEYWORD(set-car!, SetCar)
             REGISTER_KEYWORD(set-cdr!, SetCdr)
-            REGISTER_KEYWORD(symbol?, SymbolPredicate)
+            REGISTER_PURE_KEYWORD(symbol?, SymbolPredicate)
             REGISTER_KEYWORD(if, IfOp)
             REGISTER_KEYWORD(lambda, LambdaOp)
+            REGISTER_KEYWORD(memoize, MemoizeOp)
+            REGISTER_KEYWORD(define-memoized, DefineMemoizedOp)
+            REGISTER_KEYWORD(future, FutureOp)
+            REGISTER_KEYWORD(touch, TouchOp)
+            REGISTER_KEYWORD(pmap, ParallelMapOp)
+            REGISTER_KEYWORD(profile, ProfileOp)
         };
-    }
-    return keywords;
+        // Builtins are shared by all interpreters and threads, which read them without locking. Assigning one only
+        // shadows it in the interpreter's own scope.
+        keywords->Freeze();
+        return keywords;
+    }();
+    return kKeywords;
 }
 
 #undef REGISTER_KEYWORD
+#undef REGISTER_PURE_KEYWORD
 
-using std::make_shared;
+bool Context::IsPureBuiltinName(SymbolId id) {
+    static const std::vector<bool> kIsPure = [] {
+        std::vector<bool> is_pure;
+        for (const auto& [name, value] : GetKeywords()->name_table_) {
+            if (name >= is_pure.size()) {
+                is_pure.resize(name + 1);
+            }
+            is_pure[name] = Borrow<Function>(value)->is_pure;
+        }
+        return is_pure;
+    }();
+    return id < kIsPure.size() && kIsPure[id];
+}
+
+bool Context::IsSpecialFormName(SymbolId id) {
+    static const std::vector<bool> kIsSpecialForm = [] {
+        std::vector<bool> is_special_form;
+        for (const auto& [name, value] : GetKeywords()->name_table_) {
+            if (name >= is_special_form.size()) {
+                is_special_form.resize(name + 1);
+            }
+            is_special_form[name] = !Is<Procedure>(value);
+        }
+        return is_special_form;
+    }();
+    return id < kIsSpecialForm.size() && kIsSpecialForm[id];
+}
 
 namespace {
-std::vector<ObjectPtr> VectorizeList(ObjectPtr list) {
+//! Returns number of elements of a proper list, throws otherwise.
+size_t ListLength(const ObjectPtr& list) {
     if (list == nullptr) {
-        return {};
+        return 0;
     }
     if (!Is<Cell>(list)) {
         throw RuntimeError("Expected list but got something else");
     }
-    std::vector<ObjectPtr> result;
-    while (true) {
-        result.emplace_back(As<Cell>(list)->GetFirst());
-        if (As<Cell>(list)->GetSecond() == nullptr) {
-            return result;
-        }
-        if (!Is<Cell>(As<Cell>(list)->GetSecond())) {
+    size_t length = 1;
+    for (auto cell = Borrow<Cell>(list); cell->GetSecond() != nullptr; cell = Borrow<Cell>(cell->GetSecond())) {
+        if (!Is<Cell>(cell->GetSecond())) {
             throw RuntimeError("Expected proper list but got improper one");
         }
-        list = As<Cell>(list)->GetSecond();
+        ++length;
+    }
+    return length;
+}
+
+//! Elements of an argument list. Calls have few arguments, so up to `kInlineSize` of them are stored inline and
+//! collecting them does not allocate.
+class Arguments {
+public:
+    static constexpr size_t kInlineSize = 8;
+
+    explicit Arguments(size_t size) : size_(size) {
+        if (size_ > kInlineSize) {
+            heap_.resize(size_);
+        }
+    }
+
+    //! Copies elements of a proper list, throws if `list` is not one.
+    explicit Arguments(const ObjectPtr& list) : Arguments(ListLength(list)) {
+        auto current = list;
+        for (size_t i = 0; i < size_; ++i) {
+            (*this)[i] = Borrow<Cell>(current)->GetFirst();
+            current = Borrow<Cell>(current)->GetSecond();
+        }
+    }
+
+    size_t size() const {
+        return size_;
+    }
+    bool empty() const {
+        return size_ == 0;
+    }
+    ObjectPtr& operator[](size_t index) {
+        return data()[index];
+    }
+    const ObjectPtr& operator[](size_t index) const {
+        return data()[index];
+    }
+    const ObjectPtr& back() const {
+        return data()[size_ - 1];
+    }
+    std::span<const ObjectPtr> Span(size_t from = 0) const {
+        return {data() + from, size_ - from};
+    }
+
+private:
+    ObjectPtr* data() {
+        return size_ > kInlineSize ? heap_.data() : inline_.data();
     }
+    const ObjectPtr* data() const {
+        return size_ > kInlineSize ? heap_.data() : inline_.data();
+    }
+
+    std::array<ObjectPtr, kInlineSize> inline_;
+    std::vector<ObjectPtr> heap_;
+    size_t size_;
+};
+
+//! Evaluates elements of argument list `args` in `context`. Arity is known before anything is evaluated.
+Arguments EvaluateArguments(const ObjectPtr& args, const std::shared_ptr<Context>& context) {
+    Arguments arguments(ListLength(args));
+    auto current = Borrow<Cell>(args);
+    for (size_t i = 0; i < arguments.size(); ++i) {
+        arguments[i] = ::Evaluate(current->GetFirst(), context);
+        current = Borrow<Cell>(current->GetSecond());
+    }
+    return arguments;
 }
 }  // namespace
 
-ObjectPtr Function::Evaluate([[maybe_unused]] std::shared_ptr<Context> context) {
+ObjectPtr Function::Evaluate([[maybe_unused]] const std::shared_ptr<Context>& context) {
     throw RuntimeError{"Trying to evaluate a function-object itself"};
 }
 
-ObjectPtr QuoteOp::Apply(ObjectPtr args, [[maybe_unused]] std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
+ObjectPtr Function::ApplyTail(const ObjectPtr& args, const std::shared_ptr<Context>& context,
+                              [[maybe_unused]] TailCall* tail) const {
+    return Apply(args, context);
+}
+
+namespace {
+//! Implements `Apply` of a function via its `ApplyTail`.
+ObjectPtr ApplyAndFinish(const Function& function, ObjectPtr args, const std::shared_ptr<Context>& context) {
+    TailCall tail;
+    auto result = function.ApplyTail(args, context, &tail);
+    if (tail.context == nullptr) {
+        return result;
+    }
+    return ::Evaluate(tail.expression, tail.context);
+}
+}  // namespace
+
+ObjectPtr Procedure::Apply(const ObjectPtr& args, const std::shared_ptr<Context>& context) const {
+    auto arguments = EvaluateArguments(args, context);
+    return Call(arguments.Span());
+}
+
+ObjectPtr QuoteOp::Apply(const ObjectPtr& args, [[maybe_unused]] const std::shared_ptr<Context>& context) const {
+    Arguments arguments(args);
     if (arguments.size() != 1) {
         throw RuntimeError("quote operator expects exactly one argument");
     }
@@ -153,497 +267,1053 @@ ObjectPtr QuoteOp::Apply(ObjectPtr args, [[maybe_unused]] std::shared_ptr<Contex
                                               " but found" + std::string(typeid(ARGUMENT).name())) \
                          : 0)
 
-ObjectPtr PlusOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    auto result = make_shared<Number>(0);
-    for (const auto& arg : arguments) {
-        auto evaluated = ::Evaluate(arg, context);
-        VALIDATE_ARGUMENT_TYPE(evaluated, Number);
-        result = make_shared<Number>(result->GetValue() + As<Number>(evaluated)->GetValue());
+namespace {
+//! Returns `object` to be changed, throws if it is frozen by forking and hence shared by several interpreters.
+template <class T>
+T* BorrowMutable(const ObjectPtr& object) {
+    auto result = Borrow<T>(object);
+    if (result->IsFrozen()) [[unlikely]] {
+        throw RuntimeError("Data of a frozen environment can not be changed");
     }
     return result;
 }
 
-ObjectPtr MinusOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.empty()) {
-        throw RuntimeError("Minus operator expects at least one argument");
+//! Continues folding `args` into `result` in arbitrary precision.
+template <class BigOp>
+ObjectPtr FoldBigIntegers(BigInt result, std::span<const ObjectPtr> args, BigOp big_op) {
+    for (const auto& arg : args) {
+        VALIDATE_ARGUMENT_TYPE(arg, Integer);
+        result = big_op(result, Borrow<Integer>(arg)->ToBigInt());
+    }
+    return MakeInteger(std::move(result));
+}
+
+//! Folds `args` into `result`. While arguments are `Number`s, `fixnum_op` computes on `int64_t` and returns true
+//! instead on overflow; from that point on the fold continues in arbitrary precision with `big_op`.
+template <class FixnumOp, class BigOp>
+ObjectPtr FoldIntegers(int64_t result, std::span<const ObjectPtr> args, FixnumOp fixnum_op, BigOp big_op) {
+    for (size_t i = 0; i < args.size(); ++i) {
+        auto number = Borrow<Number>(args[i]);
+        int64_t next;
+        if (number == nullptr || fixnum_op(result, number->GetValue(), &next)) [[unlikely]] {
+            return FoldBigIntegers(BigInt(result), args.subspan(i), big_op);
+        }
+        result = next;
+    }
+    return MakeNumber(result);
+}
+
+//! Folds the rest of `args` into the first one, which may be of either representation.
+template <class FixnumOp, class BigOp>
+ObjectPtr FoldIntegersFromFirst(std::span<const ObjectPtr> args, FixnumOp fixnum_op, BigOp big_op) {
+    VALIDATE_ARGUMENT_TYPE(args[0], Integer);
+    if (auto first = Borrow<Number>(args[0])) {
+        return FoldIntegers(first->GetValue(), args.subspan(1), fixnum_op, big_op);
+    }
+    return FoldBigIntegers(Borrow<BigInteger>(args[0])->GetValue(), args.subspan(1), big_op);
+}
+
+bool AddFixnums(int64_t lhs, int64_t rhs, int64_t* result) {
+    return __builtin_add_overflow(lhs, rhs, result);
+}
+BigInt AddBig(const BigInt& lhs, const BigInt& rhs) {
+    return lhs + rhs;
+}
+
+bool SubtractFixnums(int64_t lhs, int64_t rhs, int64_t* result) {
+    return __builtin_sub_overflow(lhs, rhs, result);
+}
+BigInt SubtractBig(const BigInt& lhs, const BigInt& rhs) {
+    return lhs - rhs;
+}
+
+bool MultiplyFixnums(int64_t lhs, int64_t rhs, int64_t* result) {
+    return __builtin_mul_overflow(lhs, rhs, result);
+}
+BigInt MultiplyBig(const BigInt& lhs, const BigInt& rhs) {
+    return lhs * rhs;
+}
+
+bool DivideFixnums(int64_t lhs, int64_t rhs, int64_t* result) {
+    if (rhs == 0) {
+        throw RuntimeError("Division by zero");
     }
-    auto first_value = ::Evaluate(arguments[0], context);
-    VALIDATE_ARGUMENT_TYPE(first_value, Number);
-    if (arguments.size() == 1) {
-        return make_shared<Number>(-As<Number>(first_value)->GetValue());
+    // The only quotient which does not fit.
+    if (lhs == INT64_MIN && rhs == -1) {
+        return true;
     }
-    auto result = make_shared<Number>(As<Number>(first_value)->GetValue());
-    arguments.erase(arguments.begin());
-    for (const auto& arg : arguments) {
-        auto evaluated = ::Evaluate(arg, context);
-        VALIDATE_ARGUMENT_TYPE(evaluated, Number);
-        result = make_shared<Number>(result->GetValue() - As<Number>(evaluated)->GetValue());
+    *result = lhs / rhs;
+    return false;
+}
+BigInt DivideBig(const BigInt& lhs, const BigInt& rhs) {
+    if (rhs.IsZero()) {
+        throw RuntimeError("Division by zero");
     }
-    return result;
+    return lhs / rhs;
 }
+}  // namespace
 
-ObjectPtr MultiplyOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    auto result = make_shared<Number>(1);
-    for (const auto& arg : arguments) {
-        auto evaluated = ::Evaluate(arg, context);
-        VALIDATE_ARGUMENT_TYPE(evaluated, Number);
-        result = make_shared<Number>(result->GetValue() * As<Number>(evaluated)->GetValue());
+ObjectPtr PlusOp::Call(std::span<const ObjectPtr> args) const {
+    return FoldIntegers(0, args, AddFixnums, AddBig);
+}
+
+ObjectPtr MinusOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.empty()) {
+        throw RuntimeError("Minus operator expects at least one argument");
     }
-    return result;
+    if (args.size() == 1) {
+        return FoldIntegers(0, args, SubtractFixnums, SubtractBig);
+    }
+    return FoldIntegersFromFirst(args, SubtractFixnums, SubtractBig);
 }
 
-ObjectPtr DivideOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.empty()) {
+ObjectPtr MultiplyOp::Call(std::span<const ObjectPtr> args) const {
+    return FoldIntegers(1, args, MultiplyFixnums, MultiplyBig);
+}
+
+ObjectPtr DivideOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.empty()) {
         throw RuntimeError("Division operator expects at least one argument");
     }
-    auto first_value = ::Evaluate(arguments[0], context);
-    VALIDATE_ARGUMENT_TYPE(first_value, Number);
-    if (arguments.size() == 1) {
-        return make_shared<Number>(1 / As<Number>(first_value)->GetValue());
+    if (args.size() == 1) {
+        return FoldIntegers(1, args, DivideFixnums, DivideBig);
     }
-    auto result = make_shared<Number>(As<Number>(first_value)->GetValue());
-    arguments.erase(arguments.begin());
-    for (const auto& arg : arguments) {
-        auto evaluated = ::Evaluate(arg, context);
-        VALIDATE_ARGUMENT_TYPE(evaluated, Number);
-        result = make_shared<Number>(result->GetValue() / As<Number>(evaluated)->GetValue());
-    }
-    return result;
+    return FoldIntegersFromFirst(args, DivideFixnums, DivideBig);
 }
 
-ObjectPtr IntegerPredicate::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.size() != 1) {
+ObjectPtr IntegerPredicate::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 1) {
         throw RuntimeError("Integer predicate expects exactly one argument");
     }
-    return make_shared<Boolean>(Is<Number>(::Evaluate(arguments[0], context)));
+    return MakeBoolean(Is<Integer>(args[0]));
 }
 
-ObjectPtr EqualOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.size() <= 1) {
-        return make_shared<Boolean>(true);
-    }
-    auto first_value = ::Evaluate(arguments[0], context);
-    VALIDATE_ARGUMENT_TYPE(first_value, Number);
-    for (const auto& arg : arguments) {
-        auto evaluated = ::Evaluate(arg, context);
-        VALIDATE_ARGUMENT_TYPE(evaluated, Number);
-        if (As<Number>(first_value)->GetValue() != As<Number>(evaluated)->GetValue()) {
-            return make_shared<Boolean>(false);
-        }
-    }
-    return make_shared<Boolean>(true);
+namespace {
+//! Compares integers of any representation, `Number`s without leaving `int64_t`.
+template <class Compare>
+bool CompareIntegers(const ObjectPtr& lhs, const ObjectPtr& rhs, Compare compare) {
+    auto lhs_number = Borrow<Number>(lhs);
+    auto rhs_number = Borrow<Number>(rhs);
+    if (lhs_number != nullptr && rhs_number != nullptr) [[likely]] {
+        return compare(lhs_number->GetValue(), rhs_number->GetValue());
+    }
+    return compare(Borrow<Integer>(lhs)->ToBigInt(), Borrow<Integer>(rhs)->ToBigInt());
 }
 
-ObjectPtr LessOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.size() <= 1) {
-        return make_shared<Boolean>(true);
-    }
-    auto previous_value = ::Evaluate(arguments[0], context);
-    VALIDATE_ARGUMENT_TYPE(previous_value, Number);
-    arguments.erase(arguments.begin());
-    for (const auto& arg : arguments) {
-        auto evaluated = ::Evaluate(arg, context);
-        VALIDATE_ARGUMENT_TYPE(evaluated, Number);
-        if (!(As<Number>(previous_value)->GetValue() < As<Number>(evaluated)->GetValue())) {
-            return make_shared<Boolean>(false);
-        }
-        previous_value = evaluated;
-    }
-    return make_shared<Boolean>(true);
-}
-ObjectPtr GreaterOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.size() <= 1) {
-        return make_shared<Boolean>(true);
-    }
-    auto previous_value = ::Evaluate(arguments[0], context);
-    VALIDATE_ARGUMENT_TYPE(previous_value, Number);
-    arguments.erase(arguments.begin());
-    for (const auto& arg : arguments) {
-        auto evaluated = ::Evaluate(arg, context);
-        VALIDATE_ARGUMENT_TYPE(evaluated, Number);
-        if (!(As<Number>(previous_value)->GetValue() > As<Number>(evaluated)->GetValue())) {
-            return make_shared<Boolean>(false);
-        }
-        previous_value = evaluated;
-    }
-    return make_shared<Boolean>(true);
-}
-ObjectPtr LessEqualOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.size() <= 1) {
-        return make_shared<Boolean>(true);
-    }
-    auto previous_value = ::Evaluate(arguments[0], context);
-    VALIDATE_ARGUMENT_TYPE(previous_value, Number);
-    arguments.erase(arguments.begin());
-    for (const auto& arg : arguments) {
-        auto evaluated = ::Evaluate(arg, context);
-        VALIDATE_ARGUMENT_TYPE(evaluated, Number);
-        if (!(As<Number>(previous_value)->GetValue() <= As<Number>(evaluated)->GetValue())) {
-            return make_shared<Boolean>(false);
+//! Checks that `compare` holds for every pair of neighbouring arguments.
+template <class Compare>
+ObjectPtr CompareChain(std::span<const ObjectPtr> args, Compare compare) {
+    if (args.size() <= 1) {
+        return MakeBoolean(true);
+    }
+    VALIDATE_ARGUMENT_TYPE(args[0], Integer);
+    for (size_t i = 1; i < args.size(); ++i) {
+        VALIDATE_ARGUMENT_TYPE(args[i], Integer);
+        if (!CompareIntegers(args[i - 1], args[i], compare)) {
+            return MakeBoolean(false);
         }
-        previous_value = evaluated;
-    }
-    return make_shared<Boolean>(true);
-}
-ObjectPtr GreaterEqualOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.size() <= 1) {
-        return make_shared<Boolean>(true);
-    }
-    auto previous_value = ::Evaluate(arguments[0], context);
-    VALIDATE_ARGUMENT_TYPE(previous_value, Number);
-    arguments.erase(arguments.begin());
-    for (const auto& arg : arguments) {
-        auto evaluated = ::Evaluate(arg, context);
-        VALIDATE_ARGUMENT_TYPE(evaluated, Number);
-        if (!(As<Number>(previous_value)->GetValue() >= As<Number>(evaluated)->GetValue())) {
-            return make_shared<Boolean>(false);
-        }
-        previous_value = evaluated;
     }
-    return make_shared<Boolean>(true);
+    return MakeBoolean(true);
 }
+}  // namespace
 
-ObjectPtr MinOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.empty()) {
+ObjectPtr EqualOp::Call(std::span<const ObjectPtr> args) const {
+    return CompareChain(args, std::equal_to<>{});
+}
+ObjectPtr LessOp::Call(std::span<const ObjectPtr> args) const {
+    return CompareChain(args, std::less<>{});
+}
+ObjectPtr GreaterOp::Call(std::span<const ObjectPtr> args) const {
+    return CompareChain(args, std::greater<>{});
+}
+ObjectPtr LessEqualOp::Call(std::span<const ObjectPtr> args) const {
+    return CompareChain(args, std::less_equal<>{});
+}
+ObjectPtr GreaterEqualOp::Call(std::span<const ObjectPtr> args) const {
+    return CompareChain(args, std::greater_equal<>{});
+}
+
+ObjectPtr MinOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.empty()) {
         throw RuntimeError("Min-operator expects at least one argument");
     }
-    auto evaluated = ::Evaluate(arguments[0], context);
-    VALIDATE_ARGUMENT_TYPE(evaluated, Number);
-    auto result = As<Number>(evaluated);
-    for (const auto& arg : arguments) {
-        evaluated = ::Evaluate(arg, context);
-        VALIDATE_ARGUMENT_TYPE(evaluated, Number);
-        result =
-            make_shared<Number>(std::min(result->GetValue(), As<Number>(evaluated)->GetValue()));
+    VALIDATE_ARGUMENT_TYPE(args[0], Integer);
+    auto result = args[0];
+    for (const auto& arg : args.subspan(1)) {
+        VALIDATE_ARGUMENT_TYPE(arg, Integer);
+        if (CompareIntegers(arg, result, std::less<>{})) {
+            result = arg;
+        }
     }
     return result;
 }
 
-ObjectPtr MaxOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.empty()) {
+ObjectPtr MaxOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.empty()) {
         throw RuntimeError("Max-operator expects at least one argument");
     }
-    auto evaluated = ::Evaluate(arguments[0], context);
-    VALIDATE_ARGUMENT_TYPE(evaluated, Number);
-    auto result = As<Number>(evaluated);
-    for (const auto& arg : arguments) {
-        evaluated = ::Evaluate(arg, context);
-        VALIDATE_ARGUMENT_TYPE(evaluated, Number);
-        result =
-            make_shared<Number>(std::max(result->GetValue(), As<Number>(evaluated)->GetValue()));
+    VALIDATE_ARGUMENT_TYPE(args[0], Integer);
+    auto result = args[0];
+    for (const auto& arg : args.subspan(1)) {
+        VALIDATE_ARGUMENT_TYPE(arg, Integer);
+        if (CompareIntegers(arg, result, std::greater<>{})) {
+            result = arg;
+        }
     }
     return result;
 }
 
-ObjectPtr AbsOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.size() != 1) {
+ObjectPtr AbsOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 1) {
         throw RuntimeError("abs-operator expects exactly one argument");
     }
-    auto evaluated = ::Evaluate(arguments[0], context);
-    VALIDATE_ARGUMENT_TYPE(evaluated, Number);
-    return make_shared<Number>(std::abs(As<Number>(evaluated)->GetValue()));
+    VALIDATE_ARGUMENT_TYPE(args[0], Integer);
+    if (auto number = Borrow<Number>(args[0]); number != nullptr && number->GetValue() != INT64_MIN) {
+        return MakeNumber(std::abs(number->GetValue()));
+    }
+    return MakeInteger(Borrow<Integer>(args[0])->ToBigInt().Abs());
 }
 
-ObjectPtr BooleanPredicate::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.size() != 1) {
+ObjectPtr BooleanPredicate::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 1) {
         throw RuntimeError("Boolean predicate expects exactly one argument");
     }
-    return make_shared<Boolean>(Is<Boolean>(::Evaluate(arguments[0], context)));
+    return MakeBoolean(Is<Boolean>(args[0]));
 }
 
-ObjectPtr NotOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.size() != 1) {
+ObjectPtr NotOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 1) {
         throw RuntimeError("Not-operator exactly one argument");
     }
-    return make_shared<Boolean>(
-        !make_shared<Boolean>(::Evaluate(arguments[0], context))->GetValue());
+    return MakeBoolean(!Boolean(args[0]).GetValue());
+}
+
+ObjectPtr AndOp::Apply(const ObjectPtr& args, const std::shared_ptr<Context>& context) const {
+    return ApplyAndFinish(*this, args, context);
 }
 
-ObjectPtr AndOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
+ObjectPtr AndOp::ApplyTail(const ObjectPtr& args, const std::shared_ptr<Context>& context, TailCall* tail) const {
+    Arguments arguments(args);
     if (arguments.empty()) {
-        return make_shared<Boolean>(true);
+        return MakeBoolean(true);
     }
-    ObjectPtr evaluated;
-    for (const auto& arg : arguments) {
-        evaluated = ::Evaluate(arg, context);
+    for (size_t i = 0; i + 1 < arguments.size(); ++i) {
+        auto evaluated = ::Evaluate(arguments[i], context);
         if (!Boolean(evaluated).GetValue()) {
             return evaluated;
         }
     }
-    return evaluated;
+    *tail = TailCall{arguments.back(), context};
+    return nullptr;
+}
+
+ObjectPtr OrOp::Apply(const ObjectPtr& args, const std::shared_ptr<Context>& context) const {
+    return ApplyAndFinish(*this, args, context);
 }
 
-ObjectPtr OrOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
+ObjectPtr OrOp::ApplyTail(const ObjectPtr& args, const std::shared_ptr<Context>& context, TailCall* tail) const {
+    Arguments arguments(args);
     if (arguments.empty()) {
-        return make_shared<Boolean>(false);
+        return MakeBoolean(false);
     }
-    ObjectPtr evaluated;
-    for (const auto& arg : arguments) {
-        evaluated = ::Evaluate(arg, context);
+    for (size_t i = 0; i + 1 < arguments.size(); ++i) {
+        auto evaluated = ::Evaluate(arguments[i], context);
         if (Boolean(evaluated).GetValue()) {
             return evaluated;
         }
     }
-    return make_shared<Boolean>(false);
+    // The only false value is #f, so the last argument gives the result either way.
+    *tail = TailCall{arguments.back(), context};
+    return nullptr;
 }
 
-ObjectPtr PairPredicate::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.size() != 1) {
+ObjectPtr PairPredicate::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 1) {
         throw RuntimeError("Pair predicate expects exactly one argument");
     }
-    return make_shared<Boolean>(Is<Cell>(::Evaluate(arguments[0], context)));
+    return MakeBoolean(Is<Cell>(args[0]));
 }
 
-ObjectPtr NullPredicate::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.size() != 1) {
+ObjectPtr NullPredicate::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 1) {
         throw RuntimeError("Null predicate expects exactly one argument");
     }
-    return make_shared<Boolean>(::Evaluate(arguments[0], context) == nullptr);
+    return MakeBoolean(args[0] == nullptr);
 }
 
-ObjectPtr ListPredicate::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.size() != 1) {
+ObjectPtr ListPredicate::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 1) {
         throw RuntimeError("List predicate expects exactly one argument");
     }
-    auto ptr = ::Evaluate(arguments[0], context);
+    auto ptr = args[0];
     while (Is<Cell>(ptr)) {
-        ptr = As<Cell>(ptr)->GetSecond();
+        ptr = Borrow<Cell>(ptr)->GetSecond();
     }
-    return make_shared<Boolean>(ptr == nullptr || ptr->Evaluate(context) == nullptr);
+    return MakeBoolean(ptr == nullptr);
 }
 
-ObjectPtr ConsOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.size() != 2) {
+ObjectPtr ConsOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 2) {
         throw RuntimeError("cons operator expects exactly 2 arguments");
     }
-    return make_shared<Cell>(::Evaluate(arguments[0], context), ::Evaluate(arguments[1], context));
+    return Make<Cell>(args[0], args[1]);
 }
 
-ObjectPtr CarOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.size() != 1) {
+ObjectPtr CarOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 1) {
         throw RuntimeError("car operator expects exactly one argument");
     }
-    auto evaluated = ::Evaluate(arguments[0], context);
-    VALIDATE_ARGUMENT_TYPE(evaluated, Cell);
-    return As<Cell>(evaluated)->GetFirst();
+    VALIDATE_ARGUMENT_TYPE(args[0], Cell);
+    return Borrow<Cell>(args[0])->GetFirst();
 }
 
-ObjectPtr CdrOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.size() != 1) {
+ObjectPtr CdrOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 1) {
         throw RuntimeError("cdr operator expects exactly one argument");
     }
-    auto evaluated = ::Evaluate(arguments[0], context);
-    VALIDATE_ARGUMENT_TYPE(evaluated, Cell);
-    return As<Cell>(evaluated)->GetSecond();
+    VALIDATE_ARGUMENT_TYPE(args[0], Cell);
+    return Borrow<Cell>(args[0])->GetSecond();
 }
 
-ObjectPtr ListOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    if (args == nullptr) {
-        return nullptr;
+ObjectPtr ListOp::Call(std::span<const ObjectPtr> args) const {
+    ObjectPtr result = nullptr;
+    for (auto it = args.rbegin(); it != args.rend(); ++it) {
+        result = Make<Cell>(*it, result);
     }
-    VALIDATE_ARGUMENT_TYPE(args, Cell);
-    return make_shared<Cell>(As<Cell>(args)->GetFirst(),
-                             Apply(As<Cell>(args)->GetSecond(), context));
+    return result;
 }
 
-ObjectPtr ListRef::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.size() != 2) {
+ObjectPtr ListRef::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 2) {
         throw RuntimeError("list-ref expects exactly 2 arguments");
     }
-    auto eval_list = ::Evaluate(arguments[0], context);
-    auto eval_ind = ::Evaluate(arguments[1], context);
-    VALIDATE_ARGUMENT_TYPE(eval_ind, Number);
-    auto list = VectorizeList(eval_list);
-    if (As<Number>(eval_ind)->GetValue() < 0 ||
-        static_cast<size_t>(As<Number>(eval_ind)->GetValue()) >= list.size()) {
+    VALIDATE_ARGUMENT_TYPE(args[1], Number);
+    auto index = Borrow<Number>(args[1])->GetValue();
+    if (index < 0 || static_cast<size_t>(index) >= ListLength(args[0])) {
         throw RuntimeError("list-ref index out of bounds");
     }
-    return list[As<Number>(eval_ind)->GetValue()];
+    auto current = Borrow<Cell>(args[0]);
+    for (int64_t i = 0; i < index; ++i) {
+        current = Borrow<Cell>(current->GetSecond());
+    }
+    return current->GetFirst();
 }
 
-ObjectPtr ListTail::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.size() != 2) {
+ObjectPtr ListTail::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 2) {
         throw RuntimeError("list-tail expects exactly 2 arguments");
     }
-    auto eval_list = ::Evaluate(arguments[0], context);
-    auto eval_ind = ::Evaluate(arguments[1], context);
-    VALIDATE_ARGUMENT_TYPE(eval_ind, Number);
-    auto list = VectorizeList(eval_list);
-    if (As<Number>(eval_ind)->GetValue() < 0 ||
-        static_cast<size_t>(As<Number>(eval_ind)->GetValue()) > list.size()) {
+    VALIDATE_ARGUMENT_TYPE(args[1], Number);
+    auto index = Borrow<Number>(args[1])->GetValue();
+    if (index < 0 || static_cast<size_t>(index) > ListLength(args[0])) {
         throw RuntimeError("list-tail index out of bounds");
     }
-    auto result = eval_list;
-    for (int i = 0; i < As<Number>(eval_ind)->GetValue(); ++i) {
-        result = As<Cell>(result)->GetSecond();
+    const ObjectPtr* result = &args[0];
+    for (int64_t i = 0; i < index; ++i) {
+        result = &Borrow<Cell>(*result)->GetSecond();
+    }
+    return *result;
+}
+
+namespace {
+//! Builds a list front to back by appending to its last cell.
+class ListBuilder {
+public:
+    void Append(ObjectPtr value) {
+        AppendCell(Make<Cell>(std::move(value), nullptr));
+    }
+    //! Appends a cell which already holds its element, the rest of its list is replaced later.
+    void AppendCell(ObjectPtr cell) {
+        auto next = Borrow<Cell>(cell);
+        if (last_ == nullptr) {
+            head_ = std::move(cell);
+        } else {
+            last_->SetSecond(std::move(cell));
+        }
+        last_ = next;
+    }
+    //! Returns the list ending with `tail`.
+    ObjectPtr Finish(ObjectPtr tail = nullptr) {
+        if (last_ == nullptr) {
+            return tail;
+        }
+        last_->SetSecond(std::move(tail));
+        last_ = nullptr;
+        return std::move(head_);
+    }
+
+private:
+    ObjectPtr head_ = nullptr;
+    Cell* last_ = nullptr;
+};
+
+//! Returns `function` as a procedure to call from native code, throws if it is not one.
+const Procedure& ExpectProcedure(const ObjectPtr& function, const std::string& operation) {
+    auto procedure = Borrow<Procedure>(function);
+    if (procedure == nullptr) {
+        throw RuntimeError(operation + " expects a procedure");
+    }
+    return *procedure;
+}
+
+//! Calls a procedure on behalf of a builtin. It is reported to the profiler like a call made by user code.
+ObjectPtr CallProcedure(const Procedure& procedure, std::span<const ObjectPtr> args) {
+    ProfilerScope profiler_scope;
+    if (auto profiler = profiler_scope.GetProfiler()) [[unlikely]] {
+        profiler->Enter(procedure);
+    }
+    return procedure.Call(args);
+}
+
+//! Calls `procedure` on elements of `lists` with equal positions, until the shortest of them is over. `lists` are
+//! held by their own references, so the procedure may change them without invalidating the walk.
+template <class Consumer>
+void ForEachElements(const Procedure& procedure, std::span<const ObjectPtr> lists, Consumer consume) {
+    for (const auto& list : lists) {
+        ListLength(list);
+    }
+    if (lists.size() == 1) {
+        for (auto current = lists[0]; Is<Cell>(current);) {
+            auto cell = Borrow<Cell>(current);
+            consume(CallProcedure(procedure, {&cell->GetFirst(), 1}));
+            current = cell->GetSecond();
+        }
+        return;
+    }
+    Arguments cursors(lists.size());
+    Arguments elements(lists.size());
+    for (size_t i = 0; i < lists.size(); ++i) {
+        cursors[i] = lists[i];
+    }
+    while (true) {
+        for (size_t i = 0; i < cursors.size(); ++i) {
+            if (!Is<Cell>(cursors[i])) {
+                return;
+            }
+            elements[i] = Borrow<Cell>(cursors[i])->GetFirst();
+            cursors[i] = Borrow<Cell>(cursors[i])->GetSecond();
+        }
+        consume(CallProcedure(procedure, elements.Span()));
+    }
+}
+}  // namespace
+
+ObjectPtr LengthOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 1) {
+        throw RuntimeError("length expects exactly one argument");
+    }
+    return MakeNumber(static_cast<int64_t>(ListLength(args[0])));
+}
+
+ObjectPtr AppendOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.empty()) {
+        return nullptr;
+    }
+    // All lists but the last one are copied, the last one becomes the shared tail of the result.
+    ListBuilder result;
+    for (const auto& list : args.first(args.size() - 1)) {
+        ListLength(list);
+        for (auto cell = Borrow<Cell>(list); cell != nullptr; cell = Borrow<Cell>(cell->GetSecond())) {
+            result.Append(cell->GetFirst());
+        }
+    }
+    return result.Finish(args.back());
+}
+
+ObjectPtr ReverseOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 1) {
+        throw RuntimeError("reverse expects exactly one argument");
+    }
+    ListLength(args[0]);
+    ObjectPtr result = nullptr;
+    for (auto cell = Borrow<Cell>(args[0]); cell != nullptr; cell = Borrow<Cell>(cell->GetSecond())) {
+        result = Make<Cell>(cell->GetFirst(), std::move(result));
     }
     return result;
 }
 
-ObjectPtr DefineOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
+ObjectPtr MapOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() < 2) {
+        throw RuntimeError("map expects a procedure and at least one list");
+    }
+    ListBuilder result;
+    ForEachElements(ExpectProcedure(args[0], "map"), args.subspan(1),
+                    [&result](ObjectPtr value) { result.Append(std::move(value)); });
+    return result.Finish();
+}
+
+ObjectPtr ForEachOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() < 2) {
+        throw RuntimeError("for-each expects a procedure and at least one list");
+    }
+    ForEachElements(ExpectProcedure(args[0], "for-each"), args.subspan(1), [](const ObjectPtr&) {});
+    return nullptr;
+}
+
+ObjectPtr FilterOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 2) {
+        throw RuntimeError("filter expects exactly 2 arguments");
+    }
+    const auto& predicate = ExpectProcedure(args[0], "filter");
+    ListLength(args[1]);
+    ListBuilder result;
+    for (auto current = args[1]; Is<Cell>(current);) {
+        auto cell = Borrow<Cell>(current);
+        if (Boolean(CallProcedure(predicate, {&cell->GetFirst(), 1})).GetValue()) {
+            result.Append(cell->GetFirst());
+        }
+        current = cell->GetSecond();
+    }
+    return result.Finish();
+}
+
+ObjectPtr FoldLeftOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 3) {
+        throw RuntimeError("fold-left expects exactly 3 arguments");
+    }
+    const auto& procedure = ExpectProcedure(args[0], "fold-left");
+    ListLength(args[2]);
+    std::array<ObjectPtr, 2> call_args = {args[1], nullptr};
+    for (auto current = args[2]; Is<Cell>(current);) {
+        auto cell = Borrow<Cell>(current);
+        call_args[1] = cell->GetFirst();
+        call_args[0] = CallProcedure(procedure, call_args);
+        current = cell->GetSecond();
+    }
+    return std::move(call_args[0]);
+}
+
+ObjectPtr FoldRightOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 3) {
+        throw RuntimeError("fold-right expects exactly 3 arguments");
+    }
+    const auto& procedure = ExpectProcedure(args[0], "fold-right");
+    // Elements are consumed from the end, so they are collected first instead of recursing on the list.
+    std::vector<ObjectPtr> elements;
+    elements.reserve(ListLength(args[2]));
+    for (auto cell = Borrow<Cell>(args[2]); cell != nullptr; cell = Borrow<Cell>(cell->GetSecond())) {
+        elements.push_back(cell->GetFirst());
+    }
+    std::array<ObjectPtr, 2> call_args = {nullptr, args[1]};
+    for (auto it = elements.rbegin(); it != elements.rend(); ++it) {
+        call_args[0] = std::move(*it);
+        call_args[1] = CallProcedure(procedure, call_args);
+    }
+    return std::move(call_args[1]);
+}
+
+ObjectPtr MemberOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 2) {
+        throw RuntimeError("member expects exactly 2 arguments");
+    }
+    ListLength(args[1]);
+    for (auto current = &args[1]; *current != nullptr; current = &Borrow<Cell>(*current)->GetSecond()) {
+        if (Equal(args[0], Borrow<Cell>(*current)->GetFirst())) {
+            return *current;
+        }
+    }
+    return MakeBoolean(false);
+}
+
+ObjectPtr AssocOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 2) {
+        throw RuntimeError("assoc expects exactly 2 arguments");
+    }
+    ListLength(args[1]);
+    for (auto cell = Borrow<Cell>(args[1]); cell != nullptr; cell = Borrow<Cell>(cell->GetSecond())) {
+        auto entry = Borrow<Cell>(cell->GetFirst());
+        if (entry == nullptr) {
+            throw RuntimeError("assoc expects a list of pairs");
+        }
+        if (Equal(args[0], entry->GetFirst())) {
+            return cell->GetFirst();
+        }
+    }
+    return MakeBoolean(false);
+}
+
+namespace {
+//! Merges two sorted lists by relinking their cells. Elements of `left` go first among equal ones.
+ObjectPtr MergeSorted(ObjectPtr left, ObjectPtr right, const Procedure& less) {
+    ListBuilder result;
+    while (left != nullptr && right != nullptr) {
+        std::array<ObjectPtr, 2> call_args = {Borrow<Cell>(right)->GetFirst(), Borrow<Cell>(left)->GetFirst()};
+        auto& source = Boolean(CallProcedure(less, call_args)).GetValue() ? right : left;
+        auto cell = std::move(source);
+        source = Borrow<Cell>(cell)->GetSecond();
+        result.AppendCell(std::move(cell));
+    }
+    return result.Finish(left != nullptr ? std::move(left) : std::move(right));
+}
+}  // namespace
+
+ObjectPtr SortOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 2) {
+        throw RuntimeError("sort expects exactly 2 arguments");
+    }
+    const auto& less = ExpectProcedure(args[1], "sort");
+    ListLength(args[0]);
+    // Bottom-up merge sort of a copy of the list: `runs[i]` is empty or a sorted run of 2^i cells, older runs hold
+    // earlier elements. Only `less` decides the order, so an inconsistent predicate gives some permutation, never an
+    // invalid access.
+    std::array<ObjectPtr, 64> runs;
+    for (auto cell = Borrow<Cell>(args[0]); cell != nullptr; cell = Borrow<Cell>(cell->GetSecond())) {
+        ObjectPtr run = Make<Cell>(cell->GetFirst(), nullptr);
+        size_t i = 0;
+        for (; runs[i] != nullptr; ++i) {
+            run = MergeSorted(std::move(runs[i]), std::move(run), less);
+            runs[i] = nullptr;
+        }
+        runs[i] = std::move(run);
+    }
+    ObjectPtr result = nullptr;
+    for (auto& run : runs) {
+        if (run != nullptr) {
+            result = MergeSorted(std::move(run), std::move(result), less);
+        }
+    }
+    return result;
+}
+
+ObjectPtr VectorPredicate::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 1) {
+        throw RuntimeError("Vector predicate expects exactly one argument");
+    }
+    return MakeBoolean(Is<Vector>(args[0]));
+}
+
+ObjectPtr MakeVectorOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 1 && args.size() != 2) {
+        throw RuntimeError("make-vector expects 1 or 2 arguments");
+    }
+    VALIDATE_ARGUMENT_TYPE(args[0], Number);
+    auto size = Borrow<Number>(args[0])->GetValue();
+    if (size < 0) {
+        throw RuntimeError("make-vector expects non-negative size");
+    }
+    // Unspecified fill is the empty list, which is what the interpreter uses for unspecified values.
+    return Make<Vector>(std::vector<ObjectPtr>(size, args.size() == 2 ? args[1] : nullptr));
+}
+
+ObjectPtr VectorOp::Call(std::span<const ObjectPtr> args) const {
+    return Make<Vector>(std::vector<ObjectPtr>(args.begin(), args.end()));
+}
+
+ObjectPtr VectorLength::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 1) {
+        throw RuntimeError("vector-length expects exactly one argument");
+    }
+    VALIDATE_ARGUMENT_TYPE(args[0], Vector);
+    return MakeNumber(static_cast<int64_t>(Borrow<Vector>(args[0])->GetSize()));
+}
+
+namespace {
+//! Returns `index` as a position in `vector`, throws if it is not one.
+size_t VectorIndex(const Vector& vector, const ObjectPtr& index, const std::string& operation) {
+    VALIDATE_ARGUMENT_TYPE(index, Number);
+    auto value = Borrow<Number>(index)->GetValue();
+    if (value < 0 || static_cast<size_t>(value) >= vector.GetSize()) {
+        throw RuntimeError(operation + " index out of bounds");
+    }
+    return value;
+}
+}  // namespace
+
+ObjectPtr VectorRef::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 2) {
+        throw RuntimeError("vector-ref expects exactly 2 arguments");
+    }
+    VALIDATE_ARGUMENT_TYPE(args[0], Vector);
+    const auto& vector = *Borrow<Vector>(args[0]);
+    return vector.Get(VectorIndex(vector, args[1], "vector-ref"));
+}
+
+ObjectPtr VectorSet::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 3) {
+        throw RuntimeError("vector-set! expects exactly 3 arguments");
+    }
+    VALIDATE_ARGUMENT_TYPE(args[0], Vector);
+    auto& vector = *BorrowMutable<Vector>(args[0]);
+    vector.Set(VectorIndex(vector, args[1], "vector-set!"), args[2]);
+    return nullptr;
+}
+
+ObjectPtr VectorToList::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 1) {
+        throw RuntimeError("vector->list expects exactly one argument");
+    }
+    VALIDATE_ARGUMENT_TYPE(args[0], Vector);
+    const auto& elements = Borrow<Vector>(args[0])->GetElements();
+    ObjectPtr result = nullptr;
+    for (auto it = elements.rbegin(); it != elements.rend(); ++it) {
+        result = Make<Cell>(*it, std::move(result));
+    }
+    return result;
+}
+
+ObjectPtr ListToVector::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 1) {
+        throw RuntimeError("list->vector expects exactly one argument");
+    }
+    std::vector<ObjectPtr> elements;
+    elements.reserve(ListLength(args[0]));
+    for (auto cell = Borrow<Cell>(args[0]); cell != nullptr; cell = Borrow<Cell>(cell->GetSecond())) {
+        elements.push_back(cell->GetFirst());
+    }
+    return Make<Vector>(std::move(elements));
+}
+
+ObjectPtr HashTablePredicate::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 1) {
+        throw RuntimeError("hash-table? expects exactly one argument");
+    }
+    return MakeBoolean(Is<HashTable>(args[0]));
+}
+
+ObjectPtr MakeHashTableOp::Call(std::span<const ObjectPtr> args) const {
+    if (!args.empty()) {
+        throw RuntimeError("make-hash-table expects no arguments");
+    }
+    return Make<HashTable>();
+}
+
+ObjectPtr HashTableRef::Call(std::span<const ObjectPtr> args) const {
+    // The optional third argument is returned for missing keys.
+    if (args.size() != 2 && args.size() != 3) {
+        throw RuntimeError("hash-table-ref expects 2 or 3 arguments");
+    }
+    VALIDATE_ARGUMENT_TYPE(args[0], HashTable);
+    if (auto value = Borrow<HashTable>(args[0])->Find(args[1])) {
+        return *value;
+    }
+    if (args.size() == 3) {
+        return args[2];
+    }
+    throw RuntimeError("hash-table-ref: key is not found");
+}
+
+ObjectPtr HashTableSet::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 3) {
+        throw RuntimeError("hash-table-set! expects exactly 3 arguments");
+    }
+    VALIDATE_ARGUMENT_TYPE(args[0], HashTable);
+    BorrowMutable<HashTable>(args[0])->Set(args[1], args[2]);
+    return nullptr;
+}
+
+ObjectPtr HashTableDelete::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 2) {
+        throw RuntimeError("hash-table-delete! expects exactly 2 arguments");
+    }
+    VALIDATE_ARGUMENT_TYPE(args[0], HashTable);
+    BorrowMutable<HashTable>(args[0])->Remove(args[1]);
+    return nullptr;
+}
+
+ObjectPtr HashTableContains::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 2) {
+        throw RuntimeError("hash-table-contains? expects exactly 2 arguments");
+    }
+    VALIDATE_ARGUMENT_TYPE(args[0], HashTable);
+    return MakeBoolean(Borrow<HashTable>(args[0])->Find(args[1]) != nullptr);
+}
+
+ObjectPtr HashTableCount::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 1) {
+        throw RuntimeError("hash-table-count expects exactly one argument");
+    }
+    VALIDATE_ARGUMENT_TYPE(args[0], HashTable);
+    return MakeNumber(Borrow<HashTable>(args[0])->GetCount());
+}
+
+ObjectPtr HashTableWalk::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 2) {
+        throw RuntimeError("hash-table-walk expects exactly 2 arguments");
+    }
+    VALIDATE_ARGUMENT_TYPE(args[0], HashTable);
+    const auto& procedure = ExpectProcedure(args[1], "hash-table-walk");
+    // Entries are taken beforehand, so the procedure may change the table.
+    for (const auto& [key, value] : Borrow<HashTable>(args[0])->GetEntries()) {
+        std::array<ObjectPtr, 2> entry = {key, value};
+        CallProcedure(procedure, entry);
+    }
+    return nullptr;
+}
+
+ObjectPtr HashTableToAlist::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 1) {
+        throw RuntimeError("hash-table->alist expects exactly one argument");
+    }
+    VALIDATE_ARGUMENT_TYPE(args[0], HashTable);
+    ListBuilder result;
+    for (const auto& [key, value] : Borrow<HashTable>(args[0])->GetEntries()) {
+        result.Append(Make<Cell>(key, value));
+    }
+    return result.Finish();
+}
+
+ObjectPtr DefineOp::Apply(const ObjectPtr& args, const std::shared_ptr<Context>& context) const {
+    Arguments arguments(args);
     if (arguments.empty()) {
         throw SyntaxError("Empty define");
     }
     auto eval_name = arguments[0];
-    if (!Is<Symbol>(eval_name)) {
-        if (!Is<Cell>(eval_name)) {
-            throw SyntaxError("");
-        }
+    if (Is<Cell>(eval_name)) {
         // It is lambda definition
-        auto name_args = VectorizeList(eval_name);
-        auto real_name_obj = name_args[0];
+        auto real_name_obj = Borrow<Cell>(eval_name)->GetFirst();
         VALIDATE_ARGUMENT_TYPE(real_name_obj, Symbol);
-        auto real_name = As<Symbol>(real_name_obj)->GetName();
-        name_args.erase(name_args.begin());
-        std::vector<ObjectPtr> arg_name_list = std::move(name_args);
-        auto lambda_scope = make_shared<Context>(context);
-
-        std::vector<std::string> arg_names;
-        for (auto& arg_name : arg_name_list) {
-            VALIDATE_ARGUMENT_TYPE(arg_name, Symbol);
-            arg_names.emplace_back(As<Symbol>(arg_name)->GetName());
-        }
-        arguments.erase(arguments.begin());
-        std::vector<ObjectPtr> commands = std::move(arguments);
-        auto result = std::make_shared<Lambda>();
-        result->commands = commands;
-        result->arg_names = arg_names;
-        result->context = lambda_scope;
-        context->Define(real_name, result);
-        return make_shared<Symbol>(real_name);
+        auto id = Borrow<Symbol>(real_name_obj)->GetId();
+        auto result = Make<Lambda>();
+        result->code = ResolveLambda(Borrow<Cell>(eval_name)->GetSecond(), arguments.Span(1), context);
+        result->context = context;
+        context->Define(id, MakeBinding(result, id));
+        return real_name_obj;
+    }
+    if (!Is<Symbol>(eval_name) && !Is<LocalRef>(eval_name)) {
+        throw SyntaxError("");
     }
     if (arguments.size() != 2) {
         throw SyntaxError("define expects exactly 2 arguments");
     }
     auto eval_val = ::Evaluate(arguments[1], context);
 
-    context->Define(As<Symbol>(eval_name)->GetName(), eval_val);
-    return make_shared<Symbol>(As<Symbol>(eval_name)->GetName());
+    if (auto ref = Borrow<LocalRef>(eval_name)) {
+        ref->Define(context.get(), MakeBinding(eval_val, ref->GetId()));
+        return Symbol::Intern(ref->GetId());
+    }
+    auto id = Borrow<Symbol>(eval_name)->GetId();
+    context->Define(id, MakeBinding(eval_val, id));
+    return eval_name;
+}
+
+ObjectPtr DefineOp::MakeBinding(ObjectPtr value, [[maybe_unused]] SymbolId id) const {
+    return value;
 }
 
-ObjectPtr SetOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
+ObjectPtr SetOp::Apply(const ObjectPtr& args, const std::shared_ptr<Context>& context) const {
+    Arguments arguments(args);
     if (arguments.size() != 2) {
         throw SyntaxError("set! expects exactly 2 arguments");
     }
     auto eval_name = arguments[0];
     auto eval_val = ::Evaluate(arguments[1], context);
+    if (Is<LocalRef>(eval_name)) {
+        auto ret = eval_name->Evaluate(context);
+        Borrow<LocalRef>(eval_name)->Assign(context.get(), eval_val);
+        return ret;
+    }
     VALIDATE_ARGUMENT_TYPE(eval_name, Symbol);
 
-    auto ret = context->Get(As<Symbol>(eval_name)->GetName());
-    context->Set(As<Symbol>(eval_name)->GetName(), eval_val);
+    auto ret = context->Get(Borrow<Symbol>(eval_name)->GetId());
+    context->Set(Borrow<Symbol>(eval_name)->GetId(), eval_val);
     return ret;
 }
 
-ObjectPtr SetCar::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.size() != 2) {
+ObjectPtr SetCar::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 2) {
         throw SyntaxError("set-car! expects exactly 2 arguments");
     }
-    auto eval_name = ::Evaluate(arguments[0], context);
-    auto eval_val = ::Evaluate(arguments[1], context);
+    VALIDATE_ARGUMENT_TYPE(args[0], Cell);
 
-    VALIDATE_ARGUMENT_TYPE(eval_name, Cell);
-
-    As<Cell>(eval_name)->SetFirst(eval_val);
+    BorrowMutable<Cell>(args[0])->SetFirst(args[1]);
     return nullptr;
 }
-ObjectPtr SetCdr::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.size() != 2) {
+ObjectPtr SetCdr::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 2) {
         throw SyntaxError("set-car! expects exactly 2 arguments");
     }
-    auto eval_name = ::Evaluate(arguments[0], context);
-    auto eval_val = ::Evaluate(arguments[1], context);
+    VALIDATE_ARGUMENT_TYPE(args[0], Cell);
 
-    VALIDATE_ARGUMENT_TYPE(eval_name, Cell);
-
-    As<Cell>(eval_name)->SetSecond(eval_val);
+    BorrowMutable<Cell>(args[0])->SetSecond(args[1]);
     return nullptr;
 }
 
-ObjectPtr SymbolPredicate::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.size() != 1) {
+ObjectPtr SymbolPredicate::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 1) {
         throw RuntimeError("Symbol predicate expects exactly one argument");
     }
-    return make_shared<Boolean>(Is<Symbol>(::Evaluate(arguments[0], context)));
+    return MakeBoolean(Is<Symbol>(args[0]));
 }
 
-ObjectPtr IfOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto arguments = VectorizeList(args);
+ObjectPtr IfOp::Apply(const ObjectPtr& args, const std::shared_ptr<Context>& context) const {
+    return ApplyAndFinish(*this, args, context);
+}
+
+ObjectPtr IfOp::ApplyTail(const ObjectPtr& args, const std::shared_ptr<Context>& context, TailCall* tail) const {
+    Arguments arguments(args);
     if (arguments.size() != 2 && arguments.size() != 3) {
         throw SyntaxError("Incorrect if statement");
     }
     auto eval_condition = ::Evaluate(arguments[0], context);
-    if (make_shared<Boolean>(eval_condition)->GetValue()) {
-        return ::Evaluate(arguments[1], context);
+    if (Boolean(eval_condition).GetValue()) {
+        *tail = TailCall{arguments[1], context};
+        return nullptr;
     }
     if (arguments.size() == 2) {
         return nullptr;
     }
-    return ::Evaluate(arguments[2], context);
+    *tail = TailCall{arguments[2], context};
+    return nullptr;
 }
 
-ObjectPtr LambdaOp::Apply(ObjectPtr args, std::shared_ptr<Context> context) const {
-    auto lambda_scope = make_shared<Context>(context);
-    auto argumets = VectorizeList(args);
-    if (argumets.size() < 2) {
+ObjectPtr LambdaOp::Apply(const ObjectPtr& args, const std::shared_ptr<Context>& context) const {
+    Arguments arguments(args);
+    if (arguments.size() < 2) {
         throw SyntaxError("Invalid lambda expression");
     }
-    auto arg_name_list = VectorizeList(argumets[0]);
-    std::vector<std::string> arg_names;
-    for (auto& arg_name : arg_name_list) {
-        VALIDATE_ARGUMENT_TYPE(arg_name, Symbol);
-        arg_names.emplace_back(As<Symbol>(arg_name)->GetName());
-    }
-    argumets.erase(argumets.begin());
-    std::vector<ObjectPtr> commands = std::move(argumets);
-    auto result = std::make_shared<Lambda>();
-    result->commands = commands;
-    result->arg_names = arg_names;
-    result->context = lambda_scope;
+    auto result = Make<Lambda>();
+    result->code = ResolveLambda(arguments[0], arguments.Span(1), context);
+    result->context = context;
     return result;
 }
 
-ObjectPtr Lambda::Apply(ObjectPtr args, std::shared_ptr<Context> contextp) const {
-    auto arguments = VectorizeList(args);
-    if (arguments.size() != arg_names.size()) {
+ObjectPtr MemoizeOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.empty() || args.size() > 2) {
+        throw RuntimeError("memoize expects a procedure and an optional capacity");
+    }
+    ExpectProcedure(args[0], "memoize");
+    auto capacity = Memoized::kDefaultCapacity;
+    if (args.size() == 2) {
+        auto number = Borrow<Number>(args[1]);
+        if (number == nullptr || number->GetValue() <= 0) {
+            throw RuntimeError("memoize expects a positive capacity");
+        }
+        capacity = number->GetValue();
+    }
+    return Make<Memoized>(args[0], capacity);
+}
+
+ObjectPtr DefineMemoizedOp::MakeBinding(ObjectPtr value, SymbolId id) const {
+    // Named before wrapping, so that the memoized function takes the name over.
+    NameFunction(value, id);
+    return MemoizeOp().Call({&value, 1});
+}
+
+ObjectPtr FutureOp::Apply(const ObjectPtr& args, const std::shared_ptr<Context>& context) const {
+    Arguments arguments(args);
+    if (arguments.size() != 1) {
+        throw SyntaxError("future expects exactly one expression");
+    }
+    // Inside lambdas the resolver has turned the expression into a lambda of its own already.
+    ObjectPtr thunk;
+    if (Is<LambdaExpr>(arguments[0])) {
+        thunk = arguments[0]->Evaluate(context);
+    } else {
+        auto lambda = Make<Lambda>();
+        lambda->code = ResolveLambda(nullptr, arguments.Span(), context);
+        lambda->context = context;
+        thunk = std::move(lambda);
+    }
+    return Make<Future>(std::move(thunk));
+}
+
+ObjectPtr SpawnFutureOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 1) {
+        throw RuntimeError("future expects exactly one expression");
+    }
+    ExpectProcedure(args[0], "future");
+    return Make<Future>(args[0]);
+}
+
+ObjectPtr TouchOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 1) {
+        throw RuntimeError("touch expects exactly one argument");
+    }
+    auto future = Borrow<Future>(args[0]);
+    if (future == nullptr) {
+        throw RuntimeError("touch expects a future");
+    }
+    return future->Touch();
+}
+
+ObjectPtr ParallelMapOp::Call(std::span<const ObjectPtr> args) const {
+    if (args.size() != 2) {
+        throw RuntimeError("pmap expects a procedure and a list");
+    }
+    const auto& function = ExpectProcedure(args[0], "pmap");
+    std::vector<ObjectPtr> elements;
+    elements.reserve(ListLength(args[1]));
+    for (auto cell = Borrow<Cell>(args[1]); cell != nullptr; cell = Borrow<Cell>(cell->GetSecond())) {
+        elements.push_back(cell->GetFirst());
+    }
+    ListBuilder result;
+    for (auto& value : ParallelMap(function, elements)) {
+        result.Append(std::move(value));
+    }
+    return result.Finish();
+}
+
+ObjectPtr ProfileOp::Apply(const ObjectPtr& args, const std::shared_ptr<Context>& context) const {
+    Arguments arguments(args);
+    if (arguments.size() != 1) {
+        throw SyntaxError("profile expects exactly one argument");
+    }
+    Profiler profiler;
+    {
+        Profiler::Activation activation(&profiler);
+        ::Evaluate(arguments[0], context);
+    }
+    // Report is a list of `(name calls inclusive-ns exclusive-ns allocations)`, the most expensive entries first.
+    auto entries = profiler.GetEntries();
+    ObjectPtr result = nullptr;
+    for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+        ObjectPtr entry = nullptr;
+        for (auto value : {it->allocations, it->exclusive_ns, it->inclusive_ns, it->calls}) {
+            entry = Make<Cell>(MakeNumber(static_cast<int64_t>(value)), entry);
+        }
+        result = Make<Cell>(Make<Cell>(Symbol::Intern(it->name), entry), result);
+    }
+    return result;
+}
+
+std::shared_ptr<Context> Lambda::MakeFrame(std::span<const ObjectPtr> args) const {
+    if (args.size() != code->arg_count) {
         throw RuntimeError("Argument count is incorrect for lambda");
     }
-    std::shared_ptr<Context> cur_context = std::make_shared<Context>(context);
-    for (size_t i = 0; i < arguments.size(); ++i) {
-        cur_context->Define(arg_names[i], ::Evaluate(arguments[i], contextp));
+    CollectGarbageIfNeeded();
+    auto frame = Make<Context>(context, code);
+    for (size_t i = 0; i < args.size(); ++i) {
+        frame->GetSlot(i) = args[i];
+    }
+    return frame;
+}
+
+ObjectPtr Lambda::ApplyTail(const ObjectPtr& args, const std::shared_ptr<Context>& contextp, TailCall* tail) const {
+    auto arguments = EvaluateArguments(args, contextp);
+    auto frame = MakeFrame(arguments.Span());
+    if (code->commands.empty()) {
+        return nullptr;
+    }
+    for (size_t i = 0; i + 1 < code->commands.size(); ++i) {
+        ::Evaluate(code->commands[i], frame);
     }
+    *tail = TailCall{code->commands.back(), std::move(frame)};
+    return nullptr;
+}
+
+ObjectPtr Lambda::Call(std::span<const ObjectPtr> args) const {
+    auto frame = MakeFrame(args);
     ObjectPtr last_result;
-    for (auto& cmd : commands) {
-        last_result = ::Evaluate(cmd, cur_context);
+    for (auto& cmd : code->commands) {
+        last_result = ::Evaluate(cmd, frame);
     }
     return last_result;
 }
+
+void Lambda::Trace(const std::function<void(Collectable*)>& visit) const {
+    if (context != nullptr) {
+        visit(context.get());
+    }
+}
+
+void Lambda::Clear() {
+    context = nullptr;
+}
+
+long Lambda::UseCount() const {
+    return weak_from_this().use_count();
+}
+
+std::shared_ptr<const void> Lambda::Retain() const {
+    return weak_from_this().lock();
+}
@@ -0,0 +1,257 @@
+#include "parallel.h"
+
+#include "concurrency.h"
+#include "error.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+//! Index of the worker running on this thread, any value past the last worker for other threads.
+thread_local size_t worker_index = SIZE_MAX;
+
+//! Calls of `pmap` are split into this many chunks per thread, so that chunks of different cost even out.
+constexpr size_t kChunksPerThread = 4;
+}  // namespace
+
+Task::Task(std::function<ObjectPtr()> work) : work_(std::move(work)) {
+    if (auto scope = Context::GetCurrentScope()) {
+        scope_ = scope->shared_from_this();
+    }
+}
+
+bool Task::TryRun() {
+    int expected = QUEUED;
+    if (!state_.compare_exchange_strong(expected, RUNNING, std::memory_order_acq_rel)) {
+        return false;
+    }
+    auto previous_owner = concurrency::current_owner;
+    concurrency::current_owner = concurrency::NewOwner();
+    {
+        Context::ScopeActivation activation(scope_.get());
+        RegistryActivation registry_activation(registry_);
+        try {
+            result_ = work_();
+        } catch (...) {
+            error_ = std::current_exception();
+        }
+    }
+    work_ = nullptr;
+    scope_ = nullptr;
+    concurrency::current_owner = previous_owner;
+    state_.store(DONE, std::memory_order_release);
+    state_.notify_all();
+    return true;
+}
+
+void Task::Wait() {
+    if (TryRun()) {
+        return;
+    }
+    auto& pool = TaskPool::Get();
+    while (!IsDone()) {
+        if (!pool.RunPending()) {
+            state_.wait(RUNNING, std::memory_order_acquire);
+        }
+    }
+}
+
+bool Task::IsDone() const {
+    return state_.load(std::memory_order_acquire) == DONE;
+}
+
+const ObjectPtr& Task::GetResult() const {
+    if (error_ != nullptr) {
+        std::rethrow_exception(error_);
+    }
+    return result_;
+}
+
+const ObjectPtr& Task::PeekResult() const {
+    return result_;
+}
+
+CollectableRegistry* Task::GetRegistry() const {
+    return registry_;
+}
+
+TaskPool& TaskPool::Get() {
+    static TaskPool pool(std::max(std::thread::hardware_concurrency(), 2u) - 1);
+    return pool;
+}
+
+TaskPool::TaskPool(size_t worker_count) {
+    for (size_t i = 0; i < worker_count; ++i) {
+        queues_.push_back(std::make_unique<Queue>());
+    }
+    for (size_t i = 0; i < worker_count; ++i) {
+        workers_.emplace_back([this, i] { Work(i); });
+    }
+}
+
+TaskPool::~TaskPool() {
+    {
+        std::lock_guard lock(sleep_mutex_);
+        is_stopped_.store(true);
+    }
+    wake_.notify_all();
+    // Tasks which were not started are dropped, ones being run are waited for.
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+void TaskPool::Submit(std::shared_ptr<Task> task) {
+    // The task counts as active from now until a worker drops it from its queue, even if it was run elsewhere before:
+    // the queue holds a reference to it, and thus possibly to its result.
+    concurrency::active_tasks.fetch_add(1, std::memory_order_relaxed);
+    BeginTask(task->GetRegistry());
+    auto index = worker_index < queues_.size() ? worker_index
+                                               : next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+    {
+        std::lock_guard lock(queues_[index]->mutex);
+        queues_[index]->tasks.push_back(std::move(task));
+    }
+    queued_.fetch_add(1, std::memory_order_release);
+    {
+        std::lock_guard lock(sleep_mutex_);
+    }
+    wake_.notify_one();
+}
+
+bool TaskPool::RunPending() {
+    auto task = Take(worker_index);
+    if (task == nullptr) {
+        return false;
+    }
+    auto registry = task->GetRegistry();
+    task->TryRun();
+    task = nullptr;
+    EndTask(registry);
+    concurrency::active_tasks.fetch_sub(1, std::memory_order_release);
+    return true;
+}
+
+size_t TaskPool::GetWorkerCount() const {
+    return workers_.size();
+}
+
+void TaskPool::Work(size_t index) {
+    worker_index = index;
+    while (!is_stopped_.load()) {
+        if (RunPending()) {
+            continue;
+        }
+        std::unique_lock lock(sleep_mutex_);
+        wake_.wait(lock, [this] { return is_stopped_.load() || queued_.load(std::memory_order_acquire) != 0; });
+    }
+}
+
+std::shared_ptr<Task> TaskPool::Take(size_t own_queue) {
+    if (queued_.load(std::memory_order_acquire) == 0) {
+        return nullptr;
+    }
+    auto take = [this](Queue* queue, bool is_own) -> std::shared_ptr<Task> {
+        std::lock_guard lock(queue->mutex);
+        if (queue->tasks.empty()) {
+            return nullptr;
+        }
+        std::shared_ptr<Task> task;
+        if (is_own) {
+            task = std::move(queue->tasks.back());
+            queue->tasks.pop_back();
+        } else {
+            task = std::move(queue->tasks.front());
+            queue->tasks.pop_front();
+        }
+        queued_.fetch_sub(1, std::memory_order_relaxed);
+        return task;
+    };
+    if (own_queue < queues_.size()) {
+        if (auto task = take(queues_[own_queue].get(), true)) {
+            return task;
+        }
+    }
+    for (size_t i = 1; i <= queues_.size(); ++i) {
+        if (auto task = take(queues_[(own_queue + i) % queues_.size()].get(), false)) {
+            return task;
+        }
+    }
+    return nullptr;
+}
+
+Future::Future(ObjectPtr thunk)
+    : Object(ObjectType::FUTURE),
+      task_(std::make_shared<Task>([thunk = std::move(thunk)] { return Borrow<Procedure>(thunk)->Call({}); })) {
+    TaskPool::Get().Submit(task_);
+}
+
+ObjectPtr Future::Touch() const {
+    task_->Wait();
+    return task_->GetResult();
+}
+
+ObjectPtr Future::Evaluate([[maybe_unused]] const std::shared_ptr<Context>& context) {
+    return shared_from_this();
+}
+
+std::string Future::Serialize() {
+    return "#<future>";
+}
+
+void Future::Trace(const std::function<void(Collectable*)>& visit) const {
+    // Collection happens only while no tasks run, so the computation is finished and the thunk is released already.
+    if (task_ != nullptr) {
+        TraceObject(task_->PeekResult(), visit);
+    }
+}
+
+void Future::Clear() {
+    task_ = nullptr;
+}
+
+long Future::UseCount() const {
+    return weak_from_this().use_count();
+}
+
+std::shared_ptr<const void> Future::Retain() const {
+    return weak_from_this().lock();
+}
+
+std::vector<ObjectPtr> ParallelMap(const Procedure& function, const std::vector<ObjectPtr>& args) {
+    std::vector<ObjectPtr> results(args.size());
+    auto& pool = TaskPool::Get();
+    auto chunk_count = std::min(args.size(), (pool.GetWorkerCount() + 1) * kChunksPerThread);
+    if (chunk_count <= 1) {
+        for (size_t i = 0; i < args.size(); ++i) {
+            results[i] = function.Call({&args[i], 1});
+        }
+        return results;
+    }
+    std::vector<std::shared_ptr<Task>> tasks;
+    for (size_t chunk = 0; chunk < chunk_count; ++chunk) {
+        auto begin = args.size() * chunk / chunk_count;
+        auto end = args.size() * (chunk + 1) / chunk_count;
+        tasks.push_back(std::make_shared<Task>([&function, &args, &results, begin, end]() -> ObjectPtr {
+            for (auto i = begin; i < end; ++i) {
+                results[i] = function.Call({&args[i], 1});
+            }
+            return nullptr;
+        }));
+        pool.Submit(tasks.back());
+    }
+    // Tasks refer to locals of this function, so all of them have to finish even if some fail.
+    for (const auto& task : tasks) {
+        task->Wait();
+    }
+    for (const auto& task : tasks) {
+        task->GetResult();
+    }
+    return results;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "gc.h"
+#include "object.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//! Computation which runs once, either on a worker of `TaskPool` or on a thread which needs its result before any
+//! worker took it. While it runs, it owns contexts it creates (see `concurrency`). The scope and the collectable
+//! registry which were current when it was created are current again meanwhile.
+class Task {
+public:
+    explicit Task(std::function<ObjectPtr()> work);
+
+    //! Runs the computation on the current thread unless it was taken already. Returns whether it did.
+    bool TryRun();
+    //! Returns once the computation finished. It is run here if nobody took it yet; otherwise this thread runs other
+    //! queued tasks meanwhile, so waiting inside a task does not take a worker away from the pool.
+    void Wait();
+    bool IsDone() const;
+    //! Result of a finished computation, rethrows what it threw.
+    const ObjectPtr& GetResult() const;
+    //! Result stored so far, which is empty unless the computation finished without an error.
+    const ObjectPtr& PeekResult() const;
+    //! Registry of collectables the computation creates.
+    CollectableRegistry* GetRegistry() const;
+
+private:
+    enum State : int { QUEUED, RUNNING, DONE };
+
+    std::atomic<int> state_ = QUEUED;
+    std::function<ObjectPtr()> work_;
+    std::shared_ptr<Context> scope_;
+    CollectableRegistry* registry_ = GetThreadRegistry();
+    ObjectPtr result_;
+    std::exception_ptr error_;
+};
+
+//! Work-stealing pool shared by all interpreters. Each worker keeps a deque of tasks: it takes the most recently
+//! submitted ones from its own deque, and when that is empty steals the oldest ones from the others. Threads which are
+//! not workers put tasks to the deques in turn.
+class TaskPool {
+public:
+    //! Workers are started on first use: one less than there are cores, as the submitting thread takes part too.
+    static TaskPool& Get();
+    ~TaskPool();
+
+    void Submit(std::shared_ptr<Task> task);
+    //! Runs one queued task on the current thread. Returns false if there was none.
+    bool RunPending();
+    size_t GetWorkerCount() const;
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<std::shared_ptr<Task>> tasks;
+    };
+
+    explicit TaskPool(size_t worker_count);
+    void Work(size_t index);
+    std::shared_ptr<Task> Take(size_t first_queue);
+
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> queued_ = 0;
+    std::atomic<size_t> next_queue_ = 0;
+    std::mutex sleep_mutex_;
+    std::condition_variable wake_;
+    std::atomic<bool> is_stopped_ = false;
+};
+
+//! Value of an expression which is computed by a task of the shared pool, see `(future expr)`. Futures evaluate to
+//! themselves.
+class Future : public Object, public Collectable {
+public:
+    //! Starts computing the result of calling `thunk` without arguments.
+    explicit Future(ObjectPtr thunk);
+
+    //! Returns the value once it is computed, rethrows what the computation threw.
+    ObjectPtr Touch() const;
+
+    virtual ObjectPtr Evaluate(const std::shared_ptr<Context>& context) override;
+    virtual std::string Serialize() override;
+
+    virtual void Trace(const std::function<void(Collectable*)>& visit) const override;
+    virtual void Clear() override;
+    virtual long UseCount() const override;
+    virtual std::shared_ptr<const void> Retain() const override;
+
+private:
+    std::shared_ptr<Task> task_;
+};
+DECLARE_TYPE_RANGE(Future, FUTURE, FUTURE);
+
+//! Calls `function` on each of `args` with as many parallel tasks as are worth it, and returns results in order.
+//! Rethrows the first error after all calls finished.
+std::vector<ObjectPtr> ParallelMap(const Procedure& function, const std::vector<ObjectPtr>& args);
@@ -1,49 +1,34 @@
 #include "parser.h"
 #include <memory>
 #include <variant>
+#include <vector>
 
 #include "error.h"
 #include "object.h"
+#include "pool.h"
 #include "tokenizer.h"
 
-using std::make_shared;
+namespace {
+//! Expression which is being read and waits for a nested datum.
+struct PendingExpression {
+    enum class Kind {
+        LIST,         // next element of a list
+        DOTTED_TAIL,  // the part after the dot
+        QUOTE,        // quoted datum
+        VECTOR,       // next element of a vector
+    };
 
-//! We assume that opening bracket was read before we come here.
-static std::shared_ptr<Object> ReadList(Tokenizer* tokenizer) {
-    // tokenizer->Next();
-    if (tokenizer->IsEnd()) {
-        throw SyntaxError("List misses closing bracket");
-    }
-    if (tokenizer->GetToken() == Token{BracketToken::CLOSE}) {
-        tokenizer->Next();
-        return nullptr;
-    }
-    if (tokenizer->GetToken() == Token{DotToken{}}) {
-        throw SyntaxError("Ill-formed dotted list");
-    }
-    auto result = make_shared<Cell>();
-    result->SetFirst(Read(tokenizer));
-    // tokenizer->Next();
-    if (tokenizer->IsEnd()) {
-        throw SyntaxError("List misses closing bracket");
-    }
-    if (tokenizer->GetToken() == Token{DotToken{}}) {
-        tokenizer->Next();
-        result->SetSecond(Read(tokenizer));
-        if (tokenizer->IsEnd()) {
-            throw SyntaxError("List misses closing bracket");
-        }
-        if (tokenizer->GetToken() != Token{BracketToken::CLOSE}) {
-            throw SyntaxError("Ill-formed dotted list");
-        }
-        tokenizer->Next();
-        return result;
-    }
-    result->SetSecond(ReadList(tokenizer));
-    return result;
-}
+    Kind kind;
+    ObjectPtr head = nullptr;
+    //! Last cell of the list, new elements are appended to it.
+    Cell* last = nullptr;
+    //! Elements of the vector read so far.
+    std::vector<ObjectPtr> elements = {};
+};
 
-std::shared_ptr<Object> Read(Tokenizer* tokenizer) {
+//! Reads the start of a datum. Returns true if it is complete and stored to `value`, or false if it is a list or a
+//! quote which waits for nested data and was pushed to `stack`.
+bool ReadDatumStart(Tokenizer* tokenizer, std::vector<PendingExpression>* stack, ObjectPtr* value) {
     if (tokenizer->IsEnd()) {
         throw SyntaxError{"Reached end while reading"};
     }
@@ -53,24 +38,127 @@ std::shared_ptr<Object> Read(Tokenizer* tokenizer) {
         throw SyntaxError{"Invalid closing bracket"};
     }
     if (token == Token{BracketToken::OPEN}) {
-        return ReadList(tokenizer);
+        if (tokenizer->IsEnd()) {
+            throw SyntaxError("List misses closing bracket");
+        }
+        if (tokenizer->GetToken() == Token{BracketToken::CLOSE}) {
+            tokenizer->Next();
+            *value = nullptr;
+            return true;
+        }
+        if (tokenizer->GetToken() == Token{DotToken{}}) {
+            throw SyntaxError("Ill-formed dotted list");
+        }
+        stack->push_back(PendingExpression{PendingExpression::Kind::LIST});
+        return false;
+    }
+    if (token == Token{BracketToken::OPEN_VECTOR}) {
+        if (tokenizer->IsEnd()) {
+            throw SyntaxError("Vector misses closing bracket");
+        }
+        if (tokenizer->GetToken() == Token{BracketToken::CLOSE}) {
+            tokenizer->Next();
+            *value = Make<Vector>();
+            return true;
+        }
+        stack->push_back(PendingExpression{PendingExpression::Kind::VECTOR});
+        return false;
     }
     if (std::holds_alternative<ConstantToken>(token)) {
-        return make_shared<Number>(std::get<ConstantToken>(token).value);
+        *value = MakeNumber(std::get<ConstantToken>(token).value);
+        return true;
+    }
+    if (std::holds_alternative<BigConstantToken>(token)) {
+        *value = MakeInteger(BigInt::FromString(std::get<BigConstantToken>(token).digits));
+        return true;
     }
     if (std::holds_alternative<SymbolToken>(token)) {
         if (std::get<SymbolToken>(token).name == "#t") {
-            return make_shared<Boolean>(true);
-        }
-        if (std::get<SymbolToken>(token).name == "#f") {
-            return make_shared<Boolean>(false);
+            *value = MakeBoolean(true);
+        } else if (std::get<SymbolToken>(token).name == "#f") {
+            *value = MakeBoolean(false);
+        } else {
+            *value = Symbol::Intern(std::get<SymbolToken>(token).name);
         }
-        return make_shared<Symbol>(std::get<SymbolToken>(token).name);
+        return true;
     }
     if (std::holds_alternative<QuoteToken>(token)) {
-        // tokenizer->Next();
-        return make_shared<Cell>(make_shared<Symbol>("quote"),
-                                 make_shared<Cell>(Read(tokenizer), nullptr));
+        stack->push_back(PendingExpression{PendingExpression::Kind::QUOTE});
+        return false;
     }
     throw SyntaxError{"Invalid token"};
 }
+}  // namespace
+
+//! Lists and quotes which are being read are kept on an explicit stack, and lists are built by appending to their last
+//! cell, so neither length nor nesting of the input uses C++ stack.
+std::shared_ptr<Object> Read(Tokenizer* tokenizer) {
+    std::vector<PendingExpression> stack;
+    ObjectPtr value;
+    while (true) {
+        if (!ReadDatumStart(tokenizer, &stack, &value)) {
+            continue;
+        }
+        // Hands the complete datum to the expressions waiting for it, until one of them needs more.
+        while (true) {
+            if (stack.empty()) {
+                return value;
+            }
+            auto& pending = stack.back();
+            if (pending.kind == PendingExpression::Kind::QUOTE) {
+                value = Make<Cell>(Symbol::Intern("quote"), Make<Cell>(std::move(value), nullptr));
+                stack.pop_back();
+                continue;
+            }
+            if (pending.kind == PendingExpression::Kind::DOTTED_TAIL) {
+                pending.last->SetSecond(std::move(value));
+                if (tokenizer->IsEnd()) {
+                    throw SyntaxError("List misses closing bracket");
+                }
+                if (tokenizer->GetToken() != Token{BracketToken::CLOSE}) {
+                    throw SyntaxError("Ill-formed dotted list");
+                }
+                tokenizer->Next();
+                value = std::move(pending.head);
+                stack.pop_back();
+                continue;
+            }
+            if (pending.kind == PendingExpression::Kind::VECTOR) {
+                pending.elements.push_back(std::move(value));
+                if (tokenizer->IsEnd()) {
+                    throw SyntaxError("Vector misses closing bracket");
+                }
+                if (tokenizer->GetToken() == Token{BracketToken::CLOSE}) {
+                    tokenizer->Next();
+                    value = Make<Vector>(std::move(pending.elements));
+                    stack.pop_back();
+                    continue;
+                }
+                break;
+            }
+            auto cell = Make<Cell>(std::move(value), nullptr);
+            auto last = cell.get();
+            if (pending.head == nullptr) {
+                pending.head = std::move(cell);
+            } else {
+                pending.last->SetSecond(std::move(cell));
+            }
+            pending.last = last;
+            if (tokenizer->IsEnd()) {
+                throw SyntaxError("List misses closing bracket");
+            }
+            if (tokenizer->GetToken() == Token{DotToken{}}) {
+                tokenizer->Next();
+                pending.kind = PendingExpression::Kind::DOTTED_TAIL;
+                break;
+            }
+            if (tokenizer->GetToken() == Token{BracketToken::CLOSE}) {
+                tokenizer->Next();
+                value = std::move(pending.head);
+                stack.pop_back();
+                continue;
+            }
+            break;
+        }
+    }
+}
@@ -0,0 +1,50 @@
+#include "pool.h"
+
+#include <array>
+#include <mutex>
+#include <utility>
+
+namespace {
+template <size_t... Classes>
+constexpr auto MakeAllocators(std::index_sequence<Classes...>) {
+    return std::array<void* (*)(), sizeof...(Classes)>{&pool::FixedPool<(Classes + 1) * pool::kAlignment>::Allocate...};
+}
+
+template <size_t... Classes>
+constexpr auto MakeDeallocators(std::index_sequence<Classes...>) {
+    return std::array<void (*)(void*), sizeof...(Classes)>{
+        &pool::FixedPool<(Classes + 1) * pool::kAlignment>::Deallocate...};
+}
+
+constexpr auto kClasses = std::make_index_sequence<pool::kMaxPooledSize / pool::kAlignment>();
+constexpr auto kAllocators = MakeAllocators(kClasses);
+constexpr auto kDeallocators = MakeDeallocators(kClasses);
+}  // namespace
+
+void* pool::AllocateChunk() {
+    return ::operator new(kChunkSize, std::align_val_t{kAlignment});
+}
+
+void* pool::AllocateBytes(size_t size) {
+    return kAllocators[RoundUp(size) / kAlignment - 1]();
+}
+
+void pool::DeallocateBytes(void* ptr, size_t size) {
+    kDeallocators[RoundUp(size) / kAlignment - 1](ptr);
+}
+
+void pool::Depot::Put(void* head, size_t count) {
+    std::lock_guard lock(mutex_);
+    batches_.emplace_back(head, count);
+}
+
+void* pool::Depot::Take(size_t* count) {
+    std::lock_guard lock(mutex_);
+    if (batches_.empty()) {
+        return nullptr;
+    }
+    auto [head, size] = batches_.back();
+    batches_.pop_back();
+    *count = size;
+    return head;
+}
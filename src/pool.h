@@ -0,0 +1,209 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <utility>
+#include <vector>
+
+//! Interpreter objects are small and short-lived, so they are carved from fixed-size blocks of large chunks instead of
+//! going to the global allocator one by one. Freed blocks go to a free list of their size class and are reused by the
+//! next allocation; chunks themselves are kept for the lifetime of the process, and blocks of a finished thread are
+//! reused by others.
+namespace pool {
+
+constexpr size_t kAlignment = alignof(std::max_align_t);
+constexpr size_t kChunkSize = 64 * 1024;
+//! Larger objects are not worth pooling and go to the global allocator.
+constexpr size_t kMaxPooledSize = 256;
+
+//! Allocates a fresh chunk of memory which is never released.
+void* AllocateChunk();
+
+//! Batches of free blocks of a single size, shared by all threads.
+class Depot {
+public:
+    //! Takes over a list of `count` blocks linked through their first word.
+    void Put(void* head, size_t count);
+    //! Returns a list put before and stores its length to `count`, or nullptr if there is none.
+    void* Take(size_t* count);
+
+private:
+    std::mutex mutex_;
+    std::vector<std::pair<void*, size_t>> batches_;
+};
+
+//! Free list of blocks of `BlockSize` bytes. Each thread has its own one, so no locking is needed. A block freed on
+//! another thread than it was allocated on migrates to that thread's list; when a list grows too long, a batch of its
+//! blocks goes to the depot, where an empty list of another thread takes it before carving a new chunk. The whole list
+//! goes there when its thread exits, and so does every block freed on the thread after that.
+template <size_t BlockSize>
+class FixedPool {
+public:
+    static_assert(BlockSize % kAlignment == 0 && BlockSize <= kChunkSize);
+
+    static void* Allocate() {
+        auto& pool = Get();
+        if (pool.free_ == nullptr) {
+            pool.Refill();
+        }
+        auto block = pool.free_;
+        pool.free_ = block->next;
+        --pool.free_count_;
+        return block;
+    }
+
+    static void Deallocate(void* ptr) {
+        auto& pool = Get();
+        auto block = static_cast<FreeBlock*>(ptr);
+        if (pool.is_exited_) [[unlikely]] {
+            block->next = nullptr;
+            GetDepot().Put(block, 1);
+            return;
+        }
+        block->next = pool.free_;
+        pool.free_ = block;
+        if (++pool.free_count_ > 2 * kBatchSize) [[unlikely]] {
+            pool.Release();
+        }
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    static constexpr size_t kBatchSize = kChunkSize / BlockSize / 4;
+
+    static FixedPool& Get() {
+        static thread_local FixedPool pool;
+        return pool;
+    }
+
+    static Depot& GetDepot() {
+        // Never destroyed, since destructors of other statics may still free blocks.
+        static Depot* depot = new Depot();
+        return *depot;
+    }
+
+    //! Gives the free list of an exiting thread to the depot. The pool itself is never destroyed, since objects
+    //! destroyed later on the thread, such as ones owned by other thread-local variables, still use it; but nothing
+    //! would give its list away any more, so from then on their blocks go to the depot directly.
+    struct ThreadExit {
+        ~ThreadExit() {
+            auto& pool = Get();
+            if (pool.free_ != nullptr) {
+                GetDepot().Put(pool.free_, pool.free_count_);
+            }
+            pool.free_ = nullptr;
+            pool.free_count_ = 0;
+            pool.is_exited_ = true;
+        }
+    };
+
+    void Refill() {
+        [[maybe_unused]] static thread_local ThreadExit thread_exit;
+        free_ = static_cast<FreeBlock*>(GetDepot().Take(&free_count_));
+        if (free_ == nullptr) {
+            auto chunk = static_cast<char*>(AllocateChunk());
+            for (size_t offset = 0; offset + BlockSize <= kChunkSize; offset += BlockSize) {
+                auto block = reinterpret_cast<FreeBlock*>(chunk + offset);
+                block->next = free_;
+                free_ = block;
+                ++free_count_;
+            }
+        }
+        if (is_exited_ && free_count_ > 1) [[unlikely]] {
+            // Only the block being allocated is kept, see `ThreadExit`.
+            GetDepot().Put(free_->next, free_count_ - 1);
+            free_->next = nullptr;
+            free_count_ = 1;
+        }
+    }
+
+    //! Gives the most recently freed blocks to the depot, keeping the rest.
+    void Release() {
+        auto head = free_;
+        auto last = free_;
+        for (size_t i = 1; i < kBatchSize; ++i) {
+            last = last->next;
+        }
+        free_ = last->next;
+        last->next = nullptr;
+        free_count_ -= kBatchSize;
+        GetDepot().Put(head, kBatchSize);
+    }
+
+    FreeBlock* free_ = nullptr;
+    size_t free_count_ = 0;
+    //! Whether `ThreadExit` has run on the thread.
+    bool is_exited_ = false;
+};
+
+constexpr size_t RoundUp(size_t size) {
+    return (size + kAlignment - 1) / kAlignment * kAlignment;
+}
+
+//! Same as `FixedPool<RoundUp(size)>` for a size known only at runtime, which must not exceed `kMaxPooledSize`.
+void* AllocateBytes(size_t size);
+void DeallocateBytes(void* ptr, size_t size);
+
+//! Standard allocator on top of the pools. `std::allocate_shared` rebinds it to its control block type, so an object
+//! and its reference counts share a single pooled block.
+template <class T>
+struct Allocator {
+    using value_type = T;
+
+    Allocator() = default;
+    template <class U>
+    Allocator(const Allocator<U>&) {
+    }
+
+    static constexpr bool kPooled = RoundUp(sizeof(T)) <= kMaxPooledSize && alignof(T) <= kAlignment;
+
+    // Small arrays, such as frame slots, are pooled too.
+    T* allocate(size_t n) {
+        if constexpr (kPooled) {
+            if (n == 1) {
+                return static_cast<T*>(FixedPool<RoundUp(sizeof(T))>::Allocate());
+            }
+            if (n * sizeof(T) <= kMaxPooledSize) {
+                return static_cast<T*>(AllocateBytes(n * sizeof(T)));
+            }
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, size_t n) {
+        if constexpr (kPooled) {
+            if (n == 1) {
+                FixedPool<RoundUp(sizeof(T))>::Deallocate(ptr);
+                return;
+            }
+            if (n * sizeof(T) <= kMaxPooledSize) {
+                DeallocateBytes(ptr, n * sizeof(T));
+                return;
+            }
+        }
+        ::operator delete(ptr);
+    }
+
+    template <class U>
+    bool operator==(const Allocator<U>&) const {
+        return true;
+    }
+};
+
+//! Number of objects created with `Make` on this thread, which the profiler reports.
+inline thread_local uint64_t allocated_objects = 0;
+
+}  // namespace pool
+
+//! Pooled counterpart of `std::make_shared`, used for objects that interpreter creates in bulk.
+template <class T, class... Args>
+std::shared_ptr<T> Make(Args&&... args) {
+    ++pool::allocated_objects;
+    return std::allocate_shared<T>(pool::Allocator<T>{}, std::forward<Args>(args)...);
+}
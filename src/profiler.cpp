@@ -0,0 +1,81 @@
+#include "profiler.h"
+
+#include "pool.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace {
+uint64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+SymbolId AnonymousName() {
+    static const SymbolId kAnonymous = Symbol::Intern("<anonymous>")->GetId();
+    return kAnonymous;
+}
+}  // namespace
+
+thread_local Profiler* Profiler::active = nullptr;
+
+Profiler::Activation::Activation(Profiler* profiler) : previous_(active) {
+    active = profiler;
+}
+
+Profiler::Activation::~Activation() {
+    active = previous_;
+}
+
+void Profiler::Enter(const Function& function) {
+    auto name = function.name.value_or(AnonymousName());
+    if (name >= counters_.size()) {
+        counters_.resize(name + 1);
+    }
+    auto& counters = counters_[name];
+    ++counters.calls;
+    ++counters.active_calls;
+    stack_.push_back(Call{name, NowNs(), 0, pool::allocated_objects});
+}
+
+void Profiler::Exit() {
+    auto call = stack_.back();
+    stack_.pop_back();
+    auto elapsed = NowNs() - call.start_ns;
+    auto& counters = counters_[call.name];
+    counters.exclusive_ns += elapsed - std::min(elapsed, call.callees_ns);
+    if (--counters.active_calls == 0) {
+        counters.inclusive_ns += elapsed;
+        counters.allocations += pool::allocated_objects - call.start_allocations;
+    }
+    if (!stack_.empty()) {
+        stack_.back().callees_ns += elapsed;
+    }
+}
+
+void Profiler::Unwind(size_t depth) {
+    while (stack_.size() > depth) {
+        Exit();
+    }
+}
+
+std::vector<ProfileEntry> Profiler::GetEntries() const {
+    std::vector<ProfileEntry> entries;
+    for (SymbolId name = 0; name < counters_.size(); ++name) {
+        const auto& counters = counters_[name];
+        if (counters.calls != 0) {
+            entries.push_back(ProfileEntry{Symbol::GetName(name), counters.calls, counters.inclusive_ns,
+                                           counters.exclusive_ns, counters.allocations});
+        }
+    }
+    std::stable_sort(entries.begin(), entries.end(), [](const ProfileEntry& lhs, const ProfileEntry& rhs) {
+        return lhs.exclusive_ns > rhs.exclusive_ns;
+    });
+    return entries;
+}
+
+void Profiler::Reset() {
+    counters_.clear();
+    stack_.clear();
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "object.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//! Statistics of all calls of functions with the same name.
+struct ProfileEntry {
+    std::string name;
+    uint64_t calls = 0;
+    //! Time from entering to leaving the function, not counted twice for recursive calls.
+    uint64_t inclusive_ns = 0;
+    //! Inclusive time minus the time spent in profiled callees.
+    uint64_t exclusive_ns = 0;
+    //! Objects created by the function and its callees, counted like inclusive time.
+    uint64_t allocations = 0;
+};
+
+//! Records calls of builtins and user functions, keyed by the name they were registered or defined under. Evaluator
+//! and VM report calls only to the active profiler of their thread, so when there is none the cost is a single check.
+class Profiler {
+public:
+    //! Profiler which records calls made on this thread, or nullptr if profiling is off.
+    static Profiler* Active() {
+        return active;
+    }
+
+    //! Makes a profiler active for its lifetime, restoring the previous one afterwards.
+    class Activation {
+    public:
+        explicit Activation(Profiler* profiler);
+        ~Activation();
+
+        Activation(const Activation&) = delete;
+        Activation& operator=(const Activation&) = delete;
+
+    private:
+        Profiler* previous_;
+    };
+
+    void Enter(const Function& function);
+    void Exit();
+    //! Number of calls being executed now.
+    size_t GetDepth() const {
+        return stack_.size();
+    }
+    //! Leaves calls until only `depth` of them are left, e.g. when they were replaced by a tail call or thrown out of.
+    void Unwind(size_t depth);
+
+    //! Returns statistics of all called functions, the most expensive by exclusive time first.
+    std::vector<ProfileEntry> GetEntries() const;
+    void Reset();
+
+private:
+    struct Counters {
+        uint64_t calls = 0;
+        uint64_t inclusive_ns = 0;
+        uint64_t exclusive_ns = 0;
+        uint64_t allocations = 0;
+        //! Number of unfinished calls, only the outermost one adds to inclusive counters.
+        uint32_t active_calls = 0;
+    };
+
+    struct Call {
+        SymbolId name;
+        uint64_t start_ns;
+        uint64_t callees_ns;
+        uint64_t start_allocations;
+    };
+
+    static thread_local Profiler* active;
+
+    //! Indexed by function name, `SymbolId`s are dense.
+    std::vector<Counters> counters_;
+    std::vector<Call> stack_;
+};
+
+//! Leaves calls entered during its lifetime when it is destroyed, if there is an active profiler.
+class ProfilerScope {
+public:
+    ProfilerScope() : profiler_(Profiler::Active()), depth_(profiler_ ? profiler_->GetDepth() : 0) {
+    }
+    ~ProfilerScope() {
+        if (profiler_ != nullptr) {
+            profiler_->Unwind(depth_);
+        }
+    }
+
+    ProfilerScope(const ProfilerScope&) = delete;
+    ProfilerScope& operator=(const ProfilerScope&) = delete;
+
+    Profiler* GetProfiler() const {
+        return profiler_;
+    }
+    size_t GetDepth() const {
+        return depth_;
+    }
+
+private:
+    Profiler* profiler_;
+    size_t depth_;
+};
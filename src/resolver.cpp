@@ -0,0 +1,458 @@
+#include "resolver.h"
+
+#include "error.h"
+#include "object.h"
+#include "operations.h"
+#include "pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+LocalRef::LocalRef(size_t depth, size_t slot, SymbolId id)
+    : Object(ObjectType::LOCAL_REF), depth_(depth), slot_(slot), id_(id) {
+}
+
+SymbolId LocalRef::GetId() const {
+    return id_;
+}
+
+size_t LocalRef::GetDepth() const {
+    return depth_;
+}
+
+size_t LocalRef::GetSlot() const {
+    return slot_;
+}
+
+Context* LocalRef::GetFrame(Context* context) const {
+    for (size_t i = 0; i < depth_; ++i) {
+        context = context->GetUpper();
+    }
+    return context;
+}
+
+void LocalRef::Define(Context* context, ObjectPtr value) const {
+    NoteBinding(id_);
+    NameFunction(value, id_);
+    auto frame = GetFrame(context);
+    frame->Exchange(frame->GetSlot(slot_), std::move(value));
+}
+
+void LocalRef::Assign(Context* context, ObjectPtr value) const {
+    NoteBinding(id_);
+    auto frame = GetFrame(context);
+    auto& binding = frame->GetSlot(slot_);
+    if (frame->Load(binding) != UnboundMarker()) {
+        frame->Exchange(binding, std::move(value));
+        return;
+    }
+    // Inner definition was not executed yet, so the name still means an outer binding.
+    if (frame->GetUpper() == nullptr) {
+        throw NameError("Unable to find symbol " + Symbol::GetName(id_));
+    }
+    frame->GetUpper()->Set(id_, value);
+}
+
+ObjectPtr LocalRef::Evaluate(const std::shared_ptr<Context>& context) {
+    auto frame = GetFrame(context.get());
+    auto value = frame->Load(frame->GetSlot(slot_));
+    if (value != UnboundMarker()) {
+        return value;
+    }
+    if (frame->GetUpper() == nullptr) {
+        throw NameError("Unable to find symbol " + Symbol::GetName(id_));
+    }
+    return frame->GetUpper()->Get(id_);
+}
+
+std::string LocalRef::Serialize() {
+    return Symbol::GetName(id_);
+}
+
+GlobalRef::GlobalRef(size_t depth, SymbolId id) : Object(ObjectType::GLOBAL_REF), depth_(depth), id_(id) {
+}
+
+SymbolId GlobalRef::GetId() const {
+    return id_;
+}
+
+size_t GlobalRef::GetDepth() const {
+    return depth_;
+}
+
+ObjectPtr GlobalRef::Lookup(Context* context) {
+    for (size_t i = 0; i < depth_; ++i) {
+        context = context->GetUpper();
+    }
+    auto epoch = bindings_epoch.load(std::memory_order_relaxed);
+    auto scope = Context::GetCurrentScope();
+    if (context == cached_context_ && scope == cached_scope_ && epoch == cached_epoch_) [[likely]] {
+        return cached_holder_->Load(*cached_binding_);
+    }
+    Context* holder;
+    auto binding = context->Find(id_, &holder);
+    if (binding == nullptr) {
+        throw NameError("Unable to find symbol " + Symbol::GetName(id_));
+    }
+    // Slots of frames get bound without advancing the epoch, so lookups through them are not cached. Parallel tasks
+    // and pool workers share the reference, so they only read the cache, and it is filled while none of them run.
+    auto is_cacheable = !concurrency::IsConcurrent();
+    for (auto current = context; current != nullptr; current = current->GetUpper()) {
+        is_cacheable = is_cacheable && !current->IsFrame();
+    }
+    if (is_cacheable) {
+        cached_context_ = context;
+        cached_scope_ = scope;
+        cached_holder_ = holder;
+        cached_binding_ = binding;
+        cached_epoch_ = epoch;
+    }
+    return holder->Load(*binding);
+}
+
+ObjectPtr GlobalRef::Evaluate(const std::shared_ptr<Context>& context) {
+    return Lookup(context.get());
+}
+
+std::string GlobalRef::Serialize() {
+    return Symbol::GetName(id_);
+}
+
+LambdaExpr::LambdaExpr(std::shared_ptr<const LambdaTemplate> code)
+    : Object(ObjectType::LAMBDA_EXPR), code_(std::move(code)) {
+}
+
+const std::shared_ptr<const LambdaTemplate>& LambdaExpr::GetCode() const {
+    return code_;
+}
+
+ObjectPtr LambdaExpr::Evaluate(const std::shared_ptr<Context>& context) {
+    auto result = Make<Lambda>();
+    result->code = code_;
+    result->context = context;
+    return result;
+}
+
+ConstantExpr::ConstantExpr(ObjectPtr value, ObjectPtr expression)
+    : Object(ObjectType::CONSTANT_EXPR),
+      value_(std::move(value)),
+      expression_(std::move(expression)),
+      epoch_(pure_builtins_epoch.load(std::memory_order_relaxed)) {
+}
+
+const ObjectPtr& ConstantExpr::GetValue() const {
+    return value_;
+}
+
+const ObjectPtr& ConstantExpr::GetExpression() const {
+    return expression_;
+}
+
+bool ConstantExpr::IsValid() const {
+    return pure_builtins_epoch.load(std::memory_order_relaxed) == epoch_;
+}
+
+ObjectPtr ConstantExpr::Evaluate(const std::shared_ptr<Context>& context) {
+    if (IsValid()) [[likely]] {
+        return value_;
+    }
+    return ::Evaluate(expression_, context);
+}
+
+std::string ConstantExpr::Serialize() {
+    return ::Serialize(expression_);
+}
+
+namespace {
+
+struct Scope {
+    const std::vector<SymbolId>* names;
+    const Scope* upper;
+};
+
+class Resolver {
+public:
+    Resolver(const std::shared_ptr<Context>& context) : context_(context) {
+    }
+
+    std::shared_ptr<const LambdaTemplate> ResolveLambda(const ObjectPtr& params, std::span<const ObjectPtr> body,
+                                                        const Scope* upper) {
+        auto code = std::make_shared<LambdaTemplate>();
+        auto current = params;
+        while (current != nullptr) {
+            if (!Is<Cell>(current)) {
+                throw RuntimeError("Expected proper list of lambda arguments");
+            }
+            auto name = Borrow<Cell>(current)->GetFirst();
+            if (!Is<Symbol>(name)) {
+                throw RuntimeError("Invalid type: lambda argument should be a Symbol");
+            }
+            code->names.emplace_back(Borrow<Symbol>(name)->GetId());
+            current = Borrow<Cell>(current)->GetSecond();
+        }
+        code->arg_count = code->names.size();
+
+        Scope scope{&code->names, upper};
+        for (const auto& command : body) {
+            CollectDefinitions(command, &code->names, &scope);
+        }
+        for (const auto& command : body) {
+            code->commands.emplace_back(Resolve(command, &scope));
+        }
+        return code;
+    }
+
+private:
+    static bool IsLocal(SymbolId id, const Scope* scope) {
+        for (; scope != nullptr; scope = scope->upper) {
+            if (std::find(scope->names->begin(), scope->names->end(), id) != scope->names->end()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    //! Checks if `head` names the special form `T`, i.e. is not shadowed locally and is bound to `T` where the
+    //! outermost lambda is created.
+    template <class T>
+    bool IsKeyword(const ObjectPtr& head, const Scope* scope) const {
+        if (!Is<Symbol>(head)) {
+            return false;
+        }
+        auto id = Borrow<Symbol>(head)->GetId();
+        if (IsLocal(id, scope)) {
+            return false;
+        }
+        Context* holder;
+        auto binding = context_->Find(id, &holder);
+        return binding != nullptr && Is<T>(holder->Load(*binding));
+    }
+
+    //! Returns the builtin `head` names, if it is not shadowed anywhere and is bound to that builtin now.
+    const Function* GetBuiltin(const ObjectPtr& head, const Scope* scope) const {
+        if (!Is<Symbol>(head)) {
+            return nullptr;
+        }
+        auto id = Borrow<Symbol>(head)->GetId();
+        if (IsLocal(id, scope)) {
+            return nullptr;
+        }
+        auto binding = context_->Find(id);
+        if (binding == nullptr || binding != Context::GetKeywords()->Find(id)) {
+            return nullptr;
+        }
+        return Borrow<Function>(*binding);
+    }
+
+    //! Returns value of a resolved expression which is known ahead of time and can not be changed by the program,
+    //! or `UnboundMarker()` if there is no such value.
+    static const ObjectPtr& GetImmutableConstant(const ObjectPtr& expr) {
+        if (Is<Integer>(expr) || Is<Boolean>(expr)) {
+            return expr;
+        }
+        if (auto constant = Borrow<ConstantExpr>(expr)) {
+            const auto& value = constant->GetValue();
+            if (value == nullptr || Is<Integer>(value) || Is<Boolean>(value) || Is<Symbol>(value)) {
+                return value;
+            }
+        }
+        return UnboundMarker();
+    }
+
+    //! Computes a resolved call of a pure builtin on immutable constants ahead of time. Calls which fail are left to
+    //! fail when they are evaluated.
+    static ObjectPtr FoldCall(const ObjectPtr& call, const Function& function) {
+        auto procedure = dynamic_cast<const Procedure*>(&function);
+        if (!function.is_pure || procedure == nullptr) {
+            return call;
+        }
+        std::vector<ObjectPtr> args;
+        for (auto current = Borrow<Cell>(call)->GetSecond(); current != nullptr;
+             current = Borrow<Cell>(current)->GetSecond()) {
+            if (!Is<Cell>(current)) {
+                return call;
+            }
+            const auto& value = GetImmutableConstant(Borrow<Cell>(current)->GetFirst());
+            if (value == UnboundMarker()) {
+                return call;
+            }
+            args.push_back(value);
+        }
+        try {
+            return Make<ConstantExpr>(procedure->Call(args), call);
+        } catch (const RuntimeError&) {
+            return call;
+        }
+    }
+
+    //! Finds names defined by `expr` in the frame which is being resolved, without entering nested lambdas.
+    void CollectDefinitions(const ObjectPtr& expr, std::vector<SymbolId>* names, const Scope* scope) const {
+        if (!Is<Cell>(expr)) {
+            return;
+        }
+        auto head = Borrow<Cell>(expr)->GetFirst();
+        if (IsKeyword<QuoteOp>(head, scope) || IsKeyword<LambdaOp>(head, scope) || IsKeyword<FutureOp>(head, scope)) {
+            return;
+        }
+        auto rest = Borrow<Cell>(expr)->GetSecond();
+        if (IsKeyword<DefineOp>(head, scope) && Is<Cell>(rest)) {
+            auto target = Borrow<Cell>(rest)->GetFirst();
+            bool is_function = Is<Cell>(target);
+            if (is_function) {
+                target = Borrow<Cell>(target)->GetFirst();
+            }
+            if (Is<Symbol>(target)) {
+                auto id = Borrow<Symbol>(target)->GetId();
+                if (std::find(names->begin(), names->end(), id) == names->end()) {
+                    names->emplace_back(id);
+                }
+            }
+            if (is_function) {
+                return;
+            }
+        }
+        for (auto current = expr; Is<Cell>(current); current = Borrow<Cell>(current)->GetSecond()) {
+            CollectDefinitions(Borrow<Cell>(current)->GetFirst(), names, scope);
+        }
+    }
+
+    //! Resolves a name which is evaluated.
+    static ObjectPtr ResolveReference(const ObjectPtr& symbol, const Scope* scope) {
+        auto id = Borrow<Symbol>(symbol)->GetId();
+        size_t depth = 0;
+        for (; scope != nullptr; scope = scope->upper, ++depth) {
+            auto it = std::find(scope->names->begin(), scope->names->end(), id);
+            if (it != scope->names->end()) {
+                return Make<LocalRef>(depth, it - scope->names->begin(), id);
+            }
+        }
+        return Make<GlobalRef>(depth, id);
+    }
+
+    //! Resolves a name which is a target of `define` or `set!`. Those of outer contexts are left as `Symbol`s.
+    static ObjectPtr ResolveSymbol(const ObjectPtr& symbol, const Scope* scope) {
+        auto resolved = ResolveReference(symbol, scope);
+        return Is<LocalRef>(resolved) ? resolved : symbol;
+    }
+
+    ObjectPtr Resolve(const ObjectPtr& expr, const Scope* scope) {
+        if (Is<Symbol>(expr)) {
+            return ResolveReference(expr, scope);
+        }
+        if (!Is<Cell>(expr)) {
+            return expr;
+        }
+        auto head = Borrow<Cell>(expr)->GetFirst();
+        auto rest = Borrow<Cell>(expr)->GetSecond();
+        if (IsKeyword<QuoteOp>(head, scope)) {
+            // The datum is the same object on every evaluation, so it is taken out of the form right away.
+            if (GetBuiltin(head, scope) != nullptr && Is<Cell>(rest) && Borrow<Cell>(rest)->GetSecond() == nullptr) {
+                return Make<ConstantExpr>(Borrow<Cell>(rest)->GetFirst(), expr);
+            }
+            return expr;
+        }
+        if (IsKeyword<LambdaOp>(head, scope)) {
+            // Malformed lambdas are left for LambdaOp to report.
+            if (!Is<Cell>(rest) || !Is<Cell>(Borrow<Cell>(rest)->GetSecond())) {
+                return expr;
+            }
+            return std::make_shared<LambdaExpr>(
+                ResolveLambda(Borrow<Cell>(rest)->GetFirst(), ToVector(Borrow<Cell>(rest)->GetSecond()), scope));
+        }
+        if (IsKeyword<FutureOp>(head, scope)) {
+            // The expression is evaluated by another task in a frame of its own, as the body of a lambda. Malformed
+            // futures are left for FutureOp to report.
+            if (!Is<Cell>(rest) || Borrow<Cell>(rest)->GetSecond() != nullptr) {
+                return expr;
+            }
+            const auto& body = Borrow<Cell>(rest)->GetFirst();
+            auto lambda = std::make_shared<LambdaExpr>(ResolveLambda(nullptr, {&body, 1}, scope));
+            return Make<Cell>(ResolveReference(head, scope), Make<Cell>(lambda, nullptr));
+        }
+        if (IsKeyword<DefineOp>(head, scope) && Is<Cell>(rest) && Is<Cell>(Borrow<Cell>(rest)->GetFirst())) {
+            // Function definition `(define (name args...) body...)` becomes `(define name <lambda>)`.
+            auto signature = As<Cell>(Borrow<Cell>(rest)->GetFirst());
+            if (!Is<Symbol>(signature->GetFirst())) {
+                return expr;
+            }
+            auto lambda = std::make_shared<LambdaExpr>(
+                ResolveLambda(signature->GetSecond(), ToVector(Borrow<Cell>(rest)->GetSecond()), scope));
+            return Make<Cell>(
+                head, Make<Cell>(ResolveSymbol(signature->GetFirst(), scope),
+                                             Make<Cell>(lambda, nullptr)));
+        }
+        // Targets of assignments and definitions stay names, everything else is evaluated.
+        auto is_binding = IsKeyword<DefineOp>(head, scope) || IsKeyword<SetOp>(head, scope);
+        auto result = Make<Cell>(Resolve(head, scope), nullptr);
+        auto tail = result;
+        for (auto current = rest; current != nullptr;) {
+            if (!Is<Cell>(current)) {
+                tail->SetSecond(current);
+                break;
+            }
+            auto arg = Borrow<Cell>(current)->GetFirst();
+            auto next = Make<Cell>(is_binding && tail == result && Is<Symbol>(arg) ? ResolveSymbol(arg, scope)
+                                                                                   : Resolve(arg, scope),
+                                   nullptr);
+            tail->SetSecond(next);
+            tail = next;
+            current = Borrow<Cell>(current)->GetSecond();
+        }
+        if (IsKeyword<IfOp>(head, scope)) {
+            return PruneIf(result);
+        }
+        if (auto builtin = GetBuiltin(head, scope)) {
+            return FoldCall(result, *builtin);
+        }
+        return result;
+    }
+
+    //! Replaces a resolved `if` whose condition is a literal with the branch it selects. Like other special forms,
+    //! `if` is recognized by its binding at the time of resolution.
+    static ObjectPtr PruneIf(const ObjectPtr& expr) {
+        auto args = Borrow<Cell>(expr)->GetSecond();
+        std::vector<ObjectPtr> parts;
+        for (; Is<Cell>(args) && parts.size() < 4; args = Borrow<Cell>(args)->GetSecond()) {
+            parts.push_back(Borrow<Cell>(args)->GetFirst());
+        }
+        if (args != nullptr || parts.size() < 2 || parts.size() > 3) {
+            // Malformed `if` is left for IfOp to report.
+            return expr;
+        }
+        if (!Is<Integer>(parts[0]) && !Is<Boolean>(parts[0])) {
+            return expr;
+        }
+        if (Boolean(parts[0]).GetValue()) {
+            return parts[1];
+        }
+        if (parts.size() == 3) {
+            return parts[2];
+        }
+        return Make<ConstantExpr>(nullptr, expr);
+    }
+
+    static std::vector<ObjectPtr> ToVector(ObjectPtr list) {
+        std::vector<ObjectPtr> result;
+        for (; Is<Cell>(list); list = Borrow<Cell>(list)->GetSecond()) {
+            result.emplace_back(Borrow<Cell>(list)->GetFirst());
+        }
+        if (list != nullptr) {
+            throw RuntimeError("Expected proper list but got improper one");
+        }
+        return result;
+    }
+
+    std::shared_ptr<Context> context_;
+};
+
+}  // namespace
+
+std::shared_ptr<const LambdaTemplate> ResolveLambda(const ObjectPtr& params, std::span<const ObjectPtr> body,
+                                                    const std::shared_ptr<Context>& context) {
+    return Resolver(context).ResolveLambda(params, body, nullptr);
+}
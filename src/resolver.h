@@ -0,0 +1,106 @@
+#pragma once
+
+#include "object.h"
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+//! Variable of an enclosing lambda frame, addressed as `depth` frames up and `slot` inside that frame. Resolver puts
+//! it in place of a `Symbol` referring to a lambda parameter or inner definition.
+class LocalRef : public Object {
+public:
+    LocalRef(size_t depth, size_t slot, SymbolId id);
+
+    SymbolId GetId() const;
+    size_t GetDepth() const;
+    size_t GetSlot() const;
+    //! Binds the slot itself, that is what `define` does.
+    void Define(Context* context, ObjectPtr value) const;
+    //! Changes the visible binding, that is what `set!` does.
+    void Assign(Context* context, ObjectPtr value) const;
+
+    virtual ObjectPtr Evaluate(const std::shared_ptr<Context>& context) override;
+    virtual std::string Serialize() override;
+
+private:
+    Context* GetFrame(Context* context) const;
+
+    size_t depth_;
+    size_t slot_;
+    SymbolId id_;
+};
+DECLARE_TYPE_RANGE(LocalRef, LOCAL_REF, LOCAL_REF);
+
+//! Variable which is not bound by any enclosing lambda, so it is looked up in the context the outermost lambda was
+//! created in, `depth` frames up. Resolver puts it in place of such a `Symbol` wherever it is evaluated. Each
+//! reference caches the binding it found last and reuses it while `bindings_epoch` stays the same, so repeated
+//! evaluation takes neither hashing nor a walk over the context chain. Bindings inside frames are never cached.
+class GlobalRef : public Object {
+public:
+    GlobalRef(size_t depth, SymbolId id);
+
+    SymbolId GetId() const;
+    size_t GetDepth() const;
+    //! Returns the value visible from `context`, a frame of the lambda the reference belongs to.
+    ObjectPtr Lookup(Context* context);
+
+    virtual ObjectPtr Evaluate(const std::shared_ptr<Context>& context) override;
+    virtual std::string Serialize() override;
+
+private:
+    size_t depth_;
+    SymbolId id_;
+    Context* cached_context_ = nullptr;
+    //! Scope that was current, which may shadow frozen globals.
+    Context* cached_scope_ = nullptr;
+    //! Context the binding belongs to.
+    Context* cached_holder_ = nullptr;
+    ObjectPtr* cached_binding_ = nullptr;
+    uint64_t cached_epoch_ = 0;
+};
+DECLARE_TYPE_RANGE(GlobalRef, GLOBAL_REF, GLOBAL_REF);
+
+//! Lambda expression with an already resolved body. Evaluates to a closure over the current frame.
+class LambdaExpr : public Object {
+public:
+    LambdaExpr(std::shared_ptr<const LambdaTemplate> code);
+
+    const std::shared_ptr<const LambdaTemplate>& GetCode() const;
+    virtual ObjectPtr Evaluate(const std::shared_ptr<Context>& context) override;
+
+private:
+    std::shared_ptr<const LambdaTemplate> code_;
+};
+DECLARE_TYPE_RANGE(LambdaExpr, LAMBDA_EXPR, LAMBDA_EXPR);
+
+//! Value of `expression` computed when the lambda containing it was resolved: a quoted datum, or a call of pure
+//! builtins on constants. It is valid while names of pure builtins keep their bindings; once any of them is rebound,
+//! the expression is evaluated as written instead.
+class ConstantExpr : public Object {
+public:
+    ConstantExpr(ObjectPtr value, ObjectPtr expression);
+
+    //! Value computed ahead of time, regardless of whether it is still valid.
+    const ObjectPtr& GetValue() const;
+    const ObjectPtr& GetExpression() const;
+    //! Whether the value computed ahead of time is still the value of the expression.
+    bool IsValid() const;
+    virtual ObjectPtr Evaluate(const std::shared_ptr<Context>& context) override;
+    virtual std::string Serialize() override;
+
+private:
+    ObjectPtr value_;
+    ObjectPtr expression_;
+    uint64_t epoch_;
+};
+DECLARE_TYPE_RANGE(ConstantExpr, CONSTANT_EXPR, CONSTANT_EXPR);
+
+//! Resolves lambda with parameter list `params` and `body` which is being created in `context`. References to its
+//! parameters and inner definitions, as well as to ones of lambdas nested into it, become `LocalRef`s, other evaluated
+//! names become `GlobalRef`s; nested lambda expressions become `LambdaExpr`s. Quoted data and calls of pure builtins on
+//! constants become `ConstantExpr`s, and `if`s with a constant condition are replaced with the branch it selects.
+std::shared_ptr<const LambdaTemplate> ResolveLambda(const ObjectPtr& params, std::span<const ObjectPtr> body,
+                                                    const std::shared_ptr<Context>& context);
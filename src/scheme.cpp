@@ -1,22 +1,218 @@
 #include "scheme.h"
 
+#include "bytecode.h"
+#include "concurrency.h"
 #include "error.h"
+#include "gc.h"
+#include "image.h"
 #include "object.h"
+#include "pool.h"
 #include "tokenizer.h"
 #include "parser.h"
 
+#include <algorithm>
+#include <fstream>
 #include <sstream>
+#include <utility>
 
-Interpreter::Interpreter() : global_context_(std::make_shared<Context>(Context::GetKeywords())) {
+struct Interpreter::SharedData {
+    ~SharedData() {
+        Context::Thaw(data);
+    }
+
+    //! Data shared by the forking interpreter itself, which stays frozen as long as this does.
+    std::shared_ptr<SharedData> upper;
+    Context::FrozenData data;
+};
+
+Interpreter::Interpreter(Engine engine) : Interpreter(engine, Context::GetKeywords()) {
 }
 
-std::string Interpreter::Run(const std::string &s) {
-    std::stringstream ss(s);
-    Tokenizer tokenizer(&ss);
+Interpreter::Interpreter(Engine engine, std::shared_ptr<Context> environment)
+    : environment_(std::move(environment)), global_context_(Make<Context>(environment_)), engine_(engine) {
+}
+
+Interpreter::~Interpreter() {
+    // Definitions of the interpreter usually refer to its context, so release those cycles right away. Forks leave
+    // them to the next collection instead: it would scan the whole shared environment every time one is dropped.
+    auto is_fork = environment_ != Context::GetKeywords();
+    global_context_ = nullptr;
+    environment_ = nullptr;
+    if (is_fork) {
+        CollectGarbageIfNeeded();
+    } else {
+        CollectGarbage();
+    }
+}
+
+Interpreter Interpreter::Fork() {
+    auto shared = forks_shared_.lock();
+    // Data of the environment was thawed if all earlier forks are gone, so it is frozen again along with new
+    // definitions.
+    if (!global_context_->IsEmptyScope() || (owns_environment_ && shared == nullptr)) {
+        if (shared == nullptr) {
+            shared = std::make_shared<SharedData>();
+            shared->upper = shared_;
+            forks_shared_ = shared;
+        }
+        if (!global_context_->IsEmptyScope()) {
+            environment_ = std::move(global_context_);
+            global_context_ = environment_->MakeScope(environment_);
+            owns_environment_ = true;
+        }
+        environment_->FreezeReachable(&shared->data);
+    } else if (shared == nullptr) {
+        shared = shared_;
+    }
+    Interpreter fork(engine_, environment_);
+    fork.shared_ = std::move(shared);
+    fork.global_context_ = global_context_->MakeScope(environment_);
+    fork.serialize_options_ = serialize_options_;
+    return fork;
+}
+
+ObjectPtr Interpreter::EvaluateForm(const ObjectPtr& ast) {
+    Profiler::Activation activation(is_profiling_ ? &profiler_ : Profiler::Active());
+    Context::ScopeActivation scope(global_context_.get());
+    return engine_ == Engine::BYTECODE ? Execute(Compile(ast, global_context_), global_context_)
+                                       : ::Evaluate(ast, global_context_);
+}
+
+ObjectPtr Interpreter::ReadSingleForm(const std::string& s) {
+    Tokenizer tokenizer(s);
     auto ast = Read(&tokenizer);
     if (!tokenizer.IsEnd()) {
         throw SyntaxError("Garbage at the end of input");
     }
-    auto result = ::Evaluate(ast, global_context_);
-    return ::Serialize(result);
+    return ast;
+}
+
+std::string Interpreter::Run(const std::string &s) {
+    auto serialized = ::Serialize(EvaluateForm(ReadSingleForm(s)));
+    CollectGarbageIfNeeded();
+    return serialized;
+}
+
+void Interpreter::Run(const std::string& s, std::ostream* out) {
+    ::Serialize(EvaluateForm(ReadSingleForm(s)), out, serialize_options_);
+    CollectGarbageIfNeeded();
+}
+
+void Interpreter::RunStream(std::istream* in, std::ostream* out) {
+    Tokenizer tokenizer(in);
+    while (!tokenizer.IsEnd()) {
+        auto ast = Read(&tokenizer);
+        ::Serialize(EvaluateForm(ast), out, serialize_options_);
+        *out << '\n';
+        CollectGarbageIfNeeded();
+    }
+}
+
+void Interpreter::RunFile(const std::string& path, std::ostream* out) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        throw RuntimeError("Unable to open file " + path);
+    }
+    RunStream(&file, out);
+}
+
+void Interpreter::SaveImage(const std::string& path) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file) {
+        throw RuntimeError("Unable to open file " + path);
+    }
+    WriteImage(global_context_, &file);
+    if (!file.flush()) {
+        throw RuntimeError("Unable to write file " + path);
+    }
+}
+
+void Interpreter::LoadImage(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file) {
+        throw RuntimeError("Unable to open file " + path);
+    }
+    std::string image(file.tellg(), '\0');
+    file.seekg(0);
+    if (!file.read(image.data(), image.size())) {
+        throw RuntimeError("Unable to read file " + path);
+    }
+    ReadImage(image, global_context_);
+}
+
+void Interpreter::SetProfiling(bool is_enabled) {
+    is_profiling_ = is_enabled;
+}
+
+void Interpreter::SetSerializeOptions(const SerializeOptions& options) {
+    serialize_options_ = options;
+}
+
+std::vector<ProfileEntry> Interpreter::GetProfile() const {
+    return profiler_.GetEntries();
+}
+
+void Interpreter::ResetProfile() {
+    profiler_.Reset();
+}
+
+std::optional<MemoStats> Interpreter::GetMemoStats(const std::string& name) const {
+    auto binding = global_context_->Find(Symbol::Intern(name)->GetId());
+    if (binding == nullptr || !Is<Memoized>(*binding)) {
+        return std::nullopt;
+    }
+    return Borrow<Memoized>(*binding)->GetStats();
+}
+
+InterpreterPool::InterpreterPool(Interpreter* prototype, size_t thread_count) : base_(prototype->Fork()) {
+    if (thread_count == 0) {
+        thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    concurrency::active_pools.fetch_add(1, std::memory_order_release);
+    for (size_t i = 0; i < thread_count; ++i) {
+        workers_.emplace_back([this] { Work(); });
+    }
+}
+
+InterpreterPool::~InterpreterPool() {
+    {
+        std::lock_guard lock(mutex_);
+        is_stopped_ = true;
+    }
+    ready_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+    concurrency::active_pools.fetch_sub(1, std::memory_order_release);
+}
+
+std::future<std::string> InterpreterPool::Submit(std::string source) {
+    std::packaged_task<std::string()> task([this, source = std::move(source)] {
+        auto interpreter = base_.Fork();
+        std::istringstream in(source);
+        std::ostringstream out;
+        interpreter.RunStream(&in, &out);
+        return out.str();
+    });
+    auto result = task.get_future();
+    {
+        std::lock_guard lock(mutex_);
+        queue_.push_back(std::move(task));
+    }
+    ready_.notify_one();
+    return result;
+}
+
+void InterpreterPool::Work() {
+    while (true) {
+        std::unique_lock lock(mutex_);
+        ready_.wait(lock, [this] { return is_stopped_ || !queue_.empty(); });
+        if (queue_.empty()) {
+            return;
+        }
+        auto task = std::move(queue_.front());
+        queue_.pop_front();
+        lock.unlock();
+        task();
+    }
 }
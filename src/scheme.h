@@ -1,16 +1,117 @@
 #pragma once
 
+#include "memoize.h"
 #include "object.h"
+#include "profiler.h"
 
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <istream>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
 #include <string>
+#include <thread>
+#include <vector>
+
+//! How an interpreter executes expressions: by walking the syntax tree or by compiling it to bytecode first.
+enum class Engine { TREE_WALKER, BYTECODE };
 
 class Interpreter {
 public:
-    Interpreter();
+    Interpreter(Engine engine = Engine::TREE_WALKER);
+    Interpreter(Interpreter&&) = default;
+    ~Interpreter();
+
+    //! Returns an interpreter which starts with all definitions of this one, and from then on both change them
+    //! independently. Nothing is copied: the current global scope is frozen together with all variables its functions
+    //! captured, and each interpreter gets an empty scope of its own over it (see `Context`). Pairs, vectors and hash
+    //! tables reachable from it are frozen while forks which share them exist: changing them throws `RuntimeError` in
+    //! every interpreter until the last of those is destroyed, which must not happen while this one runs. Must not be
+    //! called while tasks of this interpreter run. Forking changes nothing if no definitions were made since the last
+    //! one and its forks still exist, so then forks may be made from several threads at once.
+    Interpreter Fork();
 
+    //! Evaluates a single expression and returns its serialized result.
     std::string Run(const std::string&);
+    //! Same as `Run`, but writes the result to `out` as it is serialized, so huge results need no extra memory.
+    void Run(const std::string&, std::ostream* out);
+    //! Evaluates all top-level expressions of the stream in order, writing each result on its own line. Stops at the
+    //! first error by rethrowing it.
+    void RunStream(std::istream* in, std::ostream* out);
+    //! Same as `RunStream` for the file at `path`.
+    void RunFile(const std::string& path, std::ostream* out);
+
+    //! Writes all definitions of this interpreter to a binary image at `path` (see `WriteImage`). Must not be called
+    //! while tasks of this interpreter run.
+    void SaveImage(const std::string& path);
+    //! Makes the definitions saved in the image at `path` as if the code which made them was run here, without
+    //! reading or evaluating that code.
+    void LoadImage(const std::string& path);
+
+    //! Turns recording of calls made by `Run*` on or off. Recorded statistics are kept until `ResetProfile`.
+    void SetProfiling(bool is_enabled);
+
+    //! Limits of results written by `Run` to a stream and by `RunStream`.
+    void SetSerializeOptions(const SerializeOptions& options);
+    std::vector<ProfileEntry> GetProfile() const;
+    void ResetProfile();
+
+    //! Counters of the memoized procedure bound to global `name`, none if it is not bound to one.
+    std::optional<MemoStats> GetMemoStats(const std::string& name) const;
 
 private:
+    Interpreter(Engine engine, std::shared_ptr<Context> environment);
+
+    ObjectPtr EvaluateForm(const ObjectPtr& ast);
+    ObjectPtr ReadSingleForm(const std::string& s);
+
+    //! Pairs, vectors and hash tables frozen by forking, which are thawed once no fork shares them.
+    struct SharedData;
+
+    //! Frozen definitions shared with other interpreters, builtins unless this one was forked.
+    std::shared_ptr<Context> environment_;
+    //! Data of `environment_` frozen by the interpreter this one was forked from, none for builtins.
+    std::shared_ptr<SharedData> shared_;
+    //! Data this interpreter froze for its forks, which expires with the last of them.
+    std::weak_ptr<SharedData> forks_shared_;
+    //! Whether `environment_` holds definitions of this interpreter, so that its data is frozen by `forks_shared_`.
+    bool owns_environment_ = false;
     std::shared_ptr<Context> global_context_;
+    Engine engine_;
+    Profiler profiler_;
+    bool is_profiling_ = false;
+    SerializeOptions serialize_options_;
+};
+
+//! Serves evaluations on worker threads, each in a fresh fork of a prepared interpreter, so that they do not see each
+//! other's definitions.
+class InterpreterPool {
+public:
+    //! Starts `thread_count` workers, one per core if it is 0. Definitions made in `prototype` later are not seen by
+    //! them.
+    explicit InterpreterPool(Interpreter* prototype, size_t thread_count = 0);
+    //! Finishes evaluations submitted so far and stops the workers.
+    ~InterpreterPool();
+
+    InterpreterPool(const InterpreterPool&) = delete;
+    InterpreterPool& operator=(const InterpreterPool&) = delete;
+
+    //! Evaluates all top-level expressions of `source` as `RunStream` does. The future holds their output, or the error
+    //! which stopped them.
+    std::future<std::string> Submit(std::string source);
+
+private:
+    void Work();
+
+    //! Fork of the prototype without definitions of its own, which workers fork further.
+    Interpreter base_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    std::deque<std::packaged_task<std::string()>> queue_;
+    bool is_stopped_ = false;
+    std::vector<std::thread> workers_;
 };
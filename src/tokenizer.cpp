@@ -2,141 +2,217 @@
 
 #include "error.h"
 
-#include <cctype>
+#include <cstdint>
 #include <istream>
-#include <set>
 #include <string>
 #include <variant>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 namespace {
 
-bool IsSign(int c) {
+bool IsSign(char c) {
     return c == '+' || c == '-';
 }
 
-bool IsParen(int c) {
+bool IsParen(char c) {
     return c == '(' || c == ')';
 }
 
-bool IsDigit(int c) {
-    return std::isdigit(c);
+bool IsDigit(char c) {
+    return c >= '0' && c <= '9';
 }
 
-bool IsDot(int c) {
+bool IsDot(char c) {
     return c == '.';
 }
 
-bool IsQuote(int c) {
+bool IsQuote(char c) {
     return c == '\'';
 }
 
-BracketToken GetParen(std::istream* is) {
-    if (is->get() == '(') {
-        return BracketToken::OPEN;
-    } else {
-        return BracketToken::CLOSE;
-    }
+bool IsAlpha(char c) {
+    return (c | 0x20) >= 'a' && (c | 0x20) <= 'z';
 }
 
-DotToken GetDot(std::istream* is) {
-    is->ignore();
-    return DotToken{};
+//! Same set as `std::isspace` in the "C" locale.
+bool IsSpace(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
 }
 
-QuoteToken GetQuote(std::istream* is) {
-    is->ignore();
-    return QuoteToken{};
+bool IsFirstCharOfSymbol(char c) {
+    return IsAlpha(c) || c == '<' || c == '=' || c == '>' || c == '*' || c == '/' || c == '#';
+}
+bool IsContinuingCharOfSymbol(char c) {
+    return IsFirstCharOfSymbol(c) || IsDigit(c) || c == '!' || c == '?' || c == '-';
 }
 
-Token GetConstantOrSign(std::istream* is) {
-    bool is_negative = false;
-    if (IsSign(is->peek())) {
-        char sign = is->get();
-        if (!IsDigit(is->peek())) {
-            return SymbolToken{std::string(1, sign)};
-        }
-        is_negative = (sign == '-');
-    }
-    int value = 0;
-    while (IsDigit(is->peek())) {
-        value = value * 10 + (is->get() - '0');
-    }
-    if (is_negative) {
-        value *= -1;
-    }
-    return ConstantToken{value};
+#ifdef __SSE2__
+// Scanners below look at 16 bytes at once and stop at the first one which does not match, the scalar loops which
+// follow them handle the tail of the buffer. Bytes above 0x7f are negative in signed compares, so they never match.
+
+__m128i InRange(__m128i chars, char low, char high) {
+    return _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8(low - 1)), _mm_cmpgt_epi8(_mm_set1_epi8(high + 1), chars));
 }
 
-bool IsFirstCharOfSymbol(int c) {
-    return std::isalpha(c) || c == '<' || c == '=' || c == '>' || c == '*' || c == '/' || c == '#';
+__m128i EqualTo(__m128i chars, char c) {
+    return _mm_cmpeq_epi8(chars, _mm_set1_epi8(c));
 }
-bool IsContinuingCharOfSymbol(int c) {
-    return IsFirstCharOfSymbol(c) || std::isdigit(c) || c == '!' || c == '?' || c == '-';
+
+__m128i SpaceMask(__m128i chars) {
+    return _mm_or_si128(EqualTo(chars, ' '), InRange(chars, '\t', '\r'));
 }
 
-SymbolToken GetSymbol(std::istream* is) {
-    if (IsSign(is->peek())) {
-        return SymbolToken{std::string(1, is->get())};
-    }
-    std::string result;
-    if (!IsFirstCharOfSymbol(is->peek())) {
-        throw SyntaxError("Tokenization failed at position " + std::to_string(is->tellg()) +
-                          ": not a valid first character of a symbol token: \"" + std::string(1, is->peek()) + "\"");
+__m128i SymbolCharMask(__m128i chars) {
+    auto result = _mm_or_si128(InRange(_mm_or_si128(chars, _mm_set1_epi8(0x20)), 'a', 'z'), InRange(chars, '0', '9'));
+    for (char c : {'<', '=', '>', '*', '/', '#', '!', '?', '-'}) {
+        result = _mm_or_si128(result, EqualTo(chars, c));
     }
-    result.push_back(is->get());
-    while (is->peek() != EOF && !std::isspace(is->peek())) {
-        if (!IsContinuingCharOfSymbol(is->peek())) {
-            // throw SyntaxError("Tokenization failed at position " + std::to_string(is->tellg()) +
-            //                   ": not a valid character inside of a symbol token: \"" +
-            //                   std::string(1, is->peek()) + "\"");
-            break;
+    return result;
+}
+
+//! Returns position of the first byte starting from `position` for which `mask` is false, or of the last full block.
+template <class Mask>
+size_t SkipWhile(std::string_view buffer, size_t position, Mask mask) {
+    while (position + 16 <= buffer.size()) {
+        auto chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(buffer.data() + position));
+        auto stop = ~_mm_movemask_epi8(mask(chars)) & 0xffff;
+        if (stop != 0) {
+            return position + __builtin_ctz(stop);
         }
-        result.push_back(is->get());
+        position += 16;
     }
-    return SymbolToken{result};
+    return position;
 }
+#endif
 
 } // namespace
 
-Tokenizer::Tokenizer(std::istream* in) : is_(in), is_end_(false) {}
+Tokenizer::Tokenizer(std::string_view buffer) : buffer_(buffer) {}
+
+Tokenizer::Tokenizer(std::istream* in) : in_(in) {}
+
+bool Tokenizer::Fill() {
+    if (in_ == nullptr || !std::getline(*in_, line_)) {
+        in_ = nullptr;
+        return false;
+    }
+    if (!in_->eof()) {
+        line_.push_back('\n');
+    }
+    // Everything before the token being read is consumed, so the buffer holds at most one line and an unfinished token.
+    owned_buffer_.erase(0, token_start_);
+    offset_ += token_start_;
+    position_ -= token_start_;
+    token_start_ = 0;
+    owned_buffer_ += line_;
+    buffer_ = owned_buffer_;
+    return true;
+}
 
 bool Tokenizer::IsEnd() {
-    if (std::holds_alternative<std::monostate>(current_token_)) {
-        IgnoreSpaces();
-        return is_->peek() == EOF;
+    if (std::holds_alternative<std::monostate>(current_token_) && !is_end_) {
+        Scan();
     }
     return is_end_;
 }
 
 void Tokenizer::IgnoreSpaces() {
-    while (is_->peek() != EOF && std::isspace(is_->peek())) {
-        is_->ignore();
+    do {
+#ifdef __SSE2__
+        position_ = SkipWhile(buffer_, position_, SpaceMask);
+#endif
+        while (position_ < buffer_.size() && IsSpace(buffer_[position_])) {
+            ++position_;
+        }
+    } while (position_ == buffer_.size() && Fill());
+}
+
+Token Tokenizer::GetConstantOrSign() {
+    bool is_negative = false;
+    if (IsSign(buffer_[position_])) {
+        char sign = buffer_[position_++];
+        if ((position_ == buffer_.size() && !Fill()) || !IsDigit(buffer_[position_])) {
+            return SymbolToken{buffer_.substr(position_ - 1, 1)};
+        }
+        is_negative = (sign == '-');
+    }
+    // Magnitude of the most negative value is one more than of the most positive one.
+    const uint64_t limit = is_negative ? static_cast<uint64_t>(INT64_MAX) + 1 : INT64_MAX;
+    uint64_t magnitude = 0;
+    while ((position_ < buffer_.size() || Fill()) && IsDigit(buffer_[position_])) {
+        uint64_t digit = buffer_[position_] - '0';
+        if (magnitude > (limit - digit) / 10) {
+            // Too long for 64 bits, the parser makes an arbitrary-precision integer of it.
+            while ((position_ < buffer_.size() || Fill()) && IsDigit(buffer_[position_])) {
+                ++position_;
+            }
+            return BigConstantToken{buffer_.substr(token_start_, position_ - token_start_)};
+        }
+        magnitude = magnitude * 10 + digit;
+        ++position_;
     }
+    return ConstantToken{static_cast<int64_t>(is_negative ? 0 - magnitude : magnitude)};
 }
 
-void Tokenizer::Next() {
+SymbolToken Tokenizer::GetSymbol() {
+    if (!IsFirstCharOfSymbol(buffer_[position_])) {
+        throw SyntaxError("Tokenization failed at position " + std::to_string(offset_ + position_) +
+                          ": not a valid first character of a symbol token: \"" +
+                          std::string(1, buffer_[position_]) + "\"");
+    }
+    ++position_;
+    do {
+#ifdef __SSE2__
+        position_ = SkipWhile(buffer_, position_, SymbolCharMask);
+#endif
+        while (position_ < buffer_.size() && IsContinuingCharOfSymbol(buffer_[position_])) {
+            ++position_;
+        }
+    } while (position_ == buffer_.size() && Fill());
+    return SymbolToken{buffer_.substr(token_start_, position_ - token_start_)};
+}
+
+void Tokenizer::Scan() {
+    token_start_ = position_;
     IgnoreSpaces();
-    if (is_->peek() == EOF) {
+    token_start_ = position_;
+    if (position_ == buffer_.size()) {
         is_end_ = true;
         return;
     }
-    if (IsParen(is_->peek())) {
-        current_token_ = GetParen(is_);
-    } else if (IsDot(is_->peek())) {
-        current_token_ = GetDot(is_);
-    } else if (IsQuote(is_->peek())) {
-        current_token_ = GetQuote(is_);
-    } else if (IsSign(is_->peek()) || IsDigit(is_->peek())) {
-        current_token_ = GetConstantOrSign(is_);
+    char c = buffer_[position_];
+    if (c == '#' && (position_ + 1 < buffer_.size() || Fill()) && buffer_[position_ + 1] == '(') {
+        position_ += 2;
+        current_token_ = BracketToken::OPEN_VECTOR;
+    } else if (IsParen(c)) {
+        ++position_;
+        current_token_ = c == '(' ? BracketToken::OPEN : BracketToken::CLOSE;
+    } else if (IsDot(c)) {
+        ++position_;
+        current_token_ = DotToken{};
+    } else if (IsQuote(c)) {
+        ++position_;
+        current_token_ = QuoteToken{};
+    } else if (IsSign(c) || IsDigit(c)) {
+        current_token_ = GetConstantOrSign();
     } else {
-        current_token_ = GetSymbol(is_);
+        current_token_ = GetSymbol();
+    }
+}
+
+void Tokenizer::Next() {
+    if (std::holds_alternative<std::monostate>(current_token_) && !is_end_) {
+        Scan();
     }
+    current_token_ = std::monostate{};
 }
 
 Token Tokenizer::GetToken() {
-    if (std::holds_alternative<std::monostate>(current_token_)) {
-        // It is a first call, should read a token first.
-        Next();
+    if (std::holds_alternative<std::monostate>(current_token_) && !is_end_) {
+        Scan();
     }
     return current_token_;
 }
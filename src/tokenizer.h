@@ -1,11 +1,15 @@
 #pragma once
 
-#include <variant>
-#include <optional>
+#include <cstdint>
 #include <istream>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <variant>
 
 struct SymbolToken {
-    std::string name;
+    //! View into the tokenizer's buffer, valid until the tokenizer reads the next token.
+    std::string_view name;
 
     bool operator==(const SymbolToken& other) const = default;
 };
@@ -18,21 +22,38 @@ struct DotToken {
     bool operator==(const DotToken&) const = default;
 };
 
-enum class BracketToken { OPEN, CLOSE };
+//! `OPEN_VECTOR` is the `#(` which starts a vector literal, vectors are closed by the usual bracket.
+enum class BracketToken { OPEN, CLOSE, OPEN_VECTOR };
 
 struct ConstantToken {
-    int value;
+    int64_t value;
 
     bool operator==(const ConstantToken& other) const = default;
 };
 
-using Token =
-    std::variant<std::monostate, ConstantToken, BracketToken, SymbolToken, QuoteToken, DotToken>;
+//! Integer constant which does not fit into 64 bits.
+struct BigConstantToken {
+    //! Optional sign and decimal digits, a view into the tokenizer's buffer like `SymbolToken::name`.
+    std::string_view digits;
 
+    bool operator==(const BigConstantToken& other) const = default;
+};
+
+using Token = std::variant<std::monostate, ConstantToken, BracketToken, SymbolToken, QuoteToken, DotToken,
+                           BigConstantToken>;
+
+//! Splits a contiguous buffer into tokens without copying it. `Next` only drops the current token, the next one is read
+//! when it is asked for, so a stream is not read past the end of an expression until the caller wants more.
 class Tokenizer {
 public:
+    //! Tokenizes `buffer`, which must outlive the tokenizer and its symbol tokens.
+    Tokenizer(std::string_view buffer);
+    //! Reads the stream a line at a time as tokens are asked for. Consumed lines are dropped from the buffer.
     Tokenizer(std::istream* in);
 
+    Tokenizer(const Tokenizer&) = delete;
+    Tokenizer& operator=(const Tokenizer&) = delete;
+
     bool IsEnd();
 
     void Next();
@@ -40,9 +61,20 @@ public:
     Token GetToken();
 
 private:
-    std::istream* is_;
+    std::istream* in_ = nullptr;
+    std::string owned_buffer_;
+    std::string line_;
+    std::string_view buffer_;
+    //! Number of bytes dropped from the start of `owned_buffer_`, for positions in error messages.
+    size_t offset_ = 0;
+    size_t position_ = 0;
+    size_t token_start_ = 0;
     Token current_token_;
-    bool is_end_;
+    bool is_end_ = false;
 
+    bool Fill();
+    void Scan();
     void IgnoreSpaces();
-};
\ No newline at end of file
+    Token GetConstantOrSign();
+    SymbolToken GetSymbol();
+};
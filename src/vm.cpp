@@ -0,0 +1,300 @@
+#include "bytecode.h"
+
+#include "error.h"
+#include "gc.h"
+#include "object.h"
+#include "pool.h"
+#include "profiler.h"
+#include "resolver.h"
+
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace {
+
+struct Frame {
+    std::shared_ptr<const CodeObject> code;
+    std::shared_ptr<Context> context;
+    size_t pc = 0;
+    //! Whether the frame is a call recorded by the profiler, which is left when the frame returns.
+    bool is_profiled = false;
+};
+
+Context* GetFrameContext(Context* context, uint16_t depth) {
+    for (uint16_t i = 0; i < depth; ++i) {
+        context = context->GetUpper();
+    }
+    return context;
+}
+
+//! Unbound slot means that inner definition was not executed yet, so the name still refers to an outer binding.
+Context* GetOuterContext(Context* frame, uint32_t slot) {
+    if (frame->GetUpper() == nullptr) {
+        throw NameError("Unable to find symbol " + Symbol::GetName(frame->GetSlotName(slot)));
+    }
+    return frame->GetUpper();
+}
+
+ObjectPtr Pop(std::vector<ObjectPtr>* stack) {
+    auto value = std::move(stack->back());
+    stack->pop_back();
+    return value;
+}
+
+//! Frames and value stack of a single `Execute`. Native procedures get their arguments as a view into the stack of the
+//! caller, so a nested `Execute`, such as of a closure called by `map`, can not share it. Instead the thread keeps the
+//! ones of finished runs with their capacity, and calls from native code into compiled code allocate nothing for them.
+//! Only a few stacks of moderate size are kept, those grown by a deep recursion are released with their run.
+class ExecutionStacks {
+public:
+    ExecutionStacks() {
+        auto& spare = GetSpare();
+        if (!spare.empty()) {
+            frames = std::move(spare.back().frames);
+            stack = std::move(spare.back().stack);
+            spare.pop_back();
+        }
+    }
+    ~ExecutionStacks() {
+        auto& spare = GetSpare();
+        if (spare.size() >= kMaxSpare || frames.capacity() > kMaxSpareCapacity ||
+            stack.capacity() > kMaxSpareCapacity) {
+            return;
+        }
+        frames.clear();
+        stack.clear();
+        spare.push_back({std::move(frames), std::move(stack)});
+    }
+
+    ExecutionStacks(const ExecutionStacks&) = delete;
+    ExecutionStacks& operator=(const ExecutionStacks&) = delete;
+
+    std::vector<Frame> frames;
+    std::vector<ObjectPtr> stack;
+
+private:
+    //! Nesting of native calls into compiled code, such as `map` inside `map`, which is served without allocations.
+    static constexpr size_t kMaxSpare = 16;
+    //! Elements a kept stack may hold, more than that are only needed by deep recursions.
+    static constexpr size_t kMaxSpareCapacity = 4096;
+
+    struct Spare {
+        std::vector<Frame> frames;
+        std::vector<ObjectPtr> stack;
+    };
+
+    static std::vector<Spare>& GetSpare() {
+        static thread_local std::vector<Spare> spare;
+        return spare;
+    }
+};
+
+//! Whether a special form was rebound since `code` was compiled, so that it may differ from its source.
+bool IsStale(const CodeObject& code) {
+    return code.epoch != special_forms_epoch.load(std::memory_order_relaxed);
+}
+
+}  // namespace
+
+ObjectPtr Closure::Call(std::span<const ObjectPtr> args) const {
+    if (IsStale(*code)) [[unlikely]] {
+        // The template holds the resolved body, which the tree walker evaluates with special forms bound as they are.
+        auto lambda = Make<Lambda>();
+        lambda->code = code->layout;
+        lambda->context = context;
+        lambda->name = name;
+        return lambda->Call(args);
+    }
+    if (args.size() != code->layout->arg_count) {
+        throw RuntimeError("Argument count is incorrect for lambda");
+    }
+    CollectGarbageIfNeeded();
+    auto frame = Make<Context>(context, code->layout);
+    for (size_t i = 0; i < args.size(); ++i) {
+        frame->GetSlot(i) = args[i];
+    }
+    return Execute(code, std::move(frame));
+}
+
+void Closure::Trace(const std::function<void(Collectable*)>& visit) const {
+    if (context != nullptr) {
+        visit(context.get());
+    }
+}
+
+void Closure::Clear() {
+    context = nullptr;
+}
+
+long Closure::UseCount() const {
+    return weak_from_this().use_count();
+}
+
+std::shared_ptr<const void> Closure::Retain() const {
+    return weak_from_this().lock();
+}
+
+ObjectPtr Execute(std::shared_ptr<const CodeObject> code, const std::shared_ptr<Context>& context) {
+    ExecutionStacks stacks;
+    auto& frames = stacks.frames;
+    auto& stack = stacks.stack;
+    frames.push_back(Frame{std::move(code), std::move(context)});
+    ProfilerScope profiler_scope;
+    auto profiler = profiler_scope.GetProfiler();
+    while (true) {
+        auto& frame = frames.back();
+        const auto& instruction = frame.code->instructions[frame.pc++];
+        switch (instruction.opcode) {
+            case OpCode::CONSTANT:
+                stack.push_back(frame.code->constants[instruction.arg]);
+                break;
+            case OpCode::LOCAL: {
+                auto target = GetFrameContext(frame.context.get(), instruction.depth);
+                auto value = target->Load(target->GetSlot(instruction.arg));
+                if (value != UnboundMarker()) {
+                    stack.push_back(std::move(value));
+                } else {
+                    stack.push_back(
+                        GetOuterContext(target, instruction.arg)->Get(target->GetSlotName(instruction.arg)));
+                }
+                break;
+            }
+            case OpCode::GLOBAL:
+                stack.push_back(frame.context->Get(instruction.arg));
+                break;
+            case OpCode::GLOBAL_REF:
+                stack.push_back(
+                    static_cast<GlobalRef*>(frame.code->constants[instruction.arg].get())->Lookup(frame.context.get()));
+                break;
+            case OpCode::DEFINE_LOCAL: {
+                auto target = GetFrameContext(frame.context.get(), instruction.depth);
+                auto value = Pop(&stack);
+                NoteBinding(target->GetSlotName(instruction.arg));
+                NameFunction(value, target->GetSlotName(instruction.arg));
+                target->Exchange(target->GetSlot(instruction.arg), std::move(value));
+                stack.push_back(Symbol::Intern(target->GetSlotName(instruction.arg)));
+                break;
+            }
+            case OpCode::DEFINE_GLOBAL:
+                frame.context->Define(instruction.arg, Pop(&stack));
+                stack.push_back(Symbol::Intern(instruction.arg));
+                break;
+            case OpCode::SET_LOCAL: {
+                auto target = GetFrameContext(frame.context.get(), instruction.depth);
+                auto& binding = target->GetSlot(instruction.arg);
+                if (target->Load(binding) != UnboundMarker()) {
+                    NoteBinding(target->GetSlotName(instruction.arg));
+                    stack.back() = target->Exchange(binding, std::move(stack.back()));
+                } else {
+                    auto outer = GetOuterContext(target, instruction.arg);
+                    auto name = target->GetSlotName(instruction.arg);
+                    auto old = outer->Get(name);
+                    outer->Set(name, Pop(&stack));
+                    stack.push_back(std::move(old));
+                }
+                break;
+            }
+            case OpCode::SET_GLOBAL: {
+                auto old = frame.context->Get(instruction.arg);
+                frame.context->Set(instruction.arg, Pop(&stack));
+                stack.push_back(std::move(old));
+                break;
+            }
+            case OpCode::POP:
+                stack.pop_back();
+                break;
+            case OpCode::JUMP:
+                frame.pc = instruction.arg;
+                break;
+            case OpCode::JUMP_IF_FALSE:
+                if (!Boolean(Pop(&stack)).GetValue()) {
+                    frame.pc = instruction.arg;
+                }
+                break;
+            case OpCode::JUMP_IF_FALSE_OR_POP:
+                if (!Boolean(stack.back()).GetValue()) {
+                    frame.pc = instruction.arg;
+                } else {
+                    stack.pop_back();
+                }
+                break;
+            case OpCode::JUMP_IF_TRUE_OR_POP:
+                if (Boolean(stack.back()).GetValue()) {
+                    frame.pc = instruction.arg;
+                } else {
+                    stack.pop_back();
+                }
+                break;
+            case OpCode::MAKE_CLOSURE: {
+                auto closure = Make<Closure>();
+                closure->code = frame.code->functions[instruction.arg];
+                closure->context = frame.context;
+                stack.push_back(std::move(closure));
+                break;
+            }
+            case OpCode::EVAL:
+                stack.push_back(::Evaluate(frame.code->constants[instruction.arg], frame.context));
+                break;
+            case OpCode::CALL:
+            case OpCode::TAIL_CALL: {
+                auto function_index = stack.size() - instruction.arg - 1;
+                auto function = stack[function_index];
+                std::span<const ObjectPtr> args(stack.data() + function_index + 1, instruction.arg);
+                if (Is<Closure>(function) && !IsStale(*Borrow<Closure>(function)->code)) {
+                    // Compiled calls stay in this loop instead of recursing on the C++ stack.
+                    auto closure = Borrow<Closure>(function);
+                    if (args.size() != closure->code->layout->arg_count) {
+                        throw RuntimeError("Argument count is incorrect for lambda");
+                    }
+                    CollectGarbageIfNeeded();
+                    auto callee_context = Make<Context>(closure->context, closure->code->layout);
+                    for (size_t i = 0; i < args.size(); ++i) {
+                        callee_context->GetSlot(i) = std::move(stack[function_index + 1 + i]);
+                    }
+                    stack.resize(function_index);
+                    if (instruction.opcode == OpCode::TAIL_CALL) {
+                        // Nothing of the current frame is left on the stack in tail position.
+                        if (profiler != nullptr && frame.is_profiled) [[unlikely]] {
+                            profiler->Exit();
+                        }
+                        frame.code = closure->code;
+                        frame.context = std::move(callee_context);
+                        frame.pc = 0;
+                        frame.is_profiled = profiler != nullptr;
+                    } else {
+                        frames.push_back(Frame{closure->code, std::move(callee_context), 0, profiler != nullptr});
+                    }
+                    if (profiler != nullptr) [[unlikely]] {
+                        profiler->Enter(*closure);
+                    }
+                } else if (Is<Procedure>(function)) {
+                    if (profiler != nullptr) [[unlikely]] {
+                        profiler->Enter(*Borrow<Procedure>(function));
+                    }
+                    auto result = Borrow<Procedure>(function)->Call(args);
+                    if (profiler != nullptr) [[unlikely]] {
+                        profiler->Exit();
+                    }
+                    stack.resize(function_index);
+                    stack.push_back(std::move(result));
+                } else if (Is<Function>(function)) {
+                    throw RuntimeError("Special form can not be applied to evaluated arguments");
+                } else {
+                    throw RuntimeError("First element of list isn't applicable (not a function)");
+                }
+                break;
+            }
+            case OpCode::RETURN:
+                if (profiler != nullptr && frame.is_profiled) [[unlikely]] {
+                    profiler->Exit();
+                }
+                frames.pop_back();
+                if (frames.empty()) {
+                    return Pop(&stack);
+                }
+                break;
+        }
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+//! Stops the test with a message if `condition` is false.
+inline void Check(bool condition, const std::string& message) {
+    if (!condition) {
+        std::cerr << "FAILED: " << message << std::endl;
+        std::exit(1);
+    }
+}
+
+//! Checks that `action` throws `E`.
+template <class E, class F>
+void CheckThrows(F&& action, const std::string& message) {
+    try {
+        action();
+    } catch (const E&) {
+        return;
+    }
+    Check(false, message);
+}
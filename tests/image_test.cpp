@@ -0,0 +1,129 @@
+#include "../src/error.h"
+#include "../src/scheme.h"
+#include "check.h"
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+namespace {
+const std::string kPath = (std::filesystem::temp_directory_path() / "hse_scheme_image_test.img").string();
+
+std::string ReadFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+void WriteFile(const std::string& path, const std::string& content) {
+    std::ofstream(path, std::ios::binary) << content;
+}
+
+//! Loads `image` into a fresh interpreter and returns the result of `expression` evaluated there.
+std::string Load(Engine engine, const std::string& image, const std::string& expression) {
+    WriteFile(kPath, image);
+    Interpreter interpreter(engine);
+    interpreter.LoadImage(kPath);
+    return interpreter.Run(expression);
+}
+
+void CheckMalformed(Engine engine, const std::string& image, const std::string& message) {
+    CheckThrows<RuntimeError>([&] { Load(engine, image, "1"); }, message);
+}
+
+void TestRoundTrip(Engine engine) {
+    {
+        Interpreter interpreter(engine);
+        interpreter.Run("(define (make-counter) (define n 0) (lambda () (set! n (+ n 1)) n))");
+        interpreter.Run("(define counter (make-counter))");
+        interpreter.Run("(counter)");
+        interpreter.Run("(define (fib n) (if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))))");
+        interpreter.Run("(define data (list 1 (vector 2 3) 'four))");
+        interpreter.SaveImage(kPath);
+    }
+    auto image = ReadFile(kPath);
+    Check(Load(engine, image, "(counter)") == "2", "counter is not restored");
+    Check(Load(engine, image, "(fib 10)") == "55", "function is not restored");
+    Check(Load(engine, image, "data") == "(1 #(2 3) four)", "data is not restored");
+
+    // Every record is needed, so no prefix of an image is an image.
+    for (size_t size = 0; size < image.size(); ++size) {
+        CheckMalformed(engine, image.substr(0, size), "truncated image was loaded");
+    }
+    CheckMalformed(engine, image + '\0', "image with garbage at the end was loaded");
+}
+
+// Images below are assembled by hand, so numbers of tags and opcodes are those of image.cpp and bytecode.h. Symbols
+// are x and f, and the image defines f as a lambda of x created in the global scope.
+const std::string kHeader = std::string("hse-scheme image 1\n") + "\x02\x01x\x01" "f";
+
+//! Lambda of the tree walker, `reference` is the only command of its body.
+std::string LambdaImage(const std::string& reference) {
+    return kHeader + std::string(
+                         // Lambda created empty.
+                         "\x01\x03"
+                         // The reference, then the template with x as the parameter and the reference as the body.
+                         "\x02" +
+                         reference + std::string("\x11\x01\x00\x01\x01\x02", 6) +
+                         // No frames, the lambda is made of the template in the scope and named f, then bound to f.
+                         std::string("\x00\x01\x00\x01\x01\x01\x01\x01", 8));
+}
+
+void TestLambdaImages() {
+    auto local = [](char depth, char slot) { return std::string("\x0c") + depth + slot + '\0'; };
+    auto global = [](char depth) { return std::string("\x0d") + depth + '\0'; };
+    Check(Load(Engine::TREE_WALKER, LambdaImage(local(0, 0)), "(f 5)") == "5", "valid lambda image is not loaded");
+    CheckMalformed(Engine::TREE_WALKER, LambdaImage(local(0, 1)), "slot out of the frame was accepted");
+    CheckMalformed(Engine::TREE_WALKER, LambdaImage(local(1, 0)), "frame above the scope was accepted");
+    CheckMalformed(Engine::TREE_WALKER, LambdaImage(global(0x7f)), "context above all contexts was accepted");
+    CheckMalformed(Engine::TREE_WALKER, LambdaImage(std::string("\x30\x00\x00", 3)), "unknown tag was accepted");
+}
+
+//! Compiled closure, `instructions` are the number of instructions followed by them, there are no constants and no
+//! functions.
+std::string ClosureImage(const std::string& instructions) {
+    return kHeader + std::string(
+                         // Closure created empty.
+                         "\x01\x04"
+                         // Layout with x as the parameter, then the code.
+                         "\x02\x11\x01\x00\x01\x00\x12",
+                         9) +
+           instructions +
+           std::string(
+               // No constants and functions, the first template as the layout.
+               "\x00\x00\x01"
+               // No frames, the closure of the code in the scope named f, bound to f.
+               "\x00\x01\x00\x01\x01\x01\x01\x01",
+               11);
+}
+
+void TestClosureImages() {
+    // Opcodes: 0 is CONSTANT, 1 is LOCAL, 9 is JUMP, 13 is MAKE_CLOSURE, 17 is RETURN.
+    const std::string kReturn("\x11\x00\x00", 3);
+    auto local = [](char depth, char slot) { return std::string("\x01") + depth + slot; };
+    Check(Load(Engine::BYTECODE, ClosureImage("\x02" + local(0, 0) + kReturn), "(f 5)") == "5",
+          "valid closure image is not loaded");
+    CheckMalformed(Engine::BYTECODE, ClosureImage("\x02" + local(0, 1) + kReturn), "slot out of the frame");
+    CheckMalformed(Engine::BYTECODE, ClosureImage("\x02" + local(1, 0) + kReturn), "frame above the scope");
+    CheckMalformed(Engine::BYTECODE, ClosureImage(std::string("\x02\x12\x00\x00", 4) + kReturn), "unknown opcode");
+    CheckMalformed(Engine::BYTECODE, ClosureImage("\x02" + std::string("\x00\x00\x00", 3) + kReturn),
+                   "constant out of the table");
+    CheckMalformed(Engine::BYTECODE, ClosureImage("\x02" + std::string("\x0d\x00\x00", 3) + kReturn),
+                   "function out of the table");
+    CheckMalformed(Engine::BYTECODE, ClosureImage("\x01" + kReturn), "return from an empty stack");
+    CheckMalformed(Engine::BYTECODE, ClosureImage("\x01" + local(0, 0)), "code runs past its end");
+    CheckMalformed(Engine::BYTECODE, ClosureImage("\x02" + std::string("\x09\x00\x05", 3) + kReturn),
+                   "jump out of the code");
+}
+}  // namespace
+
+int main() {
+    TestRoundTrip(Engine::TREE_WALKER);
+    TestRoundTrip(Engine::BYTECODE);
+    TestLambdaImages();
+    TestClosureImages();
+    std::filesystem::remove(kPath);
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include "../src/error.h"
+#include "../src/pool.h"
+#include "../src/scheme.h"
+#include "check.h"
+
+#include <future>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+const std::vector<std::string> kMutations = {
+    "(set-car! shared 10)",         "(set-cdr! shared '())",       "(vector-set! numbers 0 10)",
+    "(hash-table-set! table 'a 10)", "(hash-table-delete! table 'a)", "(set-car! (f) 10)",
+};
+
+void TestSharedDataIsFrozen(Engine engine) {
+    Interpreter prototype(engine);
+    prototype.Run("(define shared (list 1 2 3))");
+    prototype.Run("(define numbers (vector 1 2 3))");
+    prototype.Run("(define table (make-hash-table))");
+    prototype.Run("(hash-table-set! table 'a 1)");
+    prototype.Run("(define (make-getter) (define captured (list 1 2)) (lambda () captured))");
+    prototype.Run("(define f (make-getter))");
+    InterpreterPool pool(&prototype, 4);
+
+    // Requests which change the shared list race with each other unless they are refused.
+    std::vector<std::future<std::string>> mutations;
+    for (int i = 0; i < 100; ++i) {
+        mutations.push_back(pool.Submit("(set-car! shared " + std::to_string(i) + ")"));
+        mutations.push_back(pool.Submit("(set-cdr! (cdr shared) (list " + std::to_string(i) + "))"));
+    }
+    for (auto& mutation : mutations) {
+        CheckThrows<RuntimeError>([&mutation] { mutation.get(); }, "shared list was changed by a request");
+    }
+    for (const auto& source : kMutations) {
+        CheckThrows<RuntimeError>([&] { pool.Submit(source).get(); }, "request was allowed to run " + source);
+        CheckThrows<RuntimeError>([&] { prototype.Run(source); }, "prototype was allowed to run " + source);
+    }
+
+    Check(pool.Submit("shared").get() == "(1 2 3)\n", "shared list changed");
+    Check(pool.Submit("numbers").get() == "#(1 2 3)\n", "shared vector changed");
+    Check(pool.Submit("(hash-table-ref table 'a)").get() == "1\n", "shared hash table changed");
+    // Data made after forking belongs to a single interpreter and may be changed.
+    Check(pool.Submit("(define own (list 1 2)) (set-car! own 5) own").get() == "own\n()\n(5 2)\n",
+          "own list of a request can not be changed");
+    Check(pool.Submit("(define shared (list 1 2)) (set-car! shared 5) shared").get() == "shared\n()\n(5 2)\n",
+          "redefined list can not be changed");
+}
+
+void TestDataIsThawedWithForks(Engine engine) {
+    Interpreter prototype(engine);
+    prototype.Run("(define shared (list 1 2 3))");
+    auto change = [&prototype] { prototype.Run("(set-car! shared 10)"); };
+    {
+        InterpreterPool pool(&prototype, 2);
+        CheckThrows<RuntimeError>(change, "prototype changed data shared with a pool");
+    }
+    change();
+    Check(prototype.Run("shared") == "(10 2 3)", "data is frozen after the pool is destroyed");
+
+    // Forking freezes the data again, even though nothing was defined since the pool.
+    std::optional<Interpreter> fork = prototype.Fork();
+    CheckThrows<RuntimeError>(change, "prototype changed data shared with a fork");
+    fork->Run("(define own (vector 1))");
+    std::optional<Interpreter> nested = fork->Fork();
+    fork.reset();
+    CheckThrows<RuntimeError>(change, "prototype changed data shared with a fork of its fork");
+    Check(nested->Run("shared") == "(10 2 3)", "shared data changed under a fork of a fork");
+    nested.reset();
+    change();
+}
+
+//! Size of blocks nothing else in the test allocates, so the depot holds only what the test puts there.
+constexpr size_t kLateBlockSize = 15 * pool::kAlignment;
+using LatePool = pool::FixedPool<kLateBlockSize>;
+
+//! Frees its block when the thread exits. Made before the first allocation of the thread, it is destroyed after the
+//! pool has handed its free list to the depot.
+struct LateFree {
+    ~LateFree() {
+        LatePool::Deallocate(block);
+    }
+
+    void* block = nullptr;
+};
+
+void TestLateFreesReachDepot() {
+    void* freed = nullptr;
+    std::thread([&freed] {
+        static thread_local LateFree late_free;
+        late_free.block = freed = LatePool::Allocate();
+    }).join();
+    // The list of this thread is empty, so it takes the batch put to the depot last.
+    Check(LatePool::Allocate() == freed, "block freed after its thread exited is lost");
+}
+}  // namespace
+
+int main() {
+    TestSharedDataIsFrozen(Engine::TREE_WALKER);
+    TestSharedDataIsFrozen(Engine::BYTECODE);
+    TestDataIsThawedWithForks(Engine::TREE_WALKER);
+    TestDataIsThawedWithForks(Engine::BYTECODE);
+    TestLateFreesReachDepot();
+    return 0;
+}
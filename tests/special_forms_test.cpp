@@ -0,0 +1,40 @@
+#include "../src/error.h"
+#include "../src/scheme.h"
+#include "check.h"
+
+#include <string>
+
+namespace {
+//! Special forms are recognized by their bindings. Lambdas made before one is rebound must see the new binding too,
+//! whichever engine runs them.
+void TestRebinding(Engine engine) {
+    Interpreter interpreter(engine);
+    interpreter.Run("(define (f x) (if x 1 2))");
+    interpreter.Run("(define (make) (lambda (x) (if x 'yes 'no)))");
+    interpreter.Run("(define inner (make))");
+    interpreter.Run("(define (g) (and #f (car 1)))");
+    interpreter.Run("(define (h) (or #t (car 1)))");
+    interpreter.Run("(define x 1)");
+    interpreter.Run("(define (assign) (set! x 2))");
+    Check(interpreter.Run("(f #t)") == "1", "if does not work before it is rebound");
+    Check(interpreter.Run("(inner #f)") == "no", "if of a nested lambda does not work before it is rebound");
+    Check(interpreter.Run("(g)") == "#f", "and does not work before it is rebound");
+
+    interpreter.Run("(define if (lambda (a b c) 'custom))");
+    Check(interpreter.Run("(f #t)") == "custom", "lambda uses the old if");
+    Check(interpreter.Run("(inner #t)") == "custom", "nested lambda uses the old if");
+    interpreter.Run("(define and (lambda (a b) 'custom))");
+    CheckThrows<RuntimeError>([&] { interpreter.Run("(g)"); }, "lambda uses the old and");
+    interpreter.Run("(define or (lambda (a b) 'custom))");
+    CheckThrows<RuntimeError>([&] { interpreter.Run("(h)"); }, "lambda uses the old or");
+    interpreter.Run("(define set! (lambda (a b) (list 'custom a b)))");
+    Check(interpreter.Run("(assign)") == "(custom 1 2)", "lambda uses the old set!");
+    Check(interpreter.Run("x") == "1", "variable was assigned by the old set!");
+}
+}  // namespace
+
+int main() {
+    TestRebinding(Engine::TREE_WALKER);
+    TestRebinding(Engine::BYTECODE);
+    return 0;
+}